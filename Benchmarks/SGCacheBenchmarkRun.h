@@ -0,0 +1,61 @@
+//
+//  SGCacheBenchmarkRun.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+* Records one benchmark run: how long each fetch took to complete, grouped by
+* kind (eg. visible and prefetch), along with the process's peak memory and
+* the cache's disk and network traffic over the run.
+*
+* Results are logged, and appended as one JSON object per line to the file
+* named by the `SGCACHE_BENCHMARK_OUTPUT` environment variable, or to
+* `SGCacheBenchmarks.jsonl` in the temporary directory, so runs can be
+* compared over time. Recording is thread safe.
+*/
+
+@interface SGCacheBenchmarkRun : NSObject
+
+@property (nonatomic, readonly) NSString *name;
+
+/** The workload's settings, included in the results as is. Plist types only. */
+@property (nonatomic, copy) NSDictionary *parameters;
+
++ (instancetype)runWithName:(NSString *)name;
+
+/** Resets the cache metrics and starts the clock and memory sampling. */
+- (void)start;
+
+- (void)recordLatency:(NSTimeInterval)latency succeeded:(BOOL)succeeded
+      group:(NSString *)group;
+
+/** Counts a fetch that was given up on before it completed. */
+- (void)recordAbandonedInGroup:(NSString *)group;
+
+/** Adds a workload specific measurement to the results. Plist types only. */
+- (void)recordValue:(id)value forKey:(NSString *)key;
+
+/** Stops the clock and memory sampling. */
+- (void)finish;
+
+- (NSDictionary *)results;
+
+/** Logs the results and appends them to the output file. */
+- (void)report;
+
+@end
+
+/**
+* A seeded xorshift generator, so every run of a workload asks for the same
+* URLs in the same order.
+*/
+uint64_t SGCacheBenchmarkRandom(uint64_t *state);
+
+/**
+* Returns `count` indexes into `universe` items, drawn with probability
+* proportional to 1 / rank^exponent.
+*/
+NSArray <NSNumber *> *SGCacheBenchmarkZipfIndexes(NSUInteger count, NSUInteger universe,
+      double exponent, uint64_t seed);
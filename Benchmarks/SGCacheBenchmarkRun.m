@@ -0,0 +1,242 @@
+//
+//  SGCacheBenchmarkRun.m
+//  Pods
+//
+
+#import "SGCacheBenchmarkRun.h"
+#import "SGCacheMetrics.h"
+#import <QuartzCore/QuartzCore.h>
+#import <mach/mach.h>
+#import <sys/resource.h>
+
+#define MEMORY_SAMPLE_INTERVAL 0.01
+#define DEFAULT_OUTPUT_FILE_NAME @"SGCacheBenchmarks.jsonl"
+
+static uint64_t SGCacheBenchmarkFootprint(void) {
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.phys_footprint;
+}
+
+uint64_t SGCacheBenchmarkRandom(uint64_t *state) {
+    uint64_t x = *state ?: 0x9e3779b97f4a7c15ULL;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+NSArray <NSNumber *> *SGCacheBenchmarkZipfIndexes(NSUInteger count, NSUInteger universe,
+      double exponent, uint64_t seed) {
+    if (!universe) {
+        return @[];
+    }
+    double *cdf = malloc(universe * sizeof(double));
+    double sum = 0;
+    for (NSUInteger rank = 0; rank < universe; rank++) {
+        sum += 1.0 / pow(rank + 1, exponent);
+        cdf[rank] = sum;
+    }
+
+    NSMutableArray *indexes = [NSMutableArray arrayWithCapacity:count];
+    uint64_t state = seed;
+    for (NSUInteger i = 0; i < count; i++) {
+        double target = (SGCacheBenchmarkRandom(&state) >> 11) * 0x1.0p-53 * sum;
+        NSUInteger low = 0, high = universe - 1;
+        while (low < high) {
+            NSUInteger mid = (low + high) / 2;
+            if (cdf[mid] < target) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        [indexes addObject:@(low)];
+    }
+    free(cdf);
+    return indexes;
+}
+
+@interface SGCacheBenchmarkGroup : NSObject
+@property (nonatomic, strong) NSMutableArray <NSNumber *> *latencies;
+@property (nonatomic, assign) NSUInteger failed;
+@property (nonatomic, assign) NSUInteger abandoned;
+@end
+
+@implementation SGCacheBenchmarkGroup
+
+- (id)init {
+    self = [super init];
+    self.latencies = NSMutableArray.new;
+    return self;
+}
+
+- (NSDictionary *)resultsOverDuration:(NSTimeInterval)duration {
+    NSArray *sorted = [self.latencies sortedArrayUsingSelector:@selector(compare:)];
+    double (^percentile)(double) = ^double(double fraction) {
+        if (!sorted.count) {
+            return 0;
+        }
+        NSUInteger rank = (NSUInteger)ceil(fraction * sorted.count);
+        return [sorted[MAX(rank, 1) - 1] doubleValue];
+    };
+    return @{@"completed" : @(sorted.count), @"failed" : @(self.failed),
+          @"abandoned" : @(self.abandoned),
+          @"throughput" : @(duration > 0 ? sorted.count / duration : 0),
+          @"p50" : @(percentile(0.5)), @"p95" : @(percentile(0.95)),
+          @"p99" : @(percentile(0.99)), @"max" : @(percentile(1))};
+}
+
+@end
+
+@interface SGCacheBenchmarkRun ()
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, strong) NSMutableDictionary <NSString *, SGCacheBenchmarkGroup *> *groups;
+@property (nonatomic, strong) NSMutableDictionary *values;
+@property (nonatomic, strong) dispatch_source_t memorySampler;
+@property (nonatomic, assign) CFTimeInterval started;
+@property (nonatomic, assign) CFTimeInterval finished;
+@property (nonatomic, assign) uint64_t baselineFootprint;
+@property (nonatomic, assign) uint64_t peakFootprint;
+@property (nonatomic, assign) struct rusage startUsage;
+@property (nonatomic, assign) struct rusage endUsage;
+@property (nonatomic, strong) SGCacheMetricsSnapshot *metrics;
+@end
+
+@implementation SGCacheBenchmarkRun
+
++ (instancetype)runWithName:(NSString *)name {
+    SGCacheBenchmarkRun *run = self.new;
+    run.name = name;
+    run.groups = NSMutableDictionary.new;
+    run.values = NSMutableDictionary.new;
+    return run;
+}
+
+- (void)start {
+    [SGCacheMetrics.sharedMetrics reset];
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    self.startUsage = usage;
+    self.baselineFootprint = self.peakFootprint = SGCacheBenchmarkFootprint();
+
+    // the footprint is sampled, so a short lived spike between samples is missed
+    __weak SGCacheBenchmarkRun *me = self;
+    self.memorySampler = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0,
+          dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0));
+    dispatch_source_set_timer(self.memorySampler, DISPATCH_TIME_NOW,
+          (uint64_t)(MEMORY_SAMPLE_INTERVAL * NSEC_PER_SEC), NSEC_PER_MSEC);
+    dispatch_source_set_event_handler(self.memorySampler, ^{
+        [me sampleMemory];
+    });
+    dispatch_resume(self.memorySampler);
+    self.started = CACurrentMediaTime();
+}
+
+- (void)sampleMemory {
+    uint64_t footprint = SGCacheBenchmarkFootprint();
+    @synchronized (self) {
+        self.peakFootprint = MAX(self.peakFootprint, footprint);
+    }
+}
+
+- (void)finish {
+    self.finished = CACurrentMediaTime();
+    if (self.memorySampler) {
+        dispatch_source_cancel(self.memorySampler);
+        self.memorySampler = nil;
+    }
+    [self sampleMemory];
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    self.endUsage = usage;
+    self.metrics = SGCacheMetrics.sharedMetrics.snapshot;
+}
+
+#pragma mark - Recording
+
+- (SGCacheBenchmarkGroup *)group:(NSString *)name {
+    SGCacheBenchmarkGroup *group = self.groups[name];
+    if (!group) {
+        group = self.groups[name] = SGCacheBenchmarkGroup.new;
+    }
+    return group;
+}
+
+- (void)recordLatency:(NSTimeInterval)latency succeeded:(BOOL)succeeded
+      group:(NSString *)group {
+    @synchronized (self) {
+        if (succeeded) {
+            [[self group:group].latencies addObject:@(latency)];
+        } else {
+            [self group:group].failed++;
+        }
+    }
+}
+
+- (void)recordAbandonedInGroup:(NSString *)group {
+    @synchronized (self) {
+        [self group:group].abandoned++;
+    }
+}
+
+- (void)recordValue:(id)value forKey:(NSString *)key {
+    @synchronized (self) {
+        self.values[key] = value;
+    }
+}
+
+#pragma mark - Results
+
+- (NSDictionary *)results {
+    NSTimeInterval duration = (self.finished ?: CACurrentMediaTime()) - self.started;
+    NSMutableDictionary *groups = NSMutableDictionary.new;
+    NSDictionary *values;
+    uint64_t peak;
+    @synchronized (self) {
+        for (NSString *name in self.groups) {
+            groups[name] = [self.groups[name] resultsOverDuration:duration];
+        }
+        values = self.values.copy;
+        peak = self.peakFootprint;
+    }
+    SGCacheMetricsSnapshot *metrics = self.metrics ?: SGCacheMetrics.sharedMetrics.snapshot;
+    struct rusage start = self.startUsage, end = self.endUsage;
+
+    return @{@"name" : self.name, @"date" : @(NSDate.date.timeIntervalSince1970),
+          @"parameters" : self.parameters ?: @{}, @"duration" : @(duration),
+          @"groups" : groups, @"values" : values,
+          @"peakMemory" : @(peak),
+          @"memoryGrowth" : @(peak > self.baselineFootprint ? peak - self.baselineFootprint : 0),
+          @"diskBytesRead" : @([metrics valueForCounter:SGCacheCounterBytesRead]),
+          @"diskBytesWritten" : @([metrics valueForCounter:SGCacheCounterBytesWritten]),
+          @"blockReads" : @(end.ru_inblock - start.ru_inblock),
+          @"blockWrites" : @(end.ru_oublock - start.ru_oublock),
+          @"bytesDownloaded" : @([metrics valueForCounter:SGCacheCounterBytesDownloaded]),
+          @"metrics" : metrics.dictionaryRepresentation};
+}
+
+- (void)report {
+    NSData *json = [NSJSONSerialization dataWithJSONObject:self.results options:0 error:nil];
+    if (!json) {
+        return;
+    }
+    NSString *line = [NSString.alloc initWithData:json encoding:NSUTF8StringEncoding];
+    NSLog(@"SGCacheBenchmark %@", line);
+
+    NSString *path = NSProcessInfo.processInfo.environment[@"SGCACHE_BENCHMARK_OUTPUT"]
+          ?: [NSTemporaryDirectory() stringByAppendingPathComponent:DEFAULT_OUTPUT_FILE_NAME];
+    if (![NSFileManager.defaultManager fileExistsAtPath:path]) {
+        [NSData.data writeToFile:path atomically:YES];
+    }
+    NSFileHandle *file = [NSFileHandle fileHandleForWritingAtPath:path];
+    [file seekToEndOfFile];
+    [file writeData:json];
+    [file writeData:[@"\n" dataUsingEncoding:NSUTF8StringEncoding]];
+    [file closeFile];
+}
+
+@end
@@ -0,0 +1,62 @@
+//
+//  SGCacheKeyBenchmarks.m
+//  Pods
+//
+
+#import <XCTest/XCTest.h>
+#import <QuartzCore/QuartzCore.h>
+#import "SGCache.h"
+#import "SGCachePrivate.h"
+#import "SGCacheDigest.h"
+#import "SGCacheBenchmarkRun.h"
+
+#define KEY_COUNT 20000
+
+@interface SGCacheKeyBenchmarks : XCTestCase
+@end
+
+@implementation SGCacheKeyBenchmarks
+
+- (NSArray <NSString *> *)urls {
+    NSMutableArray *urls = [NSMutableArray arrayWithCapacity:KEY_COUNT];
+    for (NSUInteger i = 0; i < KEY_COUNT; i++) {
+        [urls addObject:[NSString stringWithFormat:
+              @"https://images.example.com/events/%lu/performers/hero.jpg?w=750&h=422",
+              (unsigned long)i]];
+    }
+    return urls;
+}
+
+// URL to digest, as each fetch does it, with the digest derived both ways
+- (void)testCacheKeyDerivation {
+    NSArray *urls = self.urls;
+    SGCache *cache = SGCache.cache;
+    __block uint8_t sink = 0;
+
+    double (^keysPerSecond)(SGCacheDigest (^)(NSString *)) = ^double(SGCacheDigest (^make)(NSString *)) {
+        CFTimeInterval started = CACurrentMediaTime();
+        for (NSString *url in urls) {
+            @autoreleasepool {
+                sink ^= make([cache cacheKeyFor:url requestHeaders:nil]).bytes[0];
+            }
+        }
+        return urls.count / (CACurrentMediaTime() - started);
+    };
+
+    SGCacheBenchmarkRun *run = [SGCacheBenchmarkRun runWithName:@"cacheKeys"];
+    run.parameters = @{@"keys" : @(KEY_COUNT)};
+    [run start];
+    double legacy = keysPerSecond(^SGCacheDigest(NSString *key) {
+        return SGCacheDigestMakeLegacy(key);
+    });
+    double current = keysPerSecond(^SGCacheDigest(NSString *key) {
+        return SGCacheDigestMake(key);
+    });
+    [run finish];
+    [run recordValue:@(legacy) forKey:@"legacyKeysPerSecond"];
+    [run recordValue:@(current) forKey:@"keysPerSecond"];
+    [run recordValue:@(sink) forKey:@"sink"];
+    [run report];
+}
+
+@end
@@ -0,0 +1,276 @@
+//
+//  SGCacheWorkloadBenchmarks.m
+//  Pods
+//
+
+#import <XCTest/XCTest.h>
+#import <QuartzCore/QuartzCore.h>
+#import "SGCache.h"
+#import "SGCachePrefetch.h"
+#import "SGCacheCircuitBreaker.h"
+#import "SGTestHTTPServer.h"
+#import "SGCacheBenchmarkRun.h"
+
+#define SERVER_LATENCY 0.02
+#define SERVER_BYTES_PER_SECOND (2 * 1024 * 1024)
+#define SERVER_ERROR_RATE 0.01
+#define MIN_FILE_SIZE (8 * 1024)
+#define MAX_FILE_SIZE (96 * 1024)
+#define WORKLOAD_SEED 20150513
+#define RUN_TIMEOUT 300.0
+
+#define ZIPF_REQUESTS 2000
+#define ZIPF_CATALOGUE_SIZE 500
+#define ZIPF_EXPONENT 1.0
+#define ZIPF_WINDOW 16
+
+#define SCROLL_SCREENS 40
+#define SCROLL_CELLS_PER_SCREEN 12
+#define SCROLL_SCREEN_INTERVAL 0.1
+#define SCROLL_SCREENS_KEPT 3
+
+#define MIX_PREFETCH_COUNT 300
+#define MIX_VISIBLE_ROUNDS 10
+#define MIX_VISIBLE_PER_ROUND 12
+#define MIX_ROUND_INTERVAL 0.5
+
+typedef void(^SGCacheBenchmarkSettled)(BOOL succeeded, NSTimeInterval latency);
+
+@interface SGCacheWorkloadBenchmarks : XCTestCase
+@property (nonatomic, strong) SGTestHTTPServer *server;
+@property (nonatomic, strong) NSData *blob;
+@property (nonatomic, assign) uint64_t random;
+@end
+
+@implementation SGCacheWorkloadBenchmarks
+
+- (void)setUp {
+    [super setUp];
+    self.server = SGTestHTTPServer.server;
+    self.server.latency = SERVER_LATENCY;
+    self.server.bytesPerSecond = SERVER_BYTES_PER_SECOND;
+    self.server.errorRate = SERVER_ERROR_RATE;
+    [SGCacheCircuitBreaker.sharedBreaker recordSuccessForHost:@"127.0.0.1"];
+
+    self.random = WORKLOAD_SEED;
+    NSMutableData *blob = [NSMutableData dataWithLength:MAX_FILE_SIZE];
+    arc4random_buf(blob.mutableBytes, blob.length);
+    self.blob = blob;
+}
+
+- (void)tearDown {
+    [self.server stop];
+    [super tearDown];
+}
+
+#pragma mark - Helpers
+
+- (NSDictionary *)serverParameters {
+    return @{@"latency" : @(SERVER_LATENCY), @"bytesPerSecond" : @(SERVER_BYTES_PER_SECOND),
+          @"errorRate" : @(SERVER_ERROR_RATE), @"minFileSize" : @(MIN_FILE_SIZE),
+          @"maxFileSize" : @(MAX_FILE_SIZE)};
+}
+
+// paths are unique to the run, so nothing starts out cached. sizes follow the seed
+- (NSArray <NSString *> *)catalogueOfSize:(NSUInteger)size {
+    NSString *run = NSUUID.UUID.UUIDString;
+    NSMutableArray *urls = [NSMutableArray arrayWithCapacity:size];
+    uint64_t state = self.random;
+    for (NSUInteger i = 0; i < size; i++) {
+        NSString *path = [NSString stringWithFormat:@"/%@/%lu", run, (unsigned long)i];
+        NSUInteger length = MIN_FILE_SIZE
+              + SGCacheBenchmarkRandom(&state) % (MAX_FILE_SIZE - MIN_FILE_SIZE);
+        [self.server serveData:[self.blob subdataWithRange:NSMakeRange(0, length)] forPath:path];
+        [urls addObject:[self.server URLForPath:path]];
+    }
+    self.random = state;
+    return urls;
+}
+
+- (SGCachePromise *)fetchURL:(NSString *)url then:(SGCacheBenchmarkSettled)settled {
+    CFTimeInterval started = CACurrentMediaTime();
+    SGCachePromise *promise = [SGCache getFileForURL:url];
+    promise.then(^(NSData *data) {
+        settled(!!data, CACurrentMediaTime() - started);
+    }).catch(^(NSError *error) {
+        settled(NO, CACurrentMediaTime() - started);
+    });
+    return promise;
+}
+
+// keeps `window` fetches in flight until every URL has been asked for
+- (void)fetchURLs:(NSArray <NSString *> *)urls window:(NSUInteger)window
+      run:(SGCacheBenchmarkRun *)run group:(NSString *)group {
+    XCTestExpectation *done = [self expectationWithDescription:group];
+    __block NSUInteger next = 0, settledCount = 0;
+    __block void (^issue)(void);
+    issue = ^{
+        [self fetchURL:urls[next++] then:^(BOOL succeeded, NSTimeInterval latency) {
+            [run recordLatency:latency succeeded:succeeded group:group];
+            if (next < urls.count) {
+                issue();
+            }
+            if (++settledCount == urls.count) {
+                issue = nil;
+                [done fulfill];
+            }
+        }];
+    };
+    for (NSUInteger i = 0; i < MIN(window, urls.count); i++) {
+        issue();
+    }
+    [self waitForExpectationsWithTimeout:RUN_TIMEOUT handler:nil];
+}
+
+- (void)finishRun:(SGCacheBenchmarkRun *)run {
+    [run finish];
+    [run recordValue:@(self.server.requestCount) forKey:@"serverRequests"];
+    [run report];
+}
+
+#pragma mark - Workloads
+
+// a few popular files asked for over and over, and a long tail asked for once
+- (void)testZipfWorkload {
+    NSArray *catalogue = [self catalogueOfSize:ZIPF_CATALOGUE_SIZE];
+    NSMutableArray *urls = NSMutableArray.new;
+    for (NSNumber *index in SGCacheBenchmarkZipfIndexes(ZIPF_REQUESTS, catalogue.count,
+          ZIPF_EXPONENT, WORKLOAD_SEED)) {
+        [urls addObject:catalogue[index.unsignedIntegerValue]];
+    }
+
+    SGCacheBenchmarkRun *run = [SGCacheBenchmarkRun runWithName:@"zipf"];
+    NSMutableDictionary *parameters = self.serverParameters.mutableCopy;
+    [parameters addEntriesFromDictionary:@{@"requests" : @(ZIPF_REQUESTS),
+          @"catalogueSize" : @(ZIPF_CATALOGUE_SIZE), @"exponent" : @(ZIPF_EXPONENT),
+          @"window" : @(ZIPF_WINDOW)}];
+    run.parameters = parameters;
+
+    [run start];
+    [self fetchURLs:urls window:ZIPF_WINDOW run:run group:@"all"];
+    [self finishRun:run];
+}
+
+// a list flicked through quickly. each screen's cells are asked for at once,
+// and given up on once they've scrolled well out of view
+- (void)testScrollBurstWorkload {
+    NSArray *catalogue = [self catalogueOfSize:SCROLL_SCREENS * SCROLL_CELLS_PER_SCREEN];
+    SGCacheBenchmarkRun *run = [SGCacheBenchmarkRun runWithName:@"scrollBurst"];
+    NSMutableDictionary *parameters = self.serverParameters.mutableCopy;
+    [parameters addEntriesFromDictionary:@{@"screens" : @(SCROLL_SCREENS),
+          @"cellsPerScreen" : @(SCROLL_CELLS_PER_SCREEN),
+          @"screenInterval" : @(SCROLL_SCREEN_INTERVAL),
+          @"screensKept" : @(SCROLL_SCREENS_KEPT)}];
+    run.parameters = parameters;
+
+    XCTestExpectation *done = [self expectationWithDescription:@"scrolled"];
+    NSMutableArray <NSMutableArray *> *screens = NSMutableArray.new;
+    NSMutableSet *pending = NSMutableSet.new;
+    __block BOOL scrolled = NO;
+
+    __block void (^showScreen)(NSUInteger);
+    showScreen = ^(NSUInteger screen) {
+        // the screen that's now far enough away stops waiting on its cells
+        if (screen >= SCROLL_SCREENS_KEPT) {
+            for (SGCachePromise *promise in screens[screen - SCROLL_SCREENS_KEPT]) {
+                if ([pending containsObject:promise]) {
+                    [pending removeObject:promise];
+                    [run recordAbandonedInGroup:@"visible"];
+                    [SGCache unsubscribeFromPromise:promise];
+                }
+            }
+        }
+        if (screen == SCROLL_SCREENS) {
+            scrolled = YES;
+            showScreen = nil;
+            if (!pending.count) {
+                [done fulfill];
+            }
+            return;
+        }
+
+        NSMutableArray *promises = NSMutableArray.new;
+        [screens addObject:promises];
+        for (NSUInteger cell = 0; cell < SCROLL_CELLS_PER_SCREEN; cell++) {
+            __block SGCachePromise *promise;
+            promise = [self fetchURL:catalogue[screen * SCROLL_CELLS_PER_SCREEN + cell]
+                  then:^(BOOL succeeded, NSTimeInterval latency) {
+                if (![pending containsObject:promise]) {
+                    return; // given up on already
+                }
+                [pending removeObject:promise];
+                [run recordLatency:latency succeeded:succeeded group:@"visible"];
+                if (scrolled && !pending.count) {
+                    [done fulfill];
+                }
+            }];
+            [pending addObject:promise];
+            [promises addObject:promise];
+        }
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW,
+              (int64_t)(SCROLL_SCREEN_INTERVAL * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            void (^next)(NSUInteger) = showScreen; // kept alive while it runs
+            next(screen + 1);
+        });
+    };
+
+    [run start];
+    showScreen(0);
+    [self waitForExpectationsWithTimeout:RUN_TIMEOUT handler:nil];
+    [self finishRun:run];
+}
+
+// a big prefetch batch running while the user keeps bringing new files on screen
+- (void)testPrefetchWithVisibleWorkload {
+    NSArray *prefetched = [self catalogueOfSize:MIX_PREFETCH_COUNT];
+    NSArray *visible = [self catalogueOfSize:MIX_VISIBLE_ROUNDS * MIX_VISIBLE_PER_ROUND];
+    SGCacheBenchmarkRun *run = [SGCacheBenchmarkRun runWithName:@"prefetchWithVisible"];
+    NSMutableDictionary *parameters = self.serverParameters.mutableCopy;
+    [parameters addEntriesFromDictionary:@{@"prefetchCount" : @(MIX_PREFETCH_COUNT),
+          @"visibleRounds" : @(MIX_VISIBLE_ROUNDS),
+          @"visiblePerRound" : @(MIX_VISIBLE_PER_ROUND),
+          @"roundInterval" : @(MIX_ROUND_INTERVAL)}];
+    run.parameters = parameters;
+
+    XCTestExpectation *prefetchDone = [self expectationWithDescription:@"prefetched"];
+    XCTestExpectation *visibleDone = [self expectationWithDescription:@"visible"];
+    visibleDone.expectedFulfillmentCount = visible.count;
+
+    [run start];
+    CFTimeInterval started = CACurrentMediaTime();
+    __block NSUInteger settled = 0;
+    __block BOOL finished = NO;
+    SGCachePrefetch *prefetch = [SGCache prefetchFilesForURLs:prefetched];
+    prefetch.onProgress = ^(SGCachePrefetch *prefetch) {
+        // each progress call covers the files finished since the last
+        NSTimeInterval latency = CACurrentMediaTime() - started;
+        for (; settled < prefetch.completed; settled++) {
+            [run recordLatency:latency succeeded:YES group:@"prefetch"];
+        }
+        if (prefetch.finished && !finished) {
+            finished = YES;
+            for (NSUInteger i = 0; i < prefetch.failed; i++) {
+                [run recordLatency:latency succeeded:NO group:@"prefetch"];
+            }
+            [prefetchDone fulfill];
+        }
+    };
+
+    for (NSUInteger round = 0; round < MIX_VISIBLE_ROUNDS; round++) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW,
+              (int64_t)(round * MIX_ROUND_INTERVAL * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            for (NSUInteger i = 0; i < MIX_VISIBLE_PER_ROUND; i++) {
+                [self fetchURL:visible[round * MIX_VISIBLE_PER_ROUND + i]
+                      then:^(BOOL succeeded, NSTimeInterval latency) {
+                    [run recordLatency:latency succeeded:succeeded group:@"visible"];
+                    [visibleDone fulfill];
+                }];
+            }
+        });
+    }
+
+    [self waitForExpectationsWithTimeout:RUN_TIMEOUT handler:nil];
+    [self finishRun:run];
+}
+
+@end
@@ -0,0 +1,116 @@
+//
+//  SGImageCacheHitBenchmarks.m
+//  Pods
+//
+
+#import <XCTest/XCTest.h>
+#import <QuartzCore/QuartzCore.h>
+#import <malloc/malloc.h>
+#import "SGImageCache.h"
+#import "SGCachePrivate.h"
+#import "SGCacheBenchmarkRun.h"
+
+#define MEMORY_HITS 20000
+#define DISK_HITS 200
+#define IMAGE_SIZE 64
+#define STORE_TIMEOUT 10.0
+#define RUN_TIMEOUT 60.0
+
+@interface SGImageCacheHitBenchmarks : XCTestCase
+@end
+
+@implementation SGImageCacheHitBenchmarks
+
+- (UIImage *)image {
+    UIGraphicsBeginImageContextWithOptions(CGSizeMake(IMAGE_SIZE, IMAGE_SIZE), YES, 1);
+    [[UIColor colorWithHue:arc4random_uniform(360) / 360.0 saturation:1 brightness:1 alpha:1] setFill];
+    UIRectFill(CGRectMake(0, 0, IMAGE_SIZE, IMAGE_SIZE));
+    UIImage *image = UIGraphicsGetImageFromCurrentImageContext();
+    UIGraphicsEndImageContext();
+    return image;
+}
+
+- (NSArray <NSString *> *)storeImages:(NSUInteger)count {
+    NSMutableArray *urls = NSMutableArray.new;
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *url = [NSString stringWithFormat:@"https://images.example.com/%@.png",
+              NSUUID.UUID.UUIDString];
+        [SGImageCache addImage:self.image forURL:url];
+        [urls addObject:url];
+    }
+
+    // disk writes happen in the background
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:STORE_TIMEOUT];
+    for (NSString *url in urls) {
+        while (![SGImageCache haveImageForURL:url] && deadline.timeIntervalSinceNow > 0) {
+            [NSRunLoop.currentRunLoop runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+        }
+    }
+    return urls;
+}
+
+static size_t SGImageCacheBlocksInUse(void) {
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+    return stats.blocks_in_use;
+}
+
+// A memory hit resolves its promise without queueing a task or reading the
+// disk. The disk hits below are what every hit used to cost. Blocks in use
+// are counted before the autorelease pool drains, as a rough allocation count.
+- (void)testMemoryHitCost {
+    NSString *hitURL = [self storeImages:1].firstObject;
+    NSArray *diskURLs = [self storeImages:DISK_HITS];
+    for (NSString *url in diskURLs) {
+        [SGImageCache.globalMemCache removeObjectForKey:[SGImageCache.cache cacheKeyFor:url
+              requestHeaders:nil]];
+    }
+
+    SGCacheBenchmarkRun *run = [SGCacheBenchmarkRun runWithName:@"imageCacheHits"];
+    run.parameters = @{@"memoryHits" : @(MEMORY_HITS), @"diskHits" : @(DISK_HITS),
+          @"imageSize" : @(IMAGE_SIZE)};
+    [run start];
+
+    // timings go in a plain buffer, so recording them doesn't count as allocations
+    double *latencies = malloc(MEMORY_HITS * sizeof(double));
+    long blocks;
+    @autoreleasepool {
+        long before = (long)SGImageCacheBlocksInUse();
+        for (NSUInteger i = 0; i < MEMORY_HITS; i++) {
+            CFTimeInterval started = CACurrentMediaTime();
+            [SGImageCache getImageForURL:hitURL];
+            latencies[i] = CACurrentMediaTime() - started;
+        }
+        blocks = (long)SGImageCacheBlocksInUse() - before;
+    }
+    for (NSUInteger i = 0; i < MEMORY_HITS; i++) {
+        [run recordLatency:latencies[i] succeeded:YES group:@"memory"];
+    }
+    free(latencies);
+    [run recordValue:@((double)blocks / MEMORY_HITS) forKey:@"memoryHitBlocks"];
+
+    // one at a time, so each is timed on its own
+    XCTestExpectation *done = [self expectationWithDescription:@"disk hits"];
+    __block NSUInteger next = 0;
+    __block void (^fetch)(void);
+    fetch = ^{
+        if (next == diskURLs.count) {
+            fetch = nil;
+            [done fulfill];
+            return;
+        }
+        CFTimeInterval started = CACurrentMediaTime();
+        [SGImageCache getImageForURL:diskURLs[next++]].then(^(UIImage *image) {
+            [run recordLatency:CACurrentMediaTime() - started succeeded:!!image group:@"disk"];
+            void (^again)(void) = fetch; // kept alive while it runs
+            again();
+        });
+    };
+    fetch();
+    [self waitForExpectationsWithTimeout:RUN_TIMEOUT handler:nil];
+
+    [run finish];
+    [run report];
+}
+
+@end
@@ -0,0 +1,151 @@
+//
+//  SGImageCacheVisibleBenchmarks.m
+//  Pods
+//
+
+#import <XCTest/XCTest.h>
+#import <QuartzCore/QuartzCore.h>
+#import "SGImageCache.h"
+#import "SGCachePrefetch.h"
+#import "SGCacheCircuitBreaker.h"
+#import "SGTestHTTPServer.h"
+#import "SGCacheBenchmarkRun.h"
+
+#define SERVER_LATENCY 0.02
+#define SERVER_BYTES_PER_SECOND (4 * 1024 * 1024)
+#define IMAGE_WIDTH 750
+#define IMAGE_HEIGHT 422
+#define IMAGE_VARIANTS 8
+#define JPEG_QUALITY 0.8
+#define RUN_TIMEOUT 300.0
+
+#define PREFETCH_COUNT 300
+#define VISIBLE_ROUNDS 10
+#define VISIBLE_PER_ROUND 12
+#define PROMOTED_PER_ROUND 4
+#define ROUND_INTERVAL 0.5
+
+@interface SGImageCacheVisibleBenchmarks : XCTestCase
+@property (nonatomic, strong) SGTestHTTPServer *server;
+@property (nonatomic, strong) NSArray <NSData *> *jpegs;
+@end
+
+@implementation SGImageCacheVisibleBenchmarks
+
+- (void)setUp {
+    [super setUp];
+    self.server = SGTestHTTPServer.server;
+    self.server.latency = SERVER_LATENCY;
+    self.server.bytesPerSecond = SERVER_BYTES_PER_SECOND;
+    [SGCacheCircuitBreaker.sharedBreaker recordSuccessForHost:@"127.0.0.1"];
+
+    // a handful of real photos' worth of pixels, so decoding costs what it would
+    NSMutableArray *jpegs = NSMutableArray.new;
+    CGSize size = CGSizeMake(IMAGE_WIDTH, IMAGE_HEIGHT);
+    for (NSUInteger i = 0; i < IMAGE_VARIANTS; i++) {
+        UIGraphicsBeginImageContextWithOptions(size, YES, 1);
+        for (NSUInteger band = 0; band < IMAGE_HEIGHT; band += 2) {
+            [[UIColor colorWithHue:(i * IMAGE_HEIGHT + band) % 360 / 360.0 saturation:0.8
+                  brightness:0.9 alpha:1] setFill];
+            UIRectFill(CGRectMake(0, band, IMAGE_WIDTH, 2));
+        }
+        [jpegs addObject:UIImageJPEGRepresentation(UIGraphicsGetImageFromCurrentImageContext(),
+              JPEG_QUALITY)];
+        UIGraphicsEndImageContext();
+    }
+    self.jpegs = jpegs;
+}
+
+- (void)tearDown {
+    [self.server stop];
+    [super tearDown];
+}
+
+#pragma mark - Helpers
+
+// paths are unique to the run, so nothing starts out cached
+- (NSArray <NSString *> *)imagesOfCount:(NSUInteger)count {
+    NSString *run = NSUUID.UUID.UUIDString;
+    NSMutableArray *urls = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *path = [NSString stringWithFormat:@"/%@/%lu.jpg", run, (unsigned long)i];
+        [self.server serveData:self.jpegs[i % self.jpegs.count] forPath:path];
+        [urls addObject:[self.server URLForPath:path]];
+    }
+    return urls;
+}
+
+// from asking to holding a decoded image on the main thread, which is when an
+// image view would show it
+- (void)showImageForURL:(NSString *)url run:(SGCacheBenchmarkRun *)run
+      group:(NSString *)group then:(void (^)(void))done {
+    CFTimeInterval started = CACurrentMediaTime();
+    [SGImageCache getImageForURL:url].then(^(UIImage *image) {
+        [run recordLatency:CACurrentMediaTime() - started succeeded:!!image group:group];
+        done();
+    }).catch(^(NSError *error) {
+        [run recordLatency:CACurrentMediaTime() - started succeeded:NO group:group];
+        done();
+    });
+}
+
+#pragma mark - Workloads
+
+// a big image prefetch running while new images keep coming on screen. some of
+// them are already being prefetched, so they're merged into the prefetch's task
+// and raised to the visible priority
+- (void)testTimeToVisibleImageUnderPrefetchLoad {
+    NSArray *prefetched = [self imagesOfCount:PREFETCH_COUNT];
+    NSArray *visible = [self imagesOfCount:VISIBLE_ROUNDS * VISIBLE_PER_ROUND];
+    SGCacheBenchmarkRun *run = [SGCacheBenchmarkRun runWithName:@"imageTimeToVisible"];
+    run.parameters = @{@"latency" : @(SERVER_LATENCY),
+          @"bytesPerSecond" : @(SERVER_BYTES_PER_SECOND),
+          @"imageWidth" : @(IMAGE_WIDTH), @"imageHeight" : @(IMAGE_HEIGHT),
+          @"prefetchCount" : @(PREFETCH_COUNT), @"visibleRounds" : @(VISIBLE_ROUNDS),
+          @"visiblePerRound" : @(VISIBLE_PER_ROUND),
+          @"promotedPerRound" : @(PROMOTED_PER_ROUND), @"roundInterval" : @(ROUND_INTERVAL)};
+
+    XCTestExpectation *prefetchDone = [self expectationWithDescription:@"prefetched"];
+    XCTestExpectation *visibleDone = [self expectationWithDescription:@"visible"];
+    visibleDone.expectedFulfillmentCount = VISIBLE_ROUNDS
+          * (VISIBLE_PER_ROUND + PROMOTED_PER_ROUND);
+
+    [run start];
+    __block BOOL finished = NO;
+    SGCachePrefetch *prefetch = [SGImageCache prefetchImagesForURLs:prefetched];
+    prefetch.onProgress = ^(SGCachePrefetch *prefetch) {
+        if (prefetch.finished && !finished) {
+            finished = YES;
+            [prefetchDone fulfill];
+        }
+    };
+
+    // promoted images are picked from the back of the batch, so they're still
+    // waiting behind the rest of the prefetch when they come on screen
+    for (NSUInteger round = 0; round < VISIBLE_ROUNDS; round++) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW,
+              (int64_t)(round * ROUND_INTERVAL * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            for (NSUInteger i = 0; i < VISIBLE_PER_ROUND; i++) {
+                [self showImageForURL:visible[round * VISIBLE_PER_ROUND + i] run:run
+                      group:@"visible" then:^{
+                    [visibleDone fulfill];
+                }];
+            }
+            for (NSUInteger i = 0; i < PROMOTED_PER_ROUND; i++) {
+                NSUInteger index = prefetched.count - 1 - (round * PROMOTED_PER_ROUND + i);
+                [self showImageForURL:prefetched[index] run:run group:@"promoted" then:^{
+                    [visibleDone fulfill];
+                }];
+            }
+        });
+    }
+
+    [self waitForExpectationsWithTimeout:RUN_TIMEOUT handler:nil];
+    [run finish];
+    [run recordValue:@(prefetch.completed) forKey:@"prefetchCompleted"];
+    [run recordValue:@(prefetch.failed) forKey:@"prefetchFailed"];
+    [run recordValue:@(self.server.requestCount) forKey:@"serverRequests"];
+    [run report];
+}
+
+@end
@@ -7,6 +7,7 @@
 //
 
 #import "NSString+SGImageCacheHash.h"
+#import "SGCacheDigest.h"
 #import <CommonCrypto/CommonDigest.h>
 
 @implementation NSString (SGImageCacheHash)
@@ -15,17 +16,12 @@
     if (!self.length) {
         return @"";
     }
-    NSData *data = [self dataUsingEncoding:NSUTF8StringEncoding];
     uint8_t digest[CC_SHA1_DIGEST_LENGTH];
+    SGCacheSHA1(self, digest);
 
-    CC_SHA1(data.bytes, (CC_LONG)data.length, digest);
-
-    NSMutableString *output = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
-
-    for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
-        [output appendFormat:@"%02x", digest[i]];
-    }
-    return output;
+    char hex[CC_SHA1_DIGEST_LENGTH * 2];
+    SGCacheHexEncode(digest, CC_SHA1_DIGEST_LENGTH, hex);
+    return [[NSString alloc] initWithBytes:hex length:sizeof(hex) encoding:NSASCIIStringEncoding];
 }
 
 @end
@@ -4,6 +4,8 @@
 
 #import <UIKit/UIKit.h>
 #import "SGCachePromise.h"
+#import "SGCachePrefetch.h"
+#import "SGCacheMetrics.h"
 
 typedef NS_OPTIONS(NSInteger, SGImageCacheLogging) {SGImageCacheLogNothing = 0,
     SGImageCacheLogRequests = 1 << 0,
@@ -12,6 +14,30 @@ typedef NS_OPTIONS(NSInteger, SGImageCacheLogging) {SGImageCacheLogNothing = 0,
     SGImageCacheLogMemoryFlushing = 1 << 3,
     SGImageCacheLogAll = (SGImageCacheLogRequests | SGImageCacheLogResponses | SGImageCacheLogErrors | SGImageCacheLogMemoryFlushing)};
 
+/**
+* How a cache stores its entries on disk.
+*
+* - `SGCacheStorageFiles` stores each entry in its own file.
+* - `SGCacheStoragePacked` appends small entries to shared pack files, which
+*   makes writes and reads of thumbnail sized entries cheaper. Larger entries
+*   are still stored in their own files.
+*/
+typedef NS_ENUM(NSInteger, SGCacheStorage) {SGCacheStorageFiles = 0,
+    SGCacheStoragePacked = 1};
+
+/**
+* How urgently a fetch is wanted.
+*
+* `SGCachePriorityPrefetch` and `SGCachePriorityLow` fetches run on <slowQueue>,
+* `SGCachePriorityNormal` and `SGCachePriorityHigh` fetches on <fastQueue>.
+* Within a queue, higher priority fetches start first, and in flight downloads
+* get a matching share of the connection.
+*/
+typedef NS_ENUM(NSInteger, SGCachePriority) {SGCachePriorityPrefetch = 0,
+    SGCachePriorityLow = 1,
+    SGCachePriorityNormal = 2,
+    SGCachePriorityHigh = 3};
+
 #ifndef __weakSelf
 #define __weakSelf __weak typeof(self)
 #endif
@@ -110,6 +136,9 @@ the promise will resolve when the existing task completes.
  existing task completes.
  - If the URL is already in <slowQueue> it will be moved to <fastQueue> and
  the promise will resolve when the existing task completes.
+ - If the file is already cached with an ETag or Last-Modified date, the
+ request is made conditional. If the server replies that the file hasn't
+ changed, the promise resolves with the cached file without downloading it.
  */
 + (SGCachePromise *)getRemoteFileForURL:(NSString *)url;
 
@@ -200,7 +229,31 @@ resolve when the existing task completes.
       cacheKey:(NSString *)cacheKey;
 
 /**
-* Move an image fetch task from <fastQueue> to <slowQueue>.
+Warm the cache with a batch of files. Returns a handle which reports the
+batch's progress and can cancel it.
+
+    SGCachePrefetch *prefetch = [SGCache prefetchFilesForURLs:urls];
+    prefetch.onProgress = ^(SGCachePrefetch *prefetch) {
+        NSLog(@"%.0f%% done", prefetch.progress * 100);
+    };
+
+- Cache keys are computed once, and files already cached are skipped.
+- Files already queued or in progress join the existing task.
+- The remaining files are added to <slowQueue> in a single pass.
+*/
++ (SGCachePrefetch *)prefetchFilesForURLs:(NSArray <NSString *> *)urls;
+
+/**
+Warm the cache with a batch of files, sending HTTP headers with each request
+and queueing the fetches at the given priority.
+*/
++ (SGCachePrefetch *)prefetchFilesForURLs:(NSArray <NSString *> *)urls
+                           requestHeaders:(NSDictionary *)headers
+                                 priority:(SGCachePriority)priority;
+
+/**
+* Move an image fetch task from <fastQueue> to <slowQueue>. Equivalent to
+* setting `SGCachePriorityPrefetch`.
 */
 + (void)moveTaskToSlowQueueForURL:(NSString *)url;
 
@@ -215,6 +268,36 @@ resolve when the existing task completes.
 */
 + (void)moveTaskToSlowQueueForCacheKey:(NSString *)cacheKey;
 
+/**
+* Tell the cache that the result of a fetch promise is no longer wanted.
+*
+* Every fetch call, prefetch batch and image view waiting on a fetch counts as
+* a subscriber. When the last one unsubscribes the fetch is cancelled, along
+* with its download, after the unsubscribe grace period.
+*/
++ (void)unsubscribeFromPromise:(SGCachePromise *)promise;
+
+/**
+* Change the priority of a queued or in progress fetch.
+*
+* A fetch that has started keeps its download and has its priority changed
+* in place. A fetch that hasn't started yet is moved to the queue for the new
+* priority if needed, keeping its completions and promise.
+*/
++ (void)setPriority:(SGCachePriority)priority forURL:(NSString *)url;
+
+/**
+* Change the priority of a queued or in progress fetch identified by URL and
+* HTTP request headers.
+*/
++ (void)setPriority:(SGCachePriority)priority forURL:(NSString *)url
+      requestHeaders:(NSDictionary *)headers;
+
+/**
+* Change the priority of a queued or in progress fetch identified by cache key.
+*/
++ (void)setPriority:(SGCachePriority)priority forCacheKey:(NSString *)cacheKey;
+
 #pragma mark - House Keeping
 
 /** @name House keeping */
@@ -222,9 +305,46 @@ resolve when the existing task completes.
 /**
 * Delete files from cache older than a specified age, based on the date at
 * which the file was added to the cache.
+*
+* Files are deleted gradually on a low priority background queue. Fetches
+* continue while the flush is in progress, and files for queued or in
+* progress fetches are left alone.
 */
 + (void)flushFilesOlderThan:(NSTimeInterval)age;
 
+/**
+* Set the disk cache size in MB (defaults to 200MB). When a write takes the
+* cache over this size, the least recently used files are evicted.
+*/
++ (void)setDiskCacheSize:(NSUInteger)megaBytes;
+
+/**
+* Set how entries are stored on disk (defaults to SGCacheStorageFiles).
+* Entries written under either storage remain readable after changing it.
+*/
++ (void)setStorage:(SGCacheStorage)storage;
+
+/**
+* Set whether remote files are written to disk as they download, rather than
+* held in memory until complete (defaults to YES).
+*/
++ (void)setStreamsDownloads:(BOOL)stream;
+
+/**
+* Set how long a fetch is kept alive after its last subscriber unsubscribes
+* (defaults to 0). A request for the same file within this period picks the
+* fetch back up instead of starting again.
+*/
++ (void)setUnsubscribeGracePeriod:(NSTimeInterval)seconds;
+
+/**
+* Set whether remote fetches ([getRemoteFileForURL:](<+[SGCache getRemoteFileForURL:]>))
+* of a cached file are skipped while the file is within the Cache-Control
+* max-age its server gave (defaults to NO). Once the max-age has passed, the
+* file is revalidated with a conditional request as usual.
+*/
++ (void)setSkipsRefreshWhileFresh:(BOOL)skip;
+
 #pragma mark - Operation Queues
 
 /** @name Operation queues */
@@ -232,7 +352,9 @@ resolve when the existing task completes.
 /**
 * The operation queue used for non urgent file fetches
 * ([slowGetFileForURL:](<+[SGCache slowGetFileForURL:]>)).
-* By default this is a serial queue.
+* By default this is a serial queue. It keeps running while <fastQueue> is
+* busy, so prefetching always makes progress, but its downloads are given a
+* low share of the connection.
 */
 @property (nonatomic, strong) NSOperationQueue *slowQueue;
 
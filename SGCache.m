@@ -5,12 +5,35 @@
 #import <MGEvents/MGEvents.h>
 #import "SGCache.h"
 #import "SGCacheTask.h"
+#import "SGCacheTaskPrivate.h"
 #import "SGCachePrivate.h"
 #import "SGCachePromise.h"
+#import "SGCacheTaskRegistry.h"
+#import "SGCacheIndex.h"
+#import "SGCachePackStore.h"
+#import "SGCachePrefetchPrivate.h"
+#import "SGCacheEntryMetadata.h"
+#import "SGCacheMetricsPrivate.h"
+#import "SGCacheDelivery.h"
 #import "NSString+SGImageCacheHash.h"
 
 #define FOLDER_NAME @"SGCache"
 #define MAX_RETRIES 5
+#define INDEX_FILE_NAME @".sgindex"
+#define SHARDED_MARKER_FILE_NAME @".sharded"
+#define LEGACY_HASH_LENGTH 40
+#define PACKS_FOLDER_NAME @".packs"
+#define MAX_PACKED_ENTRY_SIZE (64 * 1024)
+#define DOWNLOADS_FOLDER_NAME @".downloads"
+#define METADATA_FOLDER_NAME @".meta"
+#define PARTIAL_DOWNLOAD_MAX_AGE (24 * 60 * 60)
+#define DEFAULT_DISK_CACHE_SIZE 200000000
+#define EVICTION_SLICE_DURATION 0.004
+#define EVICTION_SLICE_INTERVAL 0.05
+#define EVICTION_BATCH_SIZE 64
+#define MAX_PINNED_SKIPS 32
+#define RETRY_BASE_DELAY 0.5
+#define RETRY_MAX_DELAY 30.0
 
 SGImageCacheLogging gSGImageCacheLogging = SGImageCacheLogNothing;
 
@@ -39,6 +62,13 @@ void backgroundDo(void(^block)(void)) {
     self = [super init];
     self.folderName = FOLDER_NAME;
     self.cachePath = self.makeCachePath;
+    self.taskRegistry = SGCacheTaskRegistry.new;
+    self.diskCacheLimit = DEFAULT_DISK_CACHE_SIZE;
+    self.streamsDownloads = YES;
+    self.activeDownloadPaths = NSMutableSet.new;
+    dispatch_queue_attr_t attr = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL,
+          QOS_CLASS_BACKGROUND, 0);
+    self.evictionQueue = dispatch_queue_create("com.seatgeek.sgcache.eviction", attr);
     [self slowQueue];
     [self fastQueue];
     return self;
@@ -55,22 +85,63 @@ void backgroundDo(void(^block)(void)) {
 }
 
 + (BOOL)haveFileForCacheKey:(NSString *)cacheKey {
-    if (![cacheKey isKindOfClass:NSString.class]) {
+    SGCacheDigest digest = SGCacheDigestMake(cacheKey);
+    return [self haveFileForDigest:digest]
+          || [self.cache migrateLegacyFileForCacheKey:cacheKey toDigest:digest];
+}
+
++ (BOOL)haveFileForDigest:(SGCacheDigest)digest {
+    if (SGCacheDigestIsEmpty(digest) || [self.cache definitelyLacksDigest:digest]) {
         return NO;
     }
-    return [NSFileManager.defaultManager fileExistsAtPath:[self.cache pathForCacheKey:cacheKey]];
+    if ([self.cache.packStore hasDataForDigest:digest]) {
+        return YES;
+    }
+    return [NSFileManager.defaultManager fileExistsAtPath:[self.cache pathForDigest:digest]];
 }
 
 + (NSData *)fileForURL:(NSString *)url {
-    return [NSData dataWithContentsOfFile:[self.cache pathForURL:url requestHeaders:nil]];
+    return [self fileForCacheKey:[self.cache cacheKeyFor:url requestHeaders:nil]];
 }
 
 + (NSData *)fileForURL:(NSString *)url requestHeaders:(NSDictionary *)headers {
-    return [NSData dataWithContentsOfFile:[self.cache pathForURL:url requestHeaders:headers]];
+    return [self fileForCacheKey:[self.cache cacheKeyFor:url requestHeaders:headers]];
 }
 
 + (NSData *)fileForCacheKey:(NSString *)cacheKey {
-    return [NSData dataWithContentsOfFile:[self.cache pathForCacheKey:cacheKey]];
+    SGCacheDigest digest = SGCacheDigestMake(cacheKey);
+    NSData *data = [self fileForDigest:digest];
+    if (!data && [self.cache migrateLegacyFileForCacheKey:cacheKey toDigest:digest]) {
+        data = [self fileForDigest:digest];
+    }
+    return data;
+}
+
++ (NSData *)fileForDigest:(SGCacheDigest)digest {
+    if (SGCacheDigestIsEmpty(digest)) {
+        return nil;
+    }
+    if ([self.cache definitelyLacksDigest:digest]) {
+        SGCacheMetricsCount(SGCacheCounterDiskMisses, 1);
+        return nil;
+    }
+    NSData *data = [self.cache.packStore dataForDigest:digest];
+    if (data) {
+        [self.cache.diskIndex touchDigest:digest];
+        SGCacheMetricsCount(SGCacheCounterDiskHits, 1);
+        SGCacheMetricsCount(SGCacheCounterBytesRead, data.length);
+        return data;
+    }
+    NSString *path = [self.cache pathForDigest:digest];
+    data = [self.cache mappedDataAtPath:path];
+    if (data) {
+        [self.cache.diskIndex touchDigest:digest];
+        SGCacheMetricsCount(SGCacheCounterDiskHits, 1);
+        SGCacheMetricsCount(SGCacheCounterBytesRead, data.length);
+    } else {
+        SGCacheMetricsCount(SGCacheCounterDiskMisses, 1);
+    }
+    return data;
 }
 
 + (SGCachePromise *)getFileForURL:(NSString *)url {
@@ -162,31 +233,37 @@ void backgroundDo(void(^block)(void)) {
     }
 
     backgroundDo(^{
+        // unsubscribed before there was a task to subscribe to
+        if ([self.cache.taskRegistry isPromiseUnsubscribed:promise]) {
+            return;
+        }
         SGCacheTask *slowTask = [self existingSlowQueueTaskFor:cacheKey];
         SGCacheTask *fastTask = [self existingFastQueueTaskFor:cacheKey];
 
         if (slowTask.isExecuting) { // reuse an executing slow task
+
+            SGCacheMetricsCount(SGCacheCounterDedupeMerges, 1);
             [slowTask addCompletion:completion];
-            [slowTask addCompletions:fastTask.completions];
             [slowTask addFailBlock:failBlock];
-            [slowTask addFailBlocks:fastTask.onFailBlocks];
+            [self.cache.taskRegistry mergeTask:fastTask intoTask:slowTask
+                  priority:SGCachePriorityNormal];
             slowTask.promise = promise;
-            [fastTask cancel];
         } else if (fastTask) { // reuse a fast task
+            SGCacheMetricsCount(SGCacheCounterDedupeMerges, 1);
             [fastTask addCompletion:completion];
-            [fastTask addCompletions:slowTask.completions];
             [fastTask addFailBlock:failBlock];
-            [fastTask addFailBlocks:slowTask.onFailBlocks];
+            [self.cache.taskRegistry mergeTask:slowTask intoTask:fastTask
+                  priority:SGCachePriorityNormal];
             fastTask.promise = promise;
-            [slowTask cancel];
         } else { // add a fresh task to fast queue
             SGCacheTask *task = [self taskForURL:url requestHeaders:headers cacheKey:cacheKey
                   attempt:1];
             task.remoteFetchOnly = remoteOnly;
             [task addCompletion:completion];
             [task addFailBlock:failBlock];
+            [task addSubscribers:1];
             task.promise = promise;
-            [self.cache.fastQueue addOperation:task];
+            [self addTask:task toQueue:self.cache.fastQueue];
         }
     });
 }
@@ -200,32 +277,144 @@ void backgroundDo(void(^block)(void)) {
     }
 
     backgroundDo(^{
+        // unsubscribed before there was a task to subscribe to
+        if ([self.cache.taskRegistry isPromiseUnsubscribed:promise]) {
+            return;
+        }
         SGCacheTask *slowTask = [self existingSlowQueueTaskFor:cacheKey];
         SGCacheTask *fastTask = [self existingFastQueueTaskFor:cacheKey];
 
         if (fastTask && !slowTask.isExecuting) { // reuse existing fast task
+
+            SGCacheMetricsCount(SGCacheCounterDedupeMerges, 1);
             [fastTask addCompletion:completion];
-            [fastTask addCompletions:slowTask.completions];
             [fastTask addFailBlock:failBlock];
-            [fastTask addFailBlocks:slowTask.onFailBlocks];
+            [self.cache.taskRegistry mergeTask:slowTask intoTask:fastTask
+                  priority:SGCachePriorityPrefetch];
             fastTask.promise = promise;
-            [slowTask cancel];
         } else if (slowTask) { // reuse existing slow task
+            SGCacheMetricsCount(SGCacheCounterDedupeMerges, 1);
             [slowTask addCompletion:completion];
-            [slowTask addCompletions:fastTask.completions];
             [slowTask addFailBlock:failBlock];
-            [slowTask addFailBlocks:fastTask.onFailBlocks];
+            [self.cache.taskRegistry mergeTask:fastTask intoTask:slowTask
+                  priority:SGCachePriorityPrefetch];
             slowTask.promise = promise;
-            [fastTask cancel];
         } else { // add a fresh task to slow queue
             SGCacheTask *task = [self taskForURL:url requestHeaders:requestHeaders cacheKey:cacheKey
                   attempt:1];
             [task addCompletion:completion];
             [task addFailBlock:failBlock];
+            [task addSubscribers:1];
+            task.priority = SGCachePriorityPrefetch;
             task.promise = promise;
-            [self.cache.slowQueue addOperation:task];
+            [self addTask:task toQueue:self.cache.slowQueue];
+        }
+    });
+}
+
++ (SGCachePrefetch *)prefetchFilesForURLs:(NSArray *)urls {
+    return [self prefetchFilesForURLs:urls requestHeaders:nil priority:SGCachePriorityPrefetch];
+}
+
++ (SGCachePrefetch *)prefetchFilesForURLs:(NSArray *)urls requestHeaders:(NSDictionary *)headers
+      priority:(SGCachePriority)priority {
+    SGCachePrefetch *prefetch = SGCachePrefetch.new;
+    urls = [urls copy];
+
+    backgroundDo(^{
+        NSOperationQueue *queue = [self.cache queueForPriority:priority];
+        NSMutableOrderedSet *wanted = NSMutableOrderedSet.new;
+        NSMutableDictionary *urlsByKey = NSMutableDictionary.new;
+        NSUInteger cached = 0;
+
+        // compute keys once, dropping duplicates and files we already have
+        for (NSString *url in urls) {
+            if (![url isKindOfClass:NSString.class] || !url.length) {
+                continue;
+            }
+            NSString *cacheKey = [self.cache cacheKeyFor:url requestHeaders:headers];
+            if (urlsByKey[cacheKey]) {
+                continue;
+            }
+            urlsByKey[cacheKey] = url;
+            if ([self haveFileForCacheKey:cacheKey]) {
+                cached++;
+            } else {
+                [wanted addObject:cacheKey];
+            }
+        }
+        [prefetch setTotal:urlsByKey.count alreadyCached:cached];
+
+        __weak SGCachePrefetch *wPrefetch = prefetch;
+        for (NSString *cacheKey in wanted) {
+            if (prefetch.isCancelled) {
+                break;
+            }
+            SGCacheFetchCompletion completion = ^(id file) {
+                [wPrefetch finishedCacheKey:cacheKey succeeded:!!file];
+            };
+            SGCacheFetchFail failBlock = ^(NSError *error, BOOL wasFatal) {
+                if (wasFatal) {
+                    [wPrefetch finishedCacheKey:cacheKey succeeded:NO];
+                }
+            };
+
+            SGCacheTask *task = [self existingFastQueueTaskFor:cacheKey]
+                  ?: [self existingSlowQueueTaskFor:cacheKey];
+            if (task) { // join the existing task, raising its priority if it can be done in place
+                SGCacheMetricsCount(SGCacheCounterDedupeMerges, 1);
+                [task addCompletion:completion];
+                [task addFailBlock:failBlock];
+                [task addSubscribers:1];
+                [prefetch addSubscription:[self.cache.taskRegistry subscribeToTask:task]];
+                if (task.priority < priority && (task.isExecuting || task.registeredQueue == queue)) {
+                    task.priority = priority;
+                }
+                continue;
+            }
+
+            task = [self taskForURL:urlsByKey[cacheKey] requestHeaders:headers cacheKey:cacheKey
+                  attempt:1];
+            task.priority = priority;
+            [task addCompletion:completion];
+            [task addFailBlock:failBlock];
+            [task addSubscribers:1];
+            [prefetch addSubscription:[self.cache.taskRegistry subscribeToTask:task]];
+            [self addTask:task toQueue:queue];
         }
     });
+
+    return prefetch;
+}
+
++ (void)unsubscribeFromPromise:(SGCachePromise *)promise {
+    if (!promise) {
+        return;
+    }
+    [promise.pendingLoad cancel];
+
+    // recorded at once, so a task made for the promise from here on isn't subscribed to
+    SGCacheTask *task = [self.cache.taskRegistry endSubscriptionForPromise:promise];
+    backgroundDo(^{
+        [self unsubscribeFromTask:task];
+    });
+}
+
++ (void)unsubscribeFromTask:(SGCacheTask *)task {
+    if (!task || [task removeSubscriber]) {
+        return;
+    }
+    NSTimeInterval grace = self.cache.unsubscribeGracePeriod;
+    if (grace <= 0) {
+        [self.cache.taskRegistry cancelTaskIfUnsubscribed:task];
+        return;
+    }
+
+    // give the key a moment to be asked for again before dropping the fetch
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(grace * NSEC_PER_SEC)),
+          dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [self.cache.taskRegistry cancelTaskIfUnsubscribed:task];
+    });
 }
 
 + (void)moveTaskToSlowQueueForURL:(NSString *)url {
@@ -237,72 +426,179 @@ void backgroundDo(void(^block)(void)) {
 }
 
 + (void)moveTaskToSlowQueueForCacheKey:(NSString *)cacheKey {
+    [self setPriority:SGCachePriorityPrefetch forCacheKey:cacheKey];
+}
+
++ (void)setPriority:(SGCachePriority)priority forURL:(NSString *)url {
+    [self setPriority:priority forURL:url requestHeaders:nil];
+}
+
++ (void)setPriority:(SGCachePriority)priority forURL:(NSString *)url
+      requestHeaders:(NSDictionary *)headers {
+    [self setPriority:priority forCacheKey:[self.cache cacheKeyFor:url requestHeaders:headers]];
+}
+
++ (void)setPriority:(SGCachePriority)priority forCacheKey:(NSString *)cacheKey {
     if (![cacheKey isKindOfClass:NSString.class] || !cacheKey.length) {
         return;
     }
 
     backgroundDo(^{
-        SGCacheTask *fastTask = [self existingFastQueueTaskFor:cacheKey];
-
-        if (fastTask) {
-            SGCacheTask *slowTask = [self existingSlowQueueTaskFor:cacheKey];
+        NSOperationQueue *queue = [self.cache queueForPriority:priority];
+        SGCacheTask *task = [self existingFastQueueTaskFor:cacheKey]
+              ?: [self existingSlowQueueTaskFor:cacheKey];
+        if (!task) {
+            return;
+        }
 
-            if (slowTask) { // reuse an executing slow task
-                [slowTask addCompletions:fastTask.completions];
-            } else { // add a fresh task to slow queue
-                SGCacheTask *task = [self taskForURL:fastTask.url
-                      requestHeaders:fastTask.requestHeaders cacheKey:cacheKey attempt:1];
-                [task addCompletions:fastTask.completions];
-                [self.cache.slowQueue addOperation:task];
-            }
-            [fastTask cancel];
+        // started tasks and tasks already in the right queue change in place
+        if (task.isExecuting || task.registeredQueue == queue) {
+            task.priority = priority;
+            return;
         }
+
+        // not started yet, so nothing is lost by replacing it in the other queue
+        SGCacheTask *moved = [self taskForURL:task.url requestHeaders:task.requestHeaders
+              cacheKey:cacheKey attempt:task.attempt];
+        moved.remoteFetchOnly = task.remoteFetchOnly;
+        moved.priority = priority;
+        [moved addCompletions:task.completions];
+        [moved addFailBlocks:task.onFailBlocks];
+        [moved addRetryBlocks:task.onRetryBlocks];
+        [moved addSubscribers:task.subscriberCount];
+        [self.cache.taskRegistry moveSubscriptionsFromTask:task toTask:moved];
+        [self addTask:moved toQueue:queue];
+        [task cancel];
     });
 }
 
 + (void)flushFilesOlderThan:(NSTimeInterval)age {
-    // let the queues finish, then suspend them    
-    [self.cache.slowQueue waitUntilAllOperationsAreFinished];
-    self.cache.slowQueue.suspended = YES;
-    [self.cache.fastQueue waitUntilAllOperationsAreFinished];
-    self.cache.fastQueue.suspended = YES;
+    SGCache *cache = self.cache;
+    NSTimeInterval cutoff = NSDate.timeIntervalSinceReferenceDate - age;
 
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+    // make sure any index rebuild is queued ahead of the flush
+    [cache diskIndex];
 
-        NSArray *files = [NSFileManager.defaultManager contentsOfDirectoryAtPath:self.cache
-              .cachePath error:nil];
+    dispatch_async(cache.evictionQueue, ^{
+        [cache flushFilesCreatedBefore:cutoff cursor:0];
+    });
+}
 
-        for (NSString *file in files) {
-            if ([file isEqualToString:@"."] || [file isEqualToString:@".."]) {
-                continue;
-            }
++ (void)addData:(NSData *)data forCacheKey:(NSString *)cacheKey {
+    SGCacheDigest digest = SGCacheDigestMake(cacheKey);
 
-            NSString *path = [self.cache.cachePath stringByAppendingPathComponent:file];
-            NSDate *created = [NSFileManager.defaultManager attributesOfItemAtPath:path error:nil].fileCreationDate;
+    // the server's validators don't describe data added by hand
+    [self setMetadata:nil forDigest:digest];
+    [self addData:data forDigest:digest];
+}
 
-            // too old. delete it
-            if (-created.timeIntervalSinceNow > age) {
-                [NSFileManager.defaultManager removeItemAtPath:path error:nil];
-            }
-        }
++ (void)addData:(NSData *)data forDigest:(SGCacheDigest)digest {
+    if (SGCacheDigestIsEmpty(digest)) {
+        return;
+    }
+    SGCacheIndex *index = self.cache.diskIndex;
+    NSTimeInterval started = SGCacheMetricsNow();
+    [index beginWrite];
+    if (![self.cache writeData:data forDigest:digest]) {
+        [index endWrite];
+        return;
+    }
+    SGCacheMetricsRecordTime(SGCacheTimerDiskWrite, SGCacheMetricsNow() - started);
+    SGCacheMetricsCount(SGCacheCounterBytesWritten, data.length);
+    [index setSize:data.length forDigest:digest];
+    [index endWrite];
+    [self.cache scheduleDiskTrim];
+}
 
-        // let the queues run wild again
-        dispatch_async(dispatch_get_main_queue(), ^{
-            self.cache.fastQueue.suspended = NO;
-            self.cache.slowQueue.suspended = NO;
-        });
-    });
++ (NSData *)addFileAtPath:(NSString *)path forDigest:(SGCacheDigest)digest {
+    SGCache *cache = self.cache;
+    unsigned long long size = [NSFileManager.defaultManager attributesOfItemAtPath:path
+          error:nil].fileSize;
+
+    // nowhere to keep it. map it, and let it go when the mapping does
+    if (SGCacheDigestIsEmpty(digest)) {
+        NSData *data = [cache mappedDataAtPath:path];
+        unlink(path.fileSystemRepresentation);
+        return data;
+    }
+
+    if (cache.storage == SGCacheStoragePacked && size <= MAX_PACKED_ENTRY_SIZE) {
+        NSData *data = [NSData dataWithContentsOfFile:path];
+        unlink(path.fileSystemRepresentation);
+        [self addData:data forDigest:digest];
+        return data;
+    }
+
+    SGCacheIndex *index = cache.diskIndex;
+    NSString *cachedPath = [cache pathForDigest:digest];
+    [index beginWrite];
+    if (![cache moveFileAtPath:path toPath:cachedPath]) {
+        [index endWrite];
+        unlink(path.fileSystemRepresentation);
+        return nil;
+    }
+    SGCacheMetricsCount(SGCacheCounterBytesWritten, size);
+    [cache.packStore removeDataForDigest:digest];
+    [index setSize:size forDigest:digest];
+    [index endWrite];
+    [cache scheduleDiskTrim];
+    return [cache mappedDataAtPath:cachedPath];
 }
 
-+ (void)addData:(NSData *)data forCacheKey:(NSString *)cacheKey {
-    [data writeToFile:[self.cache pathForCacheKey:cacheKey] atomically:YES];
++ (SGCacheEntryMetadata *)metadataForDigest:(SGCacheDigest)digest {
+    if (SGCacheDigestIsEmpty(digest)) {
+        return nil;
+    }
+    NSString *path = [self.cache metadataPathForDigest:digest];
+    return [SGCacheEntryMetadata metadataWithData:[NSData dataWithContentsOfFile:path]];
+}
+
++ (void)setMetadata:(SGCacheEntryMetadata *)metadata forDigest:(SGCacheDigest)digest {
+    if (SGCacheDigestIsEmpty(digest)) {
+        return;
+    }
+    NSString *path = [self.cache metadataPathForDigest:digest];
+    if (!metadata) {
+        unlink(path.fileSystemRepresentation);
+        return;
+    }
+    [self.cache writeData:metadata.data toPath:path];
 }
 
 + (void)removeDataForCacheKey:(NSString *)cacheKey {
-    NSString *path = [self.cache pathForCacheKey:cacheKey];
-    if (path.length) {
-        [NSFileManager.defaultManager removeItemAtPath:path error:nil];
+    [self removeDataForDigest:SGCacheDigestMake(cacheKey)];
+}
+
++ (void)removeDataForDigest:(SGCacheDigest)digest {
+    if (SGCacheDigestIsEmpty(digest)) {
+        return;
     }
+    [self.cache removeFileForDigest:digest];
+    [self.cache.diskIndex removeDigest:digest];
+}
+
++ (void)setStreamsDownloads:(BOOL)stream {
+    self.cache.streamsDownloads = stream;
+}
+
++ (void)setUnsubscribeGracePeriod:(NSTimeInterval)seconds {
+    self.cache.unsubscribeGracePeriod = seconds;
+}
+
++ (void)setSkipsRefreshWhileFresh:(BOOL)skip {
+    self.cache.skipsRefreshWhileFresh = skip;
+}
+
++ (void)setStorage:(SGCacheStorage)storage {
+    @synchronized (self.cache) {
+        self.cache.storage = storage;
+        self.cache.packStoreChecked = NO;
+    }
+}
+
++ (void)setDiskCacheSize:(NSUInteger)megaBytes {
+    self.cache.diskCacheLimit = megaBytes * 1000000ull;
+    [self.cache scheduleDiskTrim];
 }
 
 #pragma mark - Task Factory
@@ -313,7 +609,7 @@ void backgroundDo(void(^block)(void)) {
           attempt:attempt];
     __weak SGCacheTask *wTask = task;
     task.completionBlock = ^{
-        if (!wTask.succeeded) {
+        if (!wTask.succeeded && !wTask.isCancelled) {
             [SGCache taskFailed:wTask];
         }
     };
@@ -322,59 +618,70 @@ void backgroundDo(void(^block)(void)) {
 
 #pragma mark - Task Finders
 
++ (void)addTask:(SGCacheTask *)task toQueue:(NSOperationQueue *)queue {
+    [self.cache.taskRegistry addTask:task forQueue:queue];
+    [self enqueueTask:task inQueue:queue];
+}
+
++ (void)enqueueTask:(SGCacheTask *)task inQueue:(NSOperationQueue *)queue {
+    task.queuedTime = SGCacheMetricsNow();
+    SGCacheMetricsAdjustGauge(SGCacheGaugeQueuedTasks, 1);
+    [queue addOperation:task];
+}
+
 + (SGCacheTask *)existingSlowQueueTaskFor:(NSString *)cacheKey {
-    for (SGCacheTask *task in self.cache.slowQueue.operations) {
-        if ([task matchesCacheKey:cacheKey]) {
-            return task;
-        }
-    }
-    return nil;
+    return [self.cache.taskRegistry taskForCacheKey:cacheKey inQueue:self.cache.slowQueue];
 }
 
 + (SGCacheTask *)existingFastQueueTaskFor:(NSString *)cacheKey {
-    for (SGCacheTask *task in self.cache.fastQueue.operations) {
-        if ([task matchesCacheKey:cacheKey]) {
-            return task;
-        }
-    }
-    return nil;
+    return [self.cache.taskRegistry taskForCacheKey:cacheKey inQueue:self.cache.fastQueue];
 }
 
 + (SGCacheTask *)taskForPromise:(SGCachePromise *)promise {
-    if (!promise) {
-        return nil;
-    }
-    for (SGCacheTask *task in self.cache.fastQueue.operations) {
-        if (promise == task.promise) {
-            return task;
-        }
-    }
-    for (SGCacheTask *task in self.cache.slowQueue.operations) {
-        if (promise == task.promise) {
-            return task;
-        }
-    }
-    return nil;
-
+    return [self.cache.taskRegistry taskForPromise:promise];
 }
 
 #pragma mark - Fail Handle
 
 + (void)taskFailed:(SGCacheTask *)task {
 
-    // too many retries?
-    if (task.attempt >= MAX_RETRIES) {
-        for (SGCacheFetchCompletion completion in task.completions) {
-            completion(nil);
-        }
+    // too many retries, or not worth retrying?
+    if (task.attempt >= MAX_RETRIES || task.failedFatally) {
+        // on the main thread in order after the fail blocks, like any other completion
+        [SGCacheDelivery.sharedDelivery deliver:^{
+            for (SGCacheFetchCompletion completion in task.completions) {
+                completion(nil);
+            }
+        }];
         return;
     }
 
-    // make and add a retry task
+    // make a retry task for the same key, so it stores its result in the right
+    // place and later requests for the key join it
     SGCacheTask *retryTask = [self taskForURL:task.url requestHeaders:task.requestHeaders
-          cacheKey:nil attempt:task.attempt + 1];
+          cacheKey:task.cacheKey attempt:task.attempt + 1];
+    retryTask.remoteFetchOnly = task.remoteFetchOnly;
+    retryTask.priority = task.priority;
     [retryTask addCompletions:task.completions];
-    [self.cache.fastQueue addOperation:retryTask];
+    [retryTask addFailBlocks:task.onFailBlocks];
+    [retryTask addRetryBlocks:task.onRetryBlocks];
+    [retryTask addSubscribers:task.subscriberCount];
+    [self.cache.taskRegistry moveSubscriptionsFromTask:task toTask:retryTask];
+
+    // register it now so it can be joined while it waits, and queue it after a
+    // capped exponential backoff with full jitter, so failures don't retry in lockstep
+    NSOperationQueue *queue = [self.cache queueForPriority:retryTask.priority];
+    [self.cache.taskRegistry addTask:retryTask forQueue:queue];
+    SGCacheMetricsCount(SGCacheCounterRetries, 1);
+    double maxDelay = MIN(RETRY_BASE_DELAY * pow(2, task.attempt - 1), RETRY_MAX_DELAY);
+    double delay = maxDelay * arc4random_uniform(1001) / 1000.0;
+    if (SGCache.logging & SGImageCacheLogErrors) {
+        NSLog(@"Retrying %@ in %.2fs (attempt %d)", task.url, delay, retryTask.attempt);
+    }
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)),
+          dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [self enqueueTask:retryTask inQueue:queue];
+    });
 }
 
 #pragma mark - File and Memory Cache Setup
@@ -394,8 +701,424 @@ void backgroundDo(void(^block)(void)) {
     return path;
 }
 
+#pragma mark - Disk Index
+
+- (SGCacheIndex *)diskIndex {
+    @synchronized (self) {
+        if (!_diskIndex) {
+            NSString *path = [self.cachePath stringByAppendingPathComponent:INDEX_FILE_NAME];
+            _diskIndex = [[SGCacheIndex alloc] initWithPath:path];
+            if (_diskIndex.needsRebuild || _diskIndex.needsSweep) {
+                [self rebuildDiskIndex:_diskIndex];
+            }
+            NSString *marker = [self.cachePath stringByAppendingPathComponent:SHARDED_MARKER_FILE_NAME];
+            self.shardingComplete = [NSFileManager.defaultManager fileExistsAtPath:marker];
+            if (!self.shardingComplete) {
+                [self migrateFlatFiles];
+            }
+            [self removeStaleDownloads];
+        }
+        return _diskIndex;
+    }
+}
+
+// Misses are answered from the index, without touching the file system.
+// Flat files from older releases aren't all indexed, so every miss goes to
+// disk until they've been migrated.
+- (BOOL)definitelyLacksDigest:(SGCacheDigest)digest {
+    SGCacheIndex *index = self.diskIndex;
+    return self.shardingComplete && [index definitelyLacksDigest:digest];
+}
+
+// only needed when the index file was missing or unreadable, or when the last
+// session may have left files unindexed, which would otherwise never be
+// evicted. runs on the eviction queue so that flushes wait for the index to be
+// complete. misses go to disk until it is
+- (void)rebuildDiskIndex:(SGCacheIndex *)index {
+    NSURL *folder = [NSURL fileURLWithPath:self.cachePath];
+    [index beginRebuild];
+    dispatch_async(self.evictionQueue, ^{
+        NSArray *keys = @[NSURLFileSizeKey, NSURLCreationDateKey, NSURLContentAccessDateKey];
+        NSDirectoryEnumerator *files = [NSFileManager.defaultManager enumeratorAtURL:folder
+              includingPropertiesForKeys:keys options:NSDirectoryEnumerationSkipsHiddenFiles
+              errorHandler:nil];
+
+        for (NSURL *file in files) {
+            SGCacheDigest digest;
+            if (!SGCacheDigestFromHex(file.lastPathComponent, &digest)) {
+                continue;
+            }
+            NSDictionary *values = [file resourceValuesForKeys:keys error:nil];
+            NSDate *created = values[NSURLCreationDateKey];
+            NSDate *accessed = values[NSURLContentAccessDateKey] ?: created;
+            BOOL indexed = [index addDigest:digest
+                  size:[values[NSURLFileSizeKey] unsignedLongLongValue]
+                  created:created.timeIntervalSinceReferenceDate
+                  lastAccess:accessed.timeIntervalSinceReferenceDate];
+
+            // a file the index can't hold could never be evicted
+            if (!indexed) {
+                unlink(file.fileSystemRepresentation);
+                unlink([self metadataPathForDigest:digest].fileSystemRepresentation);
+            }
+        }
+
+        [self.packStore enumerateEntriesUsingBlock:^(SGCacheDigest digest, unsigned long long size) {
+            NSTimeInterval now = NSDate.timeIntervalSinceReferenceDate;
+            [index addDigest:digest size:size created:now lastAccess:now];
+        }];
+
+        [index finishRebuild];
+        [self scheduleDiskTrim];
+    });
+}
+
+#pragma mark - Storage
+
+// small entries go to the pack store when packed storage is enabled. the pack
+// store is also opened whenever packs exist on disk, so that entries stay
+// readable if the storage setting changes
+- (SGCachePackStore *)packStore {
+    @synchronized (self) {
+        if (!_packStore && !self.packStoreChecked) {
+            NSString *path = [self.cachePath stringByAppendingPathComponent:PACKS_FOLDER_NAME];
+            if (self.storage == SGCacheStoragePacked
+                  || [NSFileManager.defaultManager fileExistsAtPath:path]) {
+                _packStore = [[SGCachePackStore alloc] initWithPath:path];
+            }
+            self.packStoreChecked = _packStore || self.storage != SGCacheStoragePacked;
+        }
+        return _packStore;
+    }
+}
+
+- (BOOL)writeData:(NSData *)data forDigest:(SGCacheDigest)digest {
+    if (self.storage == SGCacheStoragePacked && data.length <= MAX_PACKED_ENTRY_SIZE
+          && [self.packStore writeData:data forDigest:digest]) {
+        unlink([self pathForDigest:digest].fileSystemRepresentation);
+        return YES;
+    }
+    if (![self writeData:data toPath:[self pathForDigest:digest]]) {
+        return NO;
+    }
+    [self.packStore removeDataForDigest:digest];
+    return YES;
+}
+
+#pragma mark - Reading
+
+// Disk hits are memory mapped where the system considers it safe, so reading
+// a cached file costs page faults into the shared page cache rather than a
+// heap copy. The mapping lives as long as the returned data.
+- (NSData *)mappedDataAtPath:(NSString *)path {
+    return [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+}
+
+#pragma mark - Downloads
+
+- (NSString *)downloadPath {
+    NSString *folder = [self.cachePath stringByAppendingPathComponent:DOWNLOADS_FOLDER_NAME];
+    return [folder stringByAppendingPathComponent:NSUUID.UUID.UUIDString];
+}
+
+// Downloads for a key go to a path named by its digest, so a download that
+// was cancelled or failed part way can be resumed by the next attempt. Each
+// path is only handed to one download at a time. Returns nil if the path is
+// in use, in which case a throwaway <downloadPath> will do.
+- (NSString *)claimDownloadPathForDigest:(SGCacheDigest)digest {
+    if (SGCacheDigestIsEmpty(digest)) {
+        return nil;
+    }
+    NSString *folder = [self.cachePath stringByAppendingPathComponent:DOWNLOADS_FOLDER_NAME];
+    NSString *path = [folder stringByAppendingPathComponent:SGCacheDigestHexString(digest)];
+    @synchronized (self.activeDownloadPaths) {
+        if ([self.activeDownloadPaths containsObject:path]) {
+            return nil;
+        }
+        [self.activeDownloadPaths addObject:path];
+        return path;
+    }
+}
+
+- (void)releaseDownloadPath:(NSString *)path {
+    if (!path) {
+        return;
+    }
+    @synchronized (self.activeDownloadPaths) {
+        [self.activeDownloadPaths removeObject:path];
+    }
+}
+
+// clears out throwaway downloads left behind by a previous launch, and
+// partial downloads that haven't been resumed in a while
+- (void)removeStaleDownloads {
+    NSDate *now = NSDate.date;
+    NSDate *partialCutoff = [now dateByAddingTimeInterval:-PARTIAL_DOWNLOAD_MAX_AGE];
+    NSString *folder = [self.cachePath stringByAppendingPathComponent:DOWNLOADS_FOLDER_NAME];
+    dispatch_async(self.evictionQueue, ^{
+        NSArray *files = [NSFileManager.defaultManager contentsOfDirectoryAtPath:folder error:nil];
+        for (NSString *file in files) {
+            NSString *path = [folder stringByAppendingPathComponent:file];
+            NSDate *modified = [NSFileManager.defaultManager attributesOfItemAtPath:path
+                  error:nil].fileModificationDate;
+            SGCacheDigest digest;
+            BOOL partial = SGCacheDigestFromHex(file.stringByDeletingPathExtension, &digest);
+            if ([modified compare:partial ? partialCutoff : now] == NSOrderedAscending) {
+                unlink(path.fileSystemRepresentation);
+            }
+        }
+    });
+}
+
+#pragma mark - Sharded Layout
+
+// Files live two directories deep, named by the first two bytes of their
+// digest (eg. ab/cd/abcd...), so no single directory holds more than a few
+// entries. Caches from earlier releases kept every file at the top level.
+// Those are moved into place by a background migration, which can be
+// interrupted at any point and picks up where it left off on the next launch.
+// A file that hasn't been moved yet reads as a miss.
+
+- (BOOL)writeData:(NSData *)data toPath:(NSString *)path {
+    if ([data writeToFile:path atomically:YES]) {
+        return YES;
+    }
+
+    // the shard directory might not exist yet
+    [NSFileManager.defaultManager createDirectoryAtPath:path.stringByDeletingLastPathComponent
+          withIntermediateDirectories:YES attributes:nil error:nil];
+    return [data writeToFile:path atomically:YES];
+}
+
+- (BOOL)moveFileAtPath:(NSString *)from toPath:(NSString *)to {
+    if (!rename(from.fileSystemRepresentation, to.fileSystemRepresentation)) {
+        return YES;
+    }
+    // ENOENT means either no source file, or no shard directory yet
+    if (errno != ENOENT || access(from.fileSystemRepresentation, F_OK)) {
+        return NO;
+    }
+    [NSFileManager.defaultManager createDirectoryAtPath:to.stringByDeletingLastPathComponent
+          withIntermediateDirectories:YES attributes:nil error:nil];
+    return !rename(from.fileSystemRepresentation, to.fileSystemRepresentation);
+}
+
+- (void)removeFileForDigest:(SGCacheDigest)digest {
+    [self.packStore removeDataForDigest:digest];
+    unlink([self pathForDigest:digest].fileSystemRepresentation);
+    unlink([self metadataPathForDigest:digest].fileSystemRepresentation);
+}
+
+- (void)migrateFlatFiles {
+    dispatch_async(self.evictionQueue, ^{
+        NSArray *files = [NSFileManager.defaultManager contentsOfDirectoryAtPath:self.cachePath
+              error:nil];
+        [self migrateFlatFiles:files fromIndex:0];
+    });
+}
+
+- (void)migrateFlatFiles:(NSArray *)files fromIndex:(NSUInteger)index {
+    CFAbsoluteTime sliceEnd = CFAbsoluteTimeGetCurrent() + EVICTION_SLICE_DURATION;
+
+    for (; index < files.count && CFAbsoluteTimeGetCurrent() < sliceEnd; index++) {
+        NSString *file = files[index];
+        NSString *from = [self.cachePath stringByAppendingPathComponent:file];
+        SGCacheDigest digest;
+
+        // older releases named files with the full 40 character SHA-1 of the
+        // key. they're sharded under its leading half, the legacy digest, and
+        // moved under the key's digest when next asked for
+        if (file.length != LEGACY_HASH_LENGTH
+              || !SGCacheDigestFromHex([file substringToIndex:SGCacheDigestHexLength], &digest)) {
+            continue;
+        }
+        [self moveLegacyFileAtPath:from toDigest:digest];
+    }
+
+    if (index < files.count) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(EVICTION_SLICE_INTERVAL * NSEC_PER_SEC)),
+              self.evictionQueue, ^{
+            [self migrateFlatFiles:files fromIndex:index];
+        });
+        return;
+    }
+
+    NSString *marker = [self.cachePath stringByAppendingPathComponent:SHARDED_MARKER_FILE_NAME];
+    [NSData.data writeToFile:marker atomically:YES];
+    self.shardingComplete = YES;
+}
+
+// Only called when a lookup misses, so the extra hashing is paid once per file.
+// A flat file the migration hasn't reached yet, or a file sharded under the
+// key's legacy digest, is moved under the key's digest. Returns YES if one was.
+- (BOOL)migrateLegacyFileForCacheKey:(NSString *)cacheKey toDigest:(SGCacheDigest)digest {
+    if (![cacheKey isKindOfClass:NSString.class] || !cacheKey.length) {
+        return NO;
+    }
+    [self diskIndex]; // decides whether the migration is complete
+    if (!self.shardingComplete) {
+        NSString *flat = [self.cachePath stringByAppendingPathComponent:cacheKey.sgCacheHash];
+        if ([self moveLegacyFileAtPath:flat toDigest:digest]) {
+            return YES;
+        }
+    }
+
+    // keys that aren't hex hashes have the digest they always had
+    SGCacheDigest legacy = SGCacheDigestMakeLegacy(cacheKey);
+    if (SGCacheDigestEqual(legacy, digest) || [self definitelyLacksDigest:legacy]) {
+        return NO;
+    }
+    NSString *from = [self pathForDigest:legacy];
+    BOOL moved = [self moveLegacyFileAtPath:from toDigest:digest];
+    if (access(from.fileSystemRepresentation, F_OK)) { // moved, or dropped for a newer copy
+        [self.diskIndex removeDigest:legacy];
+        [self moveFileAtPath:[self metadataPathForDigest:legacy]
+              toPath:[self metadataPathForDigest:digest]];
+    }
+    return moved;
+}
+
+// the migration and lookups can race for a file. only one of them moves it
+- (BOOL)moveLegacyFileAtPath:(NSString *)from toDigest:(SGCacheDigest)digest {
+    NSDictionary *attributes = [NSFileManager.defaultManager attributesOfItemAtPath:from
+          error:nil];
+    if (!attributes) {
+        return NO;
+    }
+    NSString *to = [self pathForDigest:digest];
+
+    // the entry has been written again since the upgrade
+    if ([NSFileManager.defaultManager fileExistsAtPath:to]) {
+        unlink(from.fileSystemRepresentation);
+        return NO;
+    }
+
+    [self.diskIndex beginWrite];
+    BOOL moved = [self moveFileAtPath:from toPath:to];
+    if (moved) {
+        NSTimeInterval created = attributes.fileCreationDate.timeIntervalSinceReferenceDate;
+        [self.diskIndex addDigest:digest size:attributes.fileSize created:created
+              lastAccess:created];
+    }
+    [self.diskIndex endWrite];
+    return moved;
+}
+
+#pragma mark - Eviction
+
+// Eviction runs on a low priority serial queue in short time boxed slices, and
+// never suspends the fetch queues. Files for queued or in flight tasks are
+// pinned by the task registry and skipped.
+
+- (BOOL)evictDigest:(SGCacheDigest)digest {
+    if ([self.taskRegistry isDigestPinned:digest]) {
+        return NO;
+    }
+    [self.diskIndex removeDigest:digest];
+    [self removeFileForDigest:digest];
+    SGCacheMetricsCount(SGCacheCounterDiskEvictions, 1);
+    return YES;
+}
+
+- (void)flushFilesCreatedBefore:(NSTimeInterval)cutoff cursor:(uint64_t)cursor {
+    SGCacheIndex *index = self.diskIndex;
+    CFAbsoluteTime sliceEnd = CFAbsoluteTimeGetCurrent() + EVICTION_SLICE_DURATION;
+    SGCacheDigest digests[EVICTION_BATCH_SIZE];
+    BOOL more;
+
+    do {
+        NSUInteger count;
+        more = [index getDigests:digests count:&count max:EVICTION_BATCH_SIZE
+              createdBefore:cutoff cursor:&cursor];
+        for (NSUInteger i = 0; i < count; i++) {
+            [self evictDigest:digests[i]];
+        }
+    } while (more && CFAbsoluteTimeGetCurrent() < sliceEnd);
+
+    if (more) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(EVICTION_SLICE_INTERVAL * NSEC_PER_SEC)),
+              self.evictionQueue, ^{
+            [self flushFilesCreatedBefore:cutoff cursor:cursor];
+        });
+    }
+}
+
+- (void)scheduleDiskTrim {
+    unsigned long long limit = self.diskCacheLimit;
+    @synchronized (self) {
+        if (self.diskTrimScheduled || !limit || self.diskIndex.totalBytes <= limit) {
+            return;
+        }
+        self.diskTrimScheduled = YES;
+    }
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(EVICTION_SLICE_INTERVAL * NSEC_PER_SEC)),
+          self.evictionQueue, ^{
+        [self trimDiskCache];
+    });
+}
+
+// evicts least recently used files until under budget or out of time, then
+// schedules another slice if there's still more to do
+- (void)trimDiskCache {
+    unsigned long long limit = self.diskCacheLimit;
+    SGCacheIndex *index = self.diskIndex;
+    CFAbsoluteTime sliceEnd = CFAbsoluteTimeGetCurrent() + EVICTION_SLICE_DURATION;
+    int evicted = 0, skipped = 0;
+
+    while (limit && index.totalBytes > limit && CFAbsoluteTimeGetCurrent() < sliceEnd) {
+        SGCacheDigest digest;
+        if (![index getLeastRecentlyUsedDigest:&digest]) {
+            break;
+        }
+        if ([self evictDigest:digest]) {
+            evicted++;
+        } else if (++skipped > MAX_PINNED_SKIPS) {
+            break;
+        }
+    }
+
+    @synchronized (self) {
+        self.diskTrimScheduled = NO;
+    }
+
+    // if nothing could be evicted, wait for the next write to try again
+    if (evicted) {
+        [self scheduleDiskTrim];
+    }
+}
+
 #pragma mark - Getters
 
+- (NSString *)pathForDigest:(SGCacheDigest)digest {
+    char hex[SGCacheDigestHexLength + 1];
+    SGCacheDigestGetHex(digest, hex);
+    return [NSString stringWithFormat:@"%@/%.2s/%.2s/%s", self.cachePath, hex, hex + 2, hex];
+}
+
+// sidecars live in their own hidden tree, so the index rebuild and the flat
+// file migration never mistake them for entries
+- (NSString *)metadataPathForDigest:(SGCacheDigest)digest {
+    char hex[SGCacheDigestHexLength + 1];
+    SGCacheDigestGetHex(digest, hex);
+    return [NSString stringWithFormat:@"%@/%@/%.2s/%.2s/%s", self.cachePath, METADATA_FOLDER_NAME,
+          hex, hex + 2, hex];
+}
+
+- (NSString *)pathForCacheKey:(NSString *)cacheKey {
+    return [self pathForDigest:SGCacheDigestMake(cacheKey)];
+}
+
+- (NSString *)pathForURL:(NSString *)url requestHeaders:(NSDictionary *)headers {
+    return [self pathForCacheKey:[self cacheKeyFor:url requestHeaders:headers]];
+}
+
+// keys are derived as they always have been, since they're public and apps
+// keep them. the URL's SHA-1 leads the key, and the key's digest is read from
+// it rather than hashing the key again
+- (NSString *)cacheKeyFor:(NSString *)url requestHeaders:(NSDictionary *)headers {
+    return [NSString stringWithFormat:@"%@%@", url.sgCacheHash, [self hashForDictionary:headers]];
+}
+
 - (NSString *)hashForDictionary:(NSDictionary *)dict {
     NSMutableString *hash = [NSMutableString stringWithFormat:@"%@", @(dict.hash)];
     for (id key in dict) {
@@ -410,32 +1133,16 @@ void backgroundDo(void(^block)(void)) {
     return hash;
 }
 
-- (NSString *)pathForCacheKey:(NSString *)cacheKey {
-    return [NSString stringWithFormat:@"%@/%@", self.cachePath, cacheKey.sgCacheHash];
-}
-
-- (NSString *)pathForURL:(NSString *)url requestHeaders:(NSDictionary *)headers {
-    return [self pathForCacheKey:[self cacheKeyFor:url requestHeaders:headers]];
-}
-
-- (NSString *)cacheKeyFor:(NSString *)url requestHeaders:(NSDictionary *)headers {
-    return [NSString stringWithFormat:@"%@%@", url.sgCacheHash, [self hashForDictionary:headers]];
+- (NSOperationQueue *)queueForPriority:(SGCachePriority)priority {
+    return priority >= SGCachePriorityNormal ? self.fastQueue : self.slowQueue;
 }
 
+// slowQueue is no longer suspended while fastQueue is busy. Its one slot is
+// the prefetch share, and its downloads run at a low transfer priority.
 - (NSOperationQueue *)fastQueue {
-    if (_fastQueue) {
-        return _fastQueue;
+    if (!_fastQueue) {
+        _fastQueue = NSOperationQueue.new;
     }
-
-    _fastQueue = NSOperationQueue.new;
-
-    // suspend slowQueue while fastQueue is active
-    __weakSelf me = self;
-    __weak NSOperationQueue *wQueue = _fastQueue;
-    [_fastQueue onChangeOf:@"operationCount" do:^{
-        me.slowQueue.suspended = !!wQueue.operationCount;
-    }];
-
     return _fastQueue;
 }
 
@@ -0,0 +1,32 @@
+//
+//  SGCacheCircuitBreaker.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+* Tracks the health of each remote host, so requests to a host that keeps
+* failing can fail fast instead of adding to the load.
+*
+* After several consecutive server errors or timeouts a host's circuit opens
+* and requests to it are refused. Once the open period has passed a single
+* trial request is let through. If it succeeds the circuit closes, and if it
+* fails the circuit opens again for twice as long, up to a limit. All methods
+* are thread safe.
+*/
+
+@interface SGCacheCircuitBreaker : NSObject
+
++ (instancetype)sharedBreaker;
+
+/**
+* Returns NO while the host's circuit is open. Returns YES for the one trial
+* request once the open period has passed.
+*/
+- (BOOL)allowRequestToHost:(NSString *)host;
+
+- (void)recordSuccessForHost:(NSString *)host;
+- (void)recordFailureForHost:(NSString *)host;
+
+@end
@@ -0,0 +1,108 @@
+//
+//  SGCacheCircuitBreaker.m
+//  Pods
+//
+
+#import "SGCacheCircuitBreaker.h"
+#import "SGCache.h"
+
+#define FAILURE_THRESHOLD 5
+#define MIN_OPEN_DURATION 5.0
+#define MAX_OPEN_DURATION 120.0
+#define TRIAL_TIMEOUT 60.0
+
+@interface SGCacheHostHealth : NSObject
+@property (nonatomic, assign) NSUInteger consecutiveFailures;
+@property (nonatomic, assign) NSTimeInterval openUntil;
+@property (nonatomic, assign) NSTimeInterval openDuration;
+@property (nonatomic, assign) BOOL trialInFlight;
+@property (nonatomic, assign) NSTimeInterval trialStarted;
+@end
+
+@implementation SGCacheHostHealth
+@end
+
+@implementation SGCacheCircuitBreaker {
+    NSMutableDictionary *_hosts;
+}
+
++ (instancetype)sharedBreaker {
+    static SGCacheCircuitBreaker *singleton;
+    static dispatch_once_t token = 0;
+    dispatch_once(&token, ^{
+        singleton = self.new;
+    });
+    return singleton;
+}
+
+- (id)init {
+    self = [super init];
+    _hosts = NSMutableDictionary.new;
+    return self;
+}
+
+- (BOOL)allowRequestToHost:(NSString *)host {
+    if (!host) {
+        return YES;
+    }
+    @synchronized (self) {
+        SGCacheHostHealth *health = _hosts[host];
+        if (!health.openUntil) { // closed
+            return YES;
+        }
+        NSTimeInterval now = NSDate.timeIntervalSinceReferenceDate;
+        if (now < health.openUntil) {
+            return NO;
+        }
+        // a trial that never reported back (eg. was cancelled) doesn't block forever
+        if (health.trialInFlight && now - health.trialStarted < TRIAL_TIMEOUT) {
+            return NO;
+        }
+        health.trialInFlight = YES;
+        health.trialStarted = now;
+        return YES;
+    }
+}
+
+- (void)recordSuccessForHost:(NSString *)host {
+    if (!host) {
+        return;
+    }
+    @synchronized (self) {
+        if (_hosts[host] && (SGCache.logging & SGImageCacheLogErrors)) {
+            NSLog(@"Host recovered: %@", host);
+        }
+        [_hosts removeObjectForKey:host];
+    }
+}
+
+- (void)recordFailureForHost:(NSString *)host {
+    if (!host) {
+        return;
+    }
+    @synchronized (self) {
+        SGCacheHostHealth *health = _hosts[host];
+        if (!health) {
+            health = SGCacheHostHealth.new;
+            _hosts[host] = health;
+        }
+        health.consecutiveFailures++;
+
+        BOOL trialFailed = health.trialInFlight;
+        if (!trialFailed && health.consecutiveFailures < FAILURE_THRESHOLD) {
+            return;
+        }
+        if (!trialFailed && health.openUntil) { // already open, from requests started before it opened
+            return;
+        }
+        health.trialInFlight = NO;
+        health.openDuration = trialFailed
+              ? MIN(health.openDuration * 2, MAX_OPEN_DURATION) : MIN_OPEN_DURATION;
+        health.openUntil = NSDate.timeIntervalSinceReferenceDate + health.openDuration;
+        if (SGCache.logging & SGImageCacheLogErrors) {
+            NSLog(@"Host failing, pausing requests for %.0fs: %@", health.openDuration, host);
+        }
+    }
+}
+
+@end
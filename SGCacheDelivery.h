@@ -0,0 +1,30 @@
+//
+//  SGCacheDelivery.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+* Hands finished fetches' callbacks to the main thread in batches, once per
+* screen refresh, rather than waking the main thread for each one.
+*
+* Callbacks which arrive during a frame are run together at the start of the
+* next. Each batch runs for at most <frameBudget> seconds, and whatever
+* doesn't fit is carried over to the following frame, so a burst of
+* completions can't cause a hitch. Callbacks always run in the order they
+* were delivered. While the app is in the background, there are no frames to
+* wait for, and callbacks run as soon as they can.
+*/
+
+@interface SGCacheDelivery : NSObject
+
++ (instancetype)sharedDelivery;
+
+/** Main thread time to spend on callbacks each frame (defaults to 4ms). */
+@property (atomic, assign) NSTimeInterval frameBudget;
+
+/** Queue a block to run on the main thread. Safe to call from any thread. */
+- (void)deliver:(void(^)(void))block;
+
+@end
@@ -0,0 +1,133 @@
+//
+//  SGCacheDelivery.m
+//  Pods
+//
+
+#import "SGCacheDelivery.h"
+#import <UIKit/UIKit.h>
+#import <QuartzCore/QuartzCore.h>
+
+#define DEFAULT_FRAME_BUDGET 0.004
+
+#if !TARGET_OS_WATCH
+@interface SGCacheDelivery ()
+@property (nonatomic, strong) CADisplayLink *displayLink;
+@end
+#endif
+
+@implementation SGCacheDelivery {
+    NSMutableArray *_pending;
+    BOOL _scheduled;
+    BOOL _inBackground; // main thread only
+}
+
++ (instancetype)sharedDelivery {
+    static SGCacheDelivery *singleton;
+    static dispatch_once_t token = 0;
+    dispatch_once(&token, ^{
+        singleton = self.new;
+    });
+    return singleton;
+}
+
+- (id)init {
+    self = [super init];
+    _pending = NSMutableArray.new;
+    _frameBudget = DEFAULT_FRAME_BUDGET;
+
+#if !TARGET_OS_WATCH
+    // there are no frames in the background, so don't leave anything waiting for one.
+    // tracked from notifications, since UIApplication isn't available to extensions
+    [NSNotificationCenter.defaultCenter addObserver:self selector:@selector(didEnterBackground)
+          name:UIApplicationDidEnterBackgroundNotification object:nil];
+    [NSNotificationCenter.defaultCenter addObserver:self selector:@selector(willEnterForeground)
+          name:UIApplicationWillEnterForegroundNotification object:nil];
+#endif
+    return self;
+}
+
+- (void)deliver:(void(^)(void))block {
+    if (!block) {
+        return;
+    }
+    BOOL schedule;
+    @synchronized (self) {
+        [_pending addObject:[block copy]];
+        schedule = !_scheduled;
+        _scheduled = YES;
+    }
+
+    // one hop per batch, to wake the display link
+    if (schedule) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+#if TARGET_OS_WATCH
+            [self flush];
+#else
+            if (self->_inBackground) {
+                [self flush];
+            } else {
+                self.displayLink.paused = NO;
+            }
+#endif
+        });
+    }
+}
+
+#pragma mark - Main Thread
+
+#if !TARGET_OS_WATCH
+- (void)displayLinkFired:(CADisplayLink *)link {
+    [self runPendingUntil:CACurrentMediaTime() + self.frameBudget];
+}
+
+- (void)didEnterBackground {
+    _inBackground = YES;
+    [self flush];
+}
+
+- (void)willEnterForeground {
+    _inBackground = NO;
+}
+#endif
+
+- (void)flush {
+    [self runPendingUntil:DBL_MAX];
+}
+
+// runs at least one block each time, so delivery makes progress however long blocks take
+- (void)runPendingUntil:(CFTimeInterval)deadline {
+    while (YES) {
+        void (^block)(void);
+        @synchronized (self) {
+            if (!_pending.count) {
+                _scheduled = NO;
+#if !TARGET_OS_WATCH
+                _displayLink.paused = YES;
+#endif
+                return;
+            }
+            block = _pending.firstObject;
+            [_pending removeObjectAtIndex:0];
+        }
+        block();
+        if (CACurrentMediaTime() >= deadline) {
+            return;
+        }
+    }
+}
+
+#pragma mark - Getters
+
+#if !TARGET_OS_WATCH
+- (CADisplayLink *)displayLink {
+    if (!_displayLink) {
+        _displayLink = [CADisplayLink displayLinkWithTarget:self
+              selector:@selector(displayLinkFired:)];
+        _displayLink.paused = YES;
+        [_displayLink addToRunLoop:NSRunLoop.mainRunLoop forMode:NSRunLoopCommonModes];
+    }
+    return _displayLink;
+}
+#endif
+
+@end
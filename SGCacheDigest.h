@@ -0,0 +1,59 @@
+//
+//  SGCacheDigest.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+
+#define SGCacheDigestLength 16
+#define SGCacheDigestHexLength (SGCacheDigestLength * 2)
+
+/**
+* A fixed size 128 bit binary cache key, derived from a string cache key.
+* Digests are plain values, so they can be copied around and compared without
+* allocating. A digest is only rendered as hex when a file path is needed.
+*/
+typedef struct {
+    uint8_t bytes[SGCacheDigestLength];
+} SGCacheDigest;
+
+/**
+* Returns the digest for the given cache key, or an empty digest if the
+* key is nil or empty. Keys which start with a hex SHA-1, as default keys do,
+* aren't hashed again.
+*/
+SGCacheDigest SGCacheDigestMake(NSString *cacheKey);
+
+/**
+* Returns the leading half of the SHA-1 of the key, which is what digests were
+* before default keys stopped being hashed twice. Used to find files written
+* by earlier builds.
+*/
+SGCacheDigest SGCacheDigestMakeLegacy(NSString *cacheKey);
+
+BOOL SGCacheDigestIsEmpty(SGCacheDigest digest);
+BOOL SGCacheDigestEqual(SGCacheDigest a, SGCacheDigest b);
+
+/**
+* Writes the lowercase hex form of the digest into `hex`, followed by a nul.
+*/
+void SGCacheDigestGetHex(SGCacheDigest digest, char hex[SGCacheDigestHexLength + 1]);
+NSString *SGCacheDigestHexString(SGCacheDigest digest);
+
+/**
+* Parses a digest from its hex form (eg. a cache file name). Returns NO if the
+* string isn't exactly a hex digest.
+*/
+BOOL SGCacheDigestFromHex(NSString *hex, SGCacheDigest *digest);
+
+/**
+* Writes the lowercase hex form of `length` bytes into `hex`, which must have
+* room for `length * 2` characters. No nul terminator is written.
+*/
+void SGCacheHexEncode(const uint8_t *bytes, size_t length, char *hex);
+
+/**
+* Computes the SHA-1 of the UTF-8 form of a string without copying it into
+* an intermediate NSData.
+*/
+void SGCacheSHA1(NSString *string, uint8_t *digest);
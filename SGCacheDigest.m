@@ -0,0 +1,161 @@
+//
+//  SGCacheDigest.m
+//  Pods
+//
+
+#import "SGCacheDigest.h"
+#import <CommonCrypto/CommonDigest.h>
+
+#define KEY_HASH_HEX_LENGTH (CC_SHA1_DIGEST_LENGTH * 2)
+#define KEY_HASH_CHUNK_LENGTH 64
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static const char SGCacheHexTable[] = "0123456789abcdef";
+
+void SGCacheSHA1(NSString *string, uint8_t *digest) {
+    CFStringRef cfString = (__bridge CFStringRef)string;
+
+    // most URLs are backed by a UTF-8 compatible buffer we can hash directly.
+    // it's only handed out for ASCII contents, so its length is the string's
+    const char *utf8 = CFStringGetCStringPtr(cfString, kCFStringEncodingUTF8);
+    if (utf8) {
+        CC_SHA1(utf8, (CC_LONG)CFStringGetLength(cfString), digest);
+        return;
+    }
+
+    CC_SHA1_CTX context;
+    CC_SHA1_Init(&context);
+    char buffer[512];
+    NSUInteger used = 0;
+    NSRange remaining = NSMakeRange(0, string.length);
+    while (remaining.length) {
+        [string getBytes:buffer maxLength:sizeof(buffer) usedLength:&used
+              encoding:NSUTF8StringEncoding options:0 range:remaining remainingRange:&remaining];
+        if (!used) {
+            break;
+        }
+        CC_SHA1_Update(&context, buffer, (CC_LONG)used);
+    }
+    CC_SHA1_Final(digest, &context);
+}
+
+static int SGCacheHexValue(unichar c);
+
+// Default keys start with the hex SHA-1 of their URL, which is already as good
+// a hash as any, so the digest is read straight from its leading bytes. The
+// rest of the key, the SHA-1's tail and the request header hash, is folded
+// into the second half with FNV-1a.
+static BOOL SGCacheDigestFromHashedKey(NSString *cacheKey, SGCacheDigest *digest) {
+    NSUInteger length = cacheKey.length;
+    if (length < KEY_HASH_HEX_LENGTH) {
+        return NO;
+    }
+    unichar chars[KEY_HASH_CHUNK_LENGTH];
+    [cacheKey getCharacters:chars range:NSMakeRange(0, KEY_HASH_HEX_LENGTH)];
+    for (int i = 0; i < KEY_HASH_HEX_LENGTH; i++) {
+        if (SGCacheHexValue(chars[i]) < 0) {
+            return NO;
+        }
+    }
+    for (int i = 0; i < SGCacheDigestLength; i++) {
+        digest->bytes[i] = (uint8_t)(SGCacheHexValue(chars[i * 2]) << 4
+              | SGCacheHexValue(chars[i * 2 + 1]));
+    }
+
+    uint64_t fold = FNV_OFFSET_BASIS;
+    for (NSUInteger start = SGCacheDigestHexLength; start < length; start += KEY_HASH_CHUNK_LENGTH) {
+        NSUInteger count = MIN(KEY_HASH_CHUNK_LENGTH, length - start);
+        [cacheKey getCharacters:chars range:NSMakeRange(start, count)];
+        for (NSUInteger i = 0; i < count; i++) {
+            fold = (fold ^ chars[i]) * FNV_PRIME;
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        digest->bytes[SGCacheDigestLength - 8 + i] ^= (uint8_t)(fold >> (i * 8));
+    }
+    return YES;
+}
+
+SGCacheDigest SGCacheDigestMake(NSString *cacheKey) {
+    SGCacheDigest digest = {{0}};
+    if (![cacheKey isKindOfClass:NSString.class] || !cacheKey.length) {
+        return digest;
+    }
+    if (SGCacheDigestFromHashedKey(cacheKey, &digest)) {
+        return digest;
+    }
+    return SGCacheDigestMakeLegacy(cacheKey);
+}
+
+SGCacheDigest SGCacheDigestMakeLegacy(NSString *cacheKey) {
+    SGCacheDigest digest = {{0}};
+    if (![cacheKey isKindOfClass:NSString.class] || !cacheKey.length) {
+        return digest;
+    }
+    uint8_t sha1[CC_SHA1_DIGEST_LENGTH];
+    SGCacheSHA1(cacheKey, sha1);
+    memcpy(digest.bytes, sha1, SGCacheDigestLength);
+    return digest;
+}
+
+BOOL SGCacheDigestIsEmpty(SGCacheDigest digest) {
+    for (int i = 0; i < SGCacheDigestLength; i++) {
+        if (digest.bytes[i]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+BOOL SGCacheDigestEqual(SGCacheDigest a, SGCacheDigest b) {
+    return !memcmp(a.bytes, b.bytes, SGCacheDigestLength);
+}
+
+void SGCacheHexEncode(const uint8_t *bytes, size_t length, char *hex) {
+    for (size_t i = 0; i < length; i++) {
+        hex[i * 2] = SGCacheHexTable[bytes[i] >> 4];
+        hex[i * 2 + 1] = SGCacheHexTable[bytes[i] & 0x0f];
+    }
+}
+
+void SGCacheDigestGetHex(SGCacheDigest digest, char hex[SGCacheDigestHexLength + 1]) {
+    SGCacheHexEncode(digest.bytes, SGCacheDigestLength, hex);
+    hex[SGCacheDigestHexLength] = '\0';
+}
+
+NSString *SGCacheDigestHexString(SGCacheDigest digest) {
+    char hex[SGCacheDigestHexLength + 1];
+    SGCacheDigestGetHex(digest, hex);
+    return [[NSString alloc] initWithBytes:hex length:SGCacheDigestHexLength
+          encoding:NSASCIIStringEncoding];
+}
+
+static int SGCacheHexValue(unichar c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+BOOL SGCacheDigestFromHex(NSString *hex, SGCacheDigest *digest) {
+    if (hex.length != SGCacheDigestHexLength) {
+        return NO;
+    }
+    unichar chars[SGCacheDigestHexLength];
+    [hex getCharacters:chars range:NSMakeRange(0, SGCacheDigestHexLength)];
+    for (int i = 0; i < SGCacheDigestLength; i++) {
+        int high = SGCacheHexValue(chars[i * 2]), low = SGCacheHexValue(chars[i * 2 + 1]);
+        if (high < 0 || low < 0) {
+            return NO;
+        }
+        digest->bytes[i] = (uint8_t)(high << 4 | low);
+    }
+    return YES;
+}
@@ -0,0 +1,63 @@
+//
+//  SGCacheDownload.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+
+@class SGCacheDownload;
+
+typedef void(^SGCacheDownloadHandler)(SGCacheDownload *download);
+
+/**
+* Fetches a remote file, appending the response body to a file on disk as it
+* arrives rather than buffering it in memory.
+*
+* The file at `path` is created when the response starts. On failure it is
+* deleted. A 304 (not modified) response succeeds without creating the file.
+* Handlers are called on a background queue.
+*
+* A resumable download keeps what it received when it fails or is cancelled,
+* along with the response's validator, and a later download to the same path
+* asks for just the rest with `Range` and `If-Range`. If the server sends the
+* whole body instead, the partial file is replaced. If it sends a range that
+* doesn't continue the file, the partial file is dropped and the whole body is
+* requested again before the download reports back.
+*/
+
+@interface SGCacheDownload : NSObject
+
+@property (nonatomic, readonly) NSURL *url;
+@property (nonatomic, readonly) NSString *path;
+@property (nonatomic, copy) NSDictionary *requestHeaders;
+@property (nonatomic, assign) BOOL resumable;
+
+/**
+* The transfer priority, from 0 to 1 as with `NSURLSessionTask`. Can be
+* changed while the download is in progress.
+*/
+@property (atomic, assign) float priority;
+
+@property (nonatomic, copy) SGCacheDownloadHandler onSuccess;
+@property (nonatomic, copy) SGCacheDownloadHandler onFailure;
+
+@property (nonatomic, readonly) NSHTTPURLResponse *response;
+@property (nonatomic, readonly) NSInteger statusCode;
+@property (nonatomic, readonly) NSError *error;
+@property (nonatomic, readonly) unsigned long long bytesReceived;
+
+/** The number of bytes kept from an earlier attempt, if the download resumed one. */
+@property (nonatomic, readonly) unsigned long long bytesResumed;
+
+/** Seconds from starting the request to the first body bytes arriving. */
+@property (nonatomic, readonly) NSTimeInterval timeToFirstByte;
+
+/** Seconds from starting the request to it completing. */
+@property (nonatomic, readonly) NSTimeInterval duration;
+
++ (instancetype)downloadWithURL:(NSURL *)url toPath:(NSString *)path;
+
+- (void)start;
+- (void)cancel;
+
+@end
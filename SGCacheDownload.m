@@ -0,0 +1,329 @@
+//
+//  SGCacheDownload.m
+//  Pods
+//
+
+#import "SGCacheDownload.h"
+#import "SGCache.h"
+#import "SGCacheEntryMetadata.h"
+#import <fcntl.h>
+#import <unistd.h>
+
+@interface SGCacheDownload ()
+@property (nonatomic, strong) NSURL *url;
+@property (nonatomic, copy) NSString *path;
+@property (nonatomic, strong) NSURLSessionDataTask *task;
+@property (nonatomic, strong) NSHTTPURLResponse *response;
+@property (nonatomic, strong) NSError *error;
+@property (nonatomic, assign) unsigned long long bytesReceived;
+@property (nonatomic, assign) unsigned long long bytesResumed;
+@property (nonatomic, assign) unsigned long long resumeOffset;
+@property (nonatomic, assign) NSTimeInterval startTime;
+@property (nonatomic, assign) NSTimeInterval timeToFirstByte;
+@property (nonatomic, assign) NSTimeInterval duration;
+@property (nonatomic, assign) int fd;
+@property (nonatomic, assign) BOOL restartsInFull;
+@property (atomic, assign) BOOL cancelled;
+@end
+
+@interface SGCacheDownloadSessionDelegate : NSObject <NSURLSessionDataDelegate>
+@property (nonatomic, strong) NSURLSession *session;
+@property (nonatomic, strong) NSMutableDictionary *downloads;
++ (instancetype)sharedDelegate;
+@end
+
+#pragma mark - Download
+
+@implementation SGCacheDownload
+
++ (instancetype)downloadWithURL:(NSURL *)url toPath:(NSString *)path {
+    SGCacheDownload *download = self.new;
+    download.url = url;
+    download.path = path;
+    download.fd = -1;
+    download.priority = NSURLSessionTaskPriorityDefault;
+    return download;
+}
+
+- (void)start {
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:self.url];
+    request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    [self.requestHeaders enumerateKeysAndObjectsUsingBlock:^(id name, id value, BOOL *stop) {
+        [request setValue:[value description] forHTTPHeaderField:[name description]];
+    }];
+
+    // pick up where an earlier attempt left off, if the content hasn't changed since
+    if (self.resumable) {
+        SGCacheEntryMetadata *partial = [SGCacheEntryMetadata metadataWithData:
+              [NSData dataWithContentsOfFile:self.partialMetadataPath]];
+        unsigned long long size = [NSFileManager.defaultManager
+              attributesOfItemAtPath:self.path error:nil].fileSize;
+        if (partial.rangeValidator && size) {
+            self.resumeOffset = size;
+            [request setValue:[NSString stringWithFormat:@"bytes=%llu-", size]
+                  forHTTPHeaderField:@"Range"];
+            [request setValue:partial.rangeValidator forHTTPHeaderField:@"If-Range"];
+        }
+    }
+
+    if (SGCache.logging & SGImageCacheLogRequests) {
+        NSLog(@"GET %@", self.url);
+    }
+
+    SGCacheDownloadSessionDelegate *delegate = SGCacheDownloadSessionDelegate.sharedDelegate;
+    self.startTime = NSDate.timeIntervalSinceReferenceDate;
+    self.task = [delegate.session dataTaskWithRequest:request];
+    self.task.priority = self.priority;
+    @synchronized (delegate) {
+        delegate.downloads[@(self.task.taskIdentifier)] = self;
+    }
+    [self.task resume];
+}
+
+- (void)cancel {
+    self.cancelled = YES;
+    [self.task cancel];
+}
+
+- (void)setPriority:(float)priority {
+    _priority = priority;
+    self.task.priority = priority;
+}
+
+- (NSInteger)statusCode {
+    return self.response.statusCode;
+}
+
+- (NSString *)partialMetadataPath {
+    return [self.path stringByAppendingPathExtension:@"meta"];
+}
+
+// a 206 only continues the partial file if it starts where the file ends
+- (BOOL)responseContinuesPartialFile {
+    if (self.statusCode != 206 || !self.resumeOffset) {
+        return NO;
+    }
+    NSString *range = self.response.allHeaderFields[@"Content-Range"];
+    NSScanner *scanner = [NSScanner scannerWithString:range ?: @""];
+    long long start;
+    return [scanner scanString:@"bytes" intoString:nil] && [scanner scanLongLong:&start]
+          && start == (long long)self.resumeOffset;
+}
+
+- (int)openFileWithFlags:(int)flags {
+    int fd = open(self.path.fileSystemRepresentation, flags, 0644);
+    if (fd < 0 && errno == ENOENT) {
+        [NSFileManager.defaultManager
+              createDirectoryAtPath:self.path.stringByDeletingLastPathComponent
+              withIntermediateDirectories:YES attributes:nil error:nil];
+        fd = open(self.path.fileSystemRepresentation, flags, 0644);
+    }
+    return fd;
+}
+
+#pragma mark - Session Events
+
+- (BOOL)receivedResponse:(NSURLResponse *)response {
+    self.response = [response isKindOfClass:NSHTTPURLResponse.class] ? (id)response : nil;
+    if (self.statusCode >= 400) {
+        return NO;
+    }
+    if (self.statusCode == 304) { // not modified, so there's no body to keep
+        return YES;
+    }
+    // a range the server got wrong is dropped, and the whole body asked for instead
+    if (self.statusCode == 206 && ![self responseContinuesPartialFile]) {
+        self.restartsInFull = self.resumeOffset > 0;
+        return NO;
+    }
+
+    // anything but a matching 206 is the whole body, so the partial file goes
+    if (self.statusCode == 206) {
+        self.fd = [self openFileWithFlags:O_WRONLY];
+        if (self.fd >= 0 && lseek(self.fd, self.resumeOffset, SEEK_SET) < 0) {
+            close(self.fd);
+            self.fd = -1;
+        }
+        self.bytesResumed = self.resumeOffset;
+    } else {
+        self.fd = [self openFileWithFlags:O_WRONLY | O_CREAT | O_TRUNC];
+    }
+    return self.fd >= 0;
+}
+
+- (void)receivedData:(NSData *)data {
+    if (!self.timeToFirstByte) {
+        self.timeToFirstByte = NSDate.timeIntervalSinceReferenceDate - self.startTime;
+    }
+    if (self.statusCode == 304) {
+        return;
+    }
+    __block BOOL failed = NO;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange range, BOOL *stop) {
+        size_t remaining = range.length;
+        while (remaining) {
+            const uint8_t *start = (const uint8_t *)bytes + (range.length - remaining);
+            ssize_t written = write(self.fd, start, remaining);
+            if (written < 0) {
+                failed = *stop = YES;
+                return;
+            }
+            remaining -= written;
+        }
+    }];
+    if (failed) {
+        self.error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        [self.task cancel];
+        return;
+    }
+    self.bytesReceived += data.length;
+}
+
+- (void)completedWithError:(NSError *)error {
+    self.duration = NSDate.timeIntervalSinceReferenceDate - self.startTime;
+    if (self.fd >= 0) {
+        close(self.fd);
+        self.fd = -1;
+    }
+    if (self.restartsInFull) {
+        [self restartInFull];
+        return;
+    }
+    if (self.statusCode >= 400) {
+        self.error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse
+              userInfo:@{NSLocalizedDescriptionKey : [NSHTTPURLResponse
+                    localizedStringForStatusCode:self.statusCode]}];
+    } else if (!self.error) {
+        self.error = error;
+    }
+
+    if (self.error) {
+        [self keepOrRemovePartialFile];
+        if (SGCache.logging & SGImageCacheLogErrors) {
+            NSLog(@"FAILED GET %@ (%@)", self.url, self.error.localizedDescription);
+        }
+        [self callHandler:self.onFailure];
+    } else {
+        unlink(self.partialMetadataPath.fileSystemRepresentation);
+        if (SGCache.logging & SGImageCacheLogResponses) {
+            NSLog(@"GOT %@ (%llu bytes, %llu resumed)", self.url, self.bytesReceived,
+                  self.bytesResumed);
+        }
+        [self callHandler:self.onSuccess];
+    }
+}
+
+// the partial file can't be continued, so it's truncated and the whole body
+// asked for, as part of the same attempt rather than failing it
+- (void)restartInFull {
+    if (SGCache.logging & SGImageCacheLogRequests) {
+        NSLog(@"Range not continued for %@, fetching in full", self.url);
+    }
+    unlink(self.path.fileSystemRepresentation);
+    unlink(self.partialMetadataPath.fileSystemRepresentation);
+    self.restartsInFull = NO;
+    self.response = nil;
+    self.resumeOffset = 0;
+    self.bytesResumed = 0;
+    self.bytesReceived = 0;
+    self.timeToFirstByte = 0;
+    if (self.cancelled) {
+        self.error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled
+              userInfo:nil];
+        [self callHandler:self.onFailure];
+        return;
+    }
+    [self start]; // without a partial file there's no range to ask for
+}
+
+// handlers store and decode, which mustn't hold up the delegate queue that
+// every other download's bytes arrive on
+- (void)callHandler:(SGCacheDownloadHandler)handler {
+    if (!handler) {
+        return;
+    }
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        handler(self);
+    });
+}
+
+// a body cut short is worth keeping if there's a validator to resume it with
+- (void)keepOrRemovePartialFile {
+    SGCacheEntryMetadata *partial = [SGCacheEntryMetadata
+          metadataWithResponseHeaders:self.response.allHeaderFields];
+    BOOL body = self.statusCode == 200 || self.statusCode == 206;
+    if (self.resumable && body && self.bytesResumed + self.bytesReceived
+          && partial.rangeValidator && [partial.data writeToFile:self.partialMetadataPath
+          atomically:YES]) {
+        if (SGCache.logging & SGImageCacheLogRequests) {
+            NSLog(@"Keeping %llu bytes of %@ to resume", self.bytesResumed + self.bytesReceived,
+                  self.url);
+        }
+        return;
+    }
+    unlink(self.path.fileSystemRepresentation);
+    unlink(self.partialMetadataPath.fileSystemRepresentation);
+}
+
+@end
+
+#pragma mark - Session Delegate
+
+@implementation SGCacheDownloadSessionDelegate
+
++ (instancetype)sharedDelegate {
+    static SGCacheDownloadSessionDelegate *delegate;
+    static dispatch_once_t token = 0;
+    dispatch_once(&token, ^{
+        delegate = self.new;
+    });
+    return delegate;
+}
+
+- (id)init {
+    self = [super init];
+    self.downloads = NSMutableDictionary.new;
+
+    NSURLSessionConfiguration *config = NSURLSessionConfiguration.defaultSessionConfiguration;
+    config.URLCache = nil;
+    config.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+
+    // SGCacheHostLimiter decides how many requests each host gets
+    config.HTTPMaximumConnectionsPerHost = 16;
+
+    // only byte I/O happens here. completion handlers run elsewhere
+    NSOperationQueue *queue = NSOperationQueue.new;
+    queue.maxConcurrentOperationCount = 1;
+    self.session = [NSURLSession sessionWithConfiguration:config delegate:self delegateQueue:queue];
+    return self;
+}
+
+- (SGCacheDownload *)downloadForTask:(NSURLSessionTask *)task {
+    @synchronized (self) {
+        return self.downloads[@(task.taskIdentifier)];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask
+      didReceiveResponse:(NSURLResponse *)response
+      completionHandler:(void (^)(NSURLSessionResponseDisposition))completionHandler {
+    BOOL accept = [[self downloadForTask:dataTask] receivedResponse:response];
+    completionHandler(accept ? NSURLSessionResponseAllow : NSURLSessionResponseCancel);
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask
+      didReceiveData:(NSData *)data {
+    [[self downloadForTask:dataTask] receivedData:data];
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task
+      didCompleteWithError:(NSError *)error {
+    SGCacheDownload *download;
+    @synchronized (self) {
+        download = self.downloads[@(task.taskIdentifier)];
+        [self.downloads removeObjectForKey:@(task.taskIdentifier)];
+    }
+    [download completedWithError:error];
+}
+
+@end
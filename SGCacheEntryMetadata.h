@@ -0,0 +1,55 @@
+//
+//  SGCacheEntryMetadata.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+* The validators and freshness lifetime a server gave for a cache entry,
+* kept in a small sidecar file next to the entry so it can later be
+* revalidated with a conditional request instead of fetched again in full.
+*/
+
+@interface SGCacheEntryMetadata : NSObject
+
+@property (nonatomic, copy) NSString *etag;
+@property (nonatomic, copy) NSString *lastModified;
+
+/** The Cache-Control max-age in seconds, or a negative value if none was given. */
+@property (nonatomic, assign) NSTimeInterval maxAge;
+
+/** When the entry was last fetched or revalidated. */
+@property (nonatomic, assign) NSTimeInterval fetched;
+
+/**
+* Metadata for a response's headers, or nil if the response gave nothing
+* worth keeping.
+*/
++ (instancetype)metadataWithResponseHeaders:(NSDictionary *)headers;
+
++ (instancetype)metadataWithData:(NSData *)data;
+- (NSData *)data;
+
+/**
+* Metadata for a 304 response to a request made with this metadata's
+* validators. Any validators the response gives replace the old ones.
+*/
+- (instancetype)metadataRevalidatedWithResponseHeaders:(NSDictionary *)headers;
+
+/** YES if there is a validator to make a conditional request with. */
+- (BOOL)canRevalidate;
+
+/**
+* A validator to send as `If-Range` when resuming a partial body, or nil if
+* there is none. Weak ETags can't be used for ranges.
+*/
+- (NSString *)rangeValidator;
+
+/** YES while the entry is within its max-age. */
+- (BOOL)isFresh;
+
+/** `If-None-Match` and `If-Modified-Since` headers for this entry. */
+- (NSDictionary *)conditionalRequestHeaders;
+
+@end
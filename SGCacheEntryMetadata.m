@@ -0,0 +1,122 @@
+//
+//  SGCacheEntryMetadata.m
+//  Pods
+//
+
+#import "SGCacheEntryMetadata.h"
+
+#define ETAG_KEY @"etag"
+#define LAST_MODIFIED_KEY @"lastModified"
+#define MAX_AGE_KEY @"maxAge"
+#define FETCHED_KEY @"fetched"
+
+// header names are case insensitive, and not every source canonicalises them
+static NSString *SGCacheHeaderValue(NSDictionary *headers, NSString *name) {
+    id value = headers[name];
+    if (!value) {
+        for (id key in headers) {
+            if ([key isKindOfClass:NSString.class] && ![key caseInsensitiveCompare:name]) {
+                value = headers[key];
+                break;
+            }
+        }
+    }
+    return [value isKindOfClass:NSString.class] && [value length] ? value : nil;
+}
+
+// no-cache and no-store both mean the entry must be revalidated before each use
+static NSTimeInterval SGCacheMaxAge(NSString *cacheControl) {
+    NSTimeInterval maxAge = -1;
+    for (NSString *part in [cacheControl.lowercaseString componentsSeparatedByString:@","]) {
+        NSString *directive = [part stringByTrimmingCharactersInSet:
+              NSCharacterSet.whitespaceCharacterSet];
+        if ([directive isEqualToString:@"no-cache"] || [directive isEqualToString:@"no-store"]) {
+            return 0;
+        }
+        if ([directive hasPrefix:@"max-age="]) {
+            maxAge = MAX([directive substringFromIndex:8].doubleValue, 0);
+        }
+    }
+    return maxAge;
+}
+
+@implementation SGCacheEntryMetadata
+
+- (id)init {
+    self = [super init];
+    _maxAge = -1;
+    _fetched = NSDate.timeIntervalSinceReferenceDate;
+    return self;
+}
+
++ (instancetype)metadataWithResponseHeaders:(NSDictionary *)headers {
+    SGCacheEntryMetadata *metadata = self.new;
+    metadata.etag = SGCacheHeaderValue(headers, @"ETag");
+    metadata.lastModified = SGCacheHeaderValue(headers, @"Last-Modified");
+    metadata.maxAge = SGCacheMaxAge(SGCacheHeaderValue(headers, @"Cache-Control"));
+    if (!metadata.canRevalidate && metadata.maxAge <= 0) {
+        return nil;
+    }
+    return metadata;
+}
+
++ (instancetype)metadataWithData:(NSData *)data {
+    if (!data.length) {
+        return nil;
+    }
+    NSDictionary *dict = [NSPropertyListSerialization propertyListWithData:data
+          options:NSPropertyListImmutable format:nil error:nil];
+    if (![dict isKindOfClass:NSDictionary.class]) {
+        return nil;
+    }
+    SGCacheEntryMetadata *metadata = self.new;
+    metadata.etag = dict[ETAG_KEY];
+    metadata.lastModified = dict[LAST_MODIFIED_KEY];
+    metadata.maxAge = [dict[MAX_AGE_KEY] doubleValue];
+    metadata.fetched = [dict[FETCHED_KEY] doubleValue];
+    return metadata;
+}
+
+- (NSData *)data {
+    NSMutableDictionary *dict = NSMutableDictionary.new;
+    dict[ETAG_KEY] = self.etag;
+    dict[LAST_MODIFIED_KEY] = self.lastModified;
+    dict[MAX_AGE_KEY] = @(self.maxAge);
+    dict[FETCHED_KEY] = @(self.fetched);
+    return [NSPropertyListSerialization dataWithPropertyList:dict
+          format:NSPropertyListBinaryFormat_v1_0 options:0 error:nil];
+}
+
+- (instancetype)metadataRevalidatedWithResponseHeaders:(NSDictionary *)headers {
+    SGCacheEntryMetadata *metadata = SGCacheEntryMetadata.new;
+    metadata.etag = SGCacheHeaderValue(headers, @"ETag") ?: self.etag;
+    metadata.lastModified = SGCacheHeaderValue(headers, @"Last-Modified") ?: self.lastModified;
+    NSString *cacheControl = SGCacheHeaderValue(headers, @"Cache-Control");
+    metadata.maxAge = cacheControl ? SGCacheMaxAge(cacheControl) : self.maxAge;
+    return metadata;
+}
+
+- (BOOL)canRevalidate {
+    return self.etag || self.lastModified;
+}
+
+- (NSString *)rangeValidator {
+    if (self.etag && ![self.etag hasPrefix:@"W/"]) {
+        return self.etag;
+    }
+    return self.lastModified;
+}
+
+- (BOOL)isFresh {
+    NSTimeInterval age = NSDate.timeIntervalSinceReferenceDate - self.fetched;
+    return self.maxAge > 0 && age >= 0 && age < self.maxAge;
+}
+
+- (NSDictionary *)conditionalRequestHeaders {
+    NSMutableDictionary *headers = NSMutableDictionary.new;
+    headers[@"If-None-Match"] = self.etag;
+    headers[@"If-Modified-Since"] = self.lastModified;
+    return headers;
+}
+
+@end
@@ -0,0 +1,57 @@
+//
+//  SGCacheHostLimiter.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+#import "SGCache.h"
+
+/**
+* Limits how many remote fetches are in flight to each host at once, so
+* bursts wait here, where they can be prioritised, rather than in the
+* network stack.
+*
+* Each host's limit adapts to what completed fetches report. It grows by
+* about one per round of fetches while time to first byte stays close to the
+* best seen for the host. It shrinks by a quarter when time to first byte
+* climbs well above that, when large bodies arrive at well under the usual
+* throughput, or when the host fails. All methods are thread safe.
+*/
+
+@interface SGCacheHostLimiter : NSObject
+
++ (instancetype)sharedLimiter;
+
+/**
+* Calls `block` on a background queue once a slot for the host is free.
+* Waiting blocks are started highest priority first. Every acquired slot must
+* be given back with <releaseSlotForHost:>.
+*
+* Returns a waiter that can be passed to <updatePriority:forWaiter:> if the
+* block has to wait, or nil if it was started at once.
+*/
+- (id)acquireSlotForHost:(NSString *)host priority:(SGCachePriority)priority
+      thenDo:(void(^)(void))block;
+
+/**
+* Moves a waiter to its place for a new priority. Does nothing if its block
+* has already been started.
+*/
+- (void)updatePriority:(SGCachePriority)priority forWaiter:(id)waiter;
+
+/**
+* Drops a waiter, so its block is never started. Returns NO if its block has
+* already been started, in which case its slot must still be given back.
+*/
+- (BOOL)removeWaiter:(id)waiter;
+
+- (void)releaseSlotForHost:(NSString *)host;
+
+- (void)recordTimeToFirstByte:(NSTimeInterval)ttfb bytes:(unsigned long long)bytes
+      duration:(NSTimeInterval)duration forHost:(NSString *)host;
+- (void)recordFailureForHost:(NSString *)host;
+
+/** The host's current in flight limit. */
+- (NSUInteger)limitForHost:(NSString *)host;
+
+@end
@@ -0,0 +1,234 @@
+//
+//  SGCacheHostLimiter.m
+//  Pods
+//
+
+#import "SGCacheHostLimiter.h"
+
+#define INITIAL_HOST_LIMIT 6.0
+#define MIN_HOST_LIMIT 2.0
+#define MAX_HOST_LIMIT 16.0
+#define LIMIT_DECREASE_FACTOR 0.75
+#define LATENCY_TOLERANCE 2.0
+#define BASELINE_DRIFT 0.01
+#define THROUGHPUT_SMOOTHING 0.2
+#define THROUGHPUT_TOLERANCE 0.5
+#define MIN_THROUGHPUT_SAMPLE_BYTES (64 * 1024)
+
+@interface SGCacheHostWaiter : NSObject
+@property (nonatomic, copy) NSString *host;
+@property (nonatomic, assign) SGCachePriority priority;
+@property (nonatomic, copy) void (^block)(void);
+@end
+
+@implementation SGCacheHostWaiter
+@end
+
+@interface SGCacheHostState : NSObject
+@property (nonatomic, assign) double limit;
+@property (nonatomic, assign) NSUInteger inFlight;
+@property (nonatomic, strong) NSMutableArray <SGCacheHostWaiter *> *waiters;
+@property (nonatomic, assign) NSTimeInterval baselineTTFB;
+@property (nonatomic, assign) double throughput;
+@property (nonatomic, assign) NSTimeInterval lastDecrease;
+@end
+
+@implementation SGCacheHostState
+
+- (id)init {
+    self = [super init];
+    _limit = INITIAL_HOST_LIMIT;
+    _waiters = NSMutableArray.new;
+    return self;
+}
+
+@end
+
+@implementation SGCacheHostLimiter {
+    NSMutableDictionary *_hosts;
+}
+
++ (instancetype)sharedLimiter {
+    static SGCacheHostLimiter *singleton;
+    static dispatch_once_t token = 0;
+    dispatch_once(&token, ^{
+        singleton = self.new;
+    });
+    return singleton;
+}
+
+- (id)init {
+    self = [super init];
+    _hosts = NSMutableDictionary.new;
+    return self;
+}
+
+- (SGCacheHostState *)stateForHost:(NSString *)host {
+    SGCacheHostState *state = _hosts[host];
+    if (!state) {
+        state = SGCacheHostState.new;
+        _hosts[host] = state;
+    }
+    return state;
+}
+
+#pragma mark - Slots
+
+- (id)acquireSlotForHost:(NSString *)host priority:(SGCachePriority)priority
+      thenDo:(void(^)(void))block {
+    if (!block) {
+        return nil;
+    }
+    if (host) {
+        @synchronized (self) {
+            SGCacheHostState *state = [self stateForHost:host];
+            if (state.inFlight >= (NSUInteger)state.limit) {
+                SGCacheHostWaiter *waiter = SGCacheHostWaiter.new;
+                waiter.host = host;
+                waiter.priority = priority;
+                waiter.block = block;
+                [self insertWaiter:waiter intoState:state];
+                return waiter;
+            }
+            state.inFlight++;
+        }
+    }
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), block);
+    return nil;
+}
+
+- (void)updatePriority:(SGCachePriority)priority forWaiter:(SGCacheHostWaiter *)waiter {
+    if (![waiter isKindOfClass:SGCacheHostWaiter.class]) {
+        return;
+    }
+    @synchronized (self) {
+        if (waiter.priority == priority) {
+            return;
+        }
+        SGCacheHostState *state = [self stateForHost:waiter.host];
+        NSUInteger index = [state.waiters indexOfObjectIdenticalTo:waiter];
+        if (index == NSNotFound) { // already started
+            return;
+        }
+        [state.waiters removeObjectAtIndex:index];
+        waiter.priority = priority;
+        [self insertWaiter:waiter intoState:state];
+    }
+}
+
+- (BOOL)removeWaiter:(SGCacheHostWaiter *)waiter {
+    if (![waiter isKindOfClass:SGCacheHostWaiter.class]) {
+        return NO;
+    }
+    @synchronized (self) {
+        SGCacheHostState *state = [self stateForHost:waiter.host];
+        NSUInteger index = [state.waiters indexOfObjectIdenticalTo:waiter];
+        if (index == NSNotFound) { // already started
+            return NO;
+        }
+        [state.waiters removeObjectAtIndex:index];
+        waiter.block = nil;
+        return YES;
+    }
+}
+
+// keeps waiters highest priority first, first come first served within a level
+- (void)insertWaiter:(SGCacheHostWaiter *)waiter intoState:(SGCacheHostState *)state {
+    NSUInteger index = state.waiters.count;
+    while (index && state.waiters[index - 1].priority < waiter.priority) {
+        index--;
+    }
+    [state.waiters insertObject:waiter atIndex:index];
+}
+
+- (void)releaseSlotForHost:(NSString *)host {
+    if (!host) {
+        return;
+    }
+    [self startWaitersForHost:host released:1];
+}
+
+// starts as many waiters as the host's limit now allows
+- (void)startWaitersForHost:(NSString *)host released:(NSUInteger)released {
+    NSMutableArray *blocks = NSMutableArray.new;
+    @synchronized (self) {
+        SGCacheHostState *state = [self stateForHost:host];
+        state.inFlight -= MIN(released, state.inFlight);
+        while (state.waiters.count && state.inFlight < (NSUInteger)state.limit) {
+            SGCacheHostWaiter *waiter = state.waiters.firstObject;
+            [blocks addObject:waiter.block];
+            waiter.block = nil; // a waiter can be held on to after it's started
+            [state.waiters removeObjectAtIndex:0];
+            state.inFlight++;
+        }
+    }
+    for (void (^block)(void) in blocks) {
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), block);
+    }
+}
+
+#pragma mark - Adapting
+
+- (void)recordTimeToFirstByte:(NSTimeInterval)ttfb bytes:(unsigned long long)bytes
+      duration:(NSTimeInterval)duration forHost:(NSString *)host {
+    if (!host || ttfb <= 0) {
+        return;
+    }
+    @synchronized (self) {
+        SGCacheHostState *state = [self stateForHost:host];
+
+        // the baseline follows new lows at once, and drifts up slowly so it can recover
+        if (!state.baselineTTFB || ttfb < state.baselineTTFB) {
+            state.baselineTTFB = ttfb;
+        } else {
+            state.baselineTTFB += (ttfb - state.baselineTTFB) * BASELINE_DRIFT;
+        }
+
+        // only larger bodies say much about throughput
+        BOOL slowBody = NO;
+        NSTimeInterval transfer = duration - ttfb;
+        if (bytes >= MIN_THROUGHPUT_SAMPLE_BYTES && transfer > 0) {
+            double throughput = bytes / transfer;
+            slowBody = state.throughput && throughput < state.throughput * THROUGHPUT_TOLERANCE;
+            state.throughput = state.throughput
+                  ? state.throughput + (throughput - state.throughput) * THROUGHPUT_SMOOTHING
+                  : throughput;
+        }
+
+        if (ttfb > state.baselineTTFB * LATENCY_TOLERANCE || slowBody) {
+            [self decreaseLimitForState:state];
+        } else if (state.inFlight >= (NSUInteger)state.limit || state.waiters.count) {
+            // only grow while the limit is actually being used
+            state.limit = MIN(state.limit + 1.0 / state.limit, MAX_HOST_LIMIT);
+        }
+    }
+    [self startWaitersForHost:host released:0];
+}
+
+- (void)recordFailureForHost:(NSString *)host {
+    if (!host) {
+        return;
+    }
+    @synchronized (self) {
+        [self decreaseLimitForState:[self stateForHost:host]];
+    }
+}
+
+// at most one decrease per baseline round trip, so a burst of slow responses
+// to the same congestion only counts once
+- (void)decreaseLimitForState:(SGCacheHostState *)state {
+    NSTimeInterval now = NSDate.timeIntervalSinceReferenceDate;
+    if (now - state.lastDecrease < MAX(state.baselineTTFB, 0.1)) {
+        return;
+    }
+    state.lastDecrease = now;
+    state.limit = MAX(state.limit * LIMIT_DECREASE_FACTOR, MIN_HOST_LIMIT);
+}
+
+- (NSUInteger)limitForHost:(NSString *)host {
+    @synchronized (self) {
+        return (NSUInteger)[self stateForHost:host].limit;
+    }
+}
+
+@end
@@ -0,0 +1,102 @@
+//
+//  SGCacheIndex.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+#import "SGCacheDigest.h"
+
+/**
+* A persistent, memory mapped record of every entry in a disk cache: its size,
+* when it was added, when it was last read, and how many times it has been
+* read.
+*
+* The index is an open addressed hash table stored directly in the mapped
+* file, so updates cost a memory write and survive the app being killed. If
+* the file is missing or fails validation on open, a fresh index is created
+* and `needsRebuild` is set so the owner can repopulate it from a directory
+* scan. Likewise `needsSweep` is set when the last session may have left
+* files the index doesn't know about. All methods are thread safe.
+*/
+
+@interface SGCacheIndex : NSObject
+
+- (instancetype)initWithPath:(NSString *)path;
+
+/**
+* YES if the index was created from scratch (or a previous rebuild didn't
+* complete) and should be repopulated with <addDigest:size:created:lastAccess:>.
+*/
+@property (nonatomic, readonly) BOOL needsRebuild;
+
+/**
+* YES if the last session was killed while an entry was being written, or
+* failed to record an entry, so there may be files on disk the index doesn't
+* know about. They should be added with <addDigest:size:created:lastAccess:>
+* between <beginRebuild> and <finishRebuild>.
+*/
+@property (nonatomic, readonly) BOOL needsSweep;
+
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, readonly) unsigned long long totalBytes;
+
+/**
+* Records a write of `size` bytes, adding the entry if it's new.
+*/
+- (void)setSize:(unsigned long long)size forDigest:(SGCacheDigest)digest;
+
+/**
+* Adds an entry found by a directory scan, unless the entry is already indexed.
+* Returns NO if the entry couldn't be recorded.
+*/
+- (BOOL)addDigest:(SGCacheDigest)digest size:(unsigned long long)size
+      created:(NSTimeInterval)created lastAccess:(NSTimeInterval)lastAccess;
+
+/**
+* Brackets storing an entry's file and recording it with <setSize:forDigest:>.
+* Writes still open when the app is killed set `needsSweep` on the next open.
+*/
+- (void)beginWrite;
+- (void)endWrite;
+
+/**
+* YES if the digest is definitely not cached: the index is complete and has
+* no entry for it. Answered from memory, so callers can skip the file system.
+* Returns NO whenever the index may be missing entries, ie. while a rebuild
+* or sweep is pending or after an entry failed to be recorded.
+*/
+- (BOOL)definitelyLacksDigest:(SGCacheDigest)digest;
+
+/**
+* Records a read of an existing entry.
+*/
+- (void)touchDigest:(SGCacheDigest)digest;
+
+- (void)removeDigest:(SGCacheDigest)digest;
+
+/**
+* Marks the index incomplete while a rebuild or sweep runs, so misses aren't
+* answered from it, and clears `needsSweep`.
+*/
+- (void)beginRebuild;
+
+/**
+* Marks a rebuild as complete, clearing `needsRebuild`.
+*/
+- (void)finishRebuild;
+
+/**
+* Finds an eviction candidate by sampling a handful of entries and picking the
+* least recently read. Returns NO if the index is empty.
+*/
+- (BOOL)getLeastRecentlyUsedDigest:(SGCacheDigest *)digest;
+
+/**
+* Scans a bounded run of the table starting at `cursor`, copying up to `max`
+* digests of entries created before `cutoff` into `digests`. Advances `cursor`
+* past the scanned slots and returns NO once the whole table has been scanned.
+*/
+- (BOOL)getDigests:(SGCacheDigest *)digests count:(NSUInteger *)count max:(NSUInteger)max
+      createdBefore:(NSTimeInterval)cutoff cursor:(uint64_t *)cursor;
+
+@end
@@ -0,0 +1,469 @@
+//
+//  SGCacheIndex.m
+//  Pods
+//
+
+#import "SGCacheIndex.h"
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+#define INDEX_MAGIC 0x49434753 // "SGCI"
+#define INDEX_VERSION 1
+#define INITIAL_CAPACITY 4096
+#define MAX_LOAD_FACTOR 0.7
+#define EVICTION_SAMPLE_SIZE 16
+#define MAX_SCAN_LENGTH 1024
+
+typedef NS_ENUM(uint32_t, SGCacheIndexSlotState) {
+    SGCacheIndexSlotEmpty = 0,
+    SGCacheIndexSlotUsed = 1,
+    SGCacheIndexSlotRemoved = 2
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t removed;
+    uint64_t totalBytes;
+    uint32_t complete;
+    uint32_t pendingWrites;
+    uint32_t lostEntries;
+    uint8_t reserved[12];
+} SGCacheIndexHeader;
+
+typedef struct {
+    SGCacheDigest digest;
+    uint64_t size;
+    double created;
+    double lastAccess;
+    uint32_t hits;
+    uint32_t state;
+} SGCacheIndexSlot;
+
+static size_t SGCacheIndexLength(uint64_t capacity) {
+    return sizeof(SGCacheIndexHeader) + (size_t)capacity * sizeof(SGCacheIndexSlot);
+}
+
+@implementation SGCacheIndex {
+    NSString *_path;
+    int _fd;
+    size_t _length;
+    SGCacheIndexHeader *_header;
+    SGCacheIndexSlot *_slots;
+    BOOL _needsSweep;
+}
+
+- (instancetype)initWithPath:(NSString *)path {
+    self = [super init];
+    _path = path.copy;
+    _fd = -1;
+    if (![self openExisting]) {
+        [self replaceWithCapacity:INITIAL_CAPACITY];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self unmap];
+}
+
+#pragma mark - Public API
+
+- (BOOL)needsRebuild {
+    @synchronized (self) {
+        return _header && !_header->complete;
+    }
+}
+
+- (BOOL)needsSweep {
+    @synchronized (self) {
+        return _needsSweep;
+    }
+}
+
+- (NSUInteger)count {
+    @synchronized (self) {
+        return _header ? (NSUInteger)_header->count : 0;
+    }
+}
+
+- (unsigned long long)totalBytes {
+    @synchronized (self) {
+        return _header ? _header->totalBytes : 0;
+    }
+}
+
+- (void)setSize:(unsigned long long)size forDigest:(SGCacheDigest)digest {
+    NSTimeInterval now = NSDate.timeIntervalSinceReferenceDate;
+    @synchronized (self) {
+        SGCacheIndexSlot *slot = [self insertionSlotForDigest:digest];
+        if (!slot) {
+            [self lostEntryForDigest:digest];
+            return;
+        }
+        if (slot->state == SGCacheIndexSlotUsed) {
+            _header->totalBytes -= slot->size;
+        } else {
+            [self claimSlot:slot forDigest:digest created:now];
+        }
+        slot->size = size;
+        slot->lastAccess = now;
+        _header->totalBytes += size;
+    }
+}
+
+- (BOOL)addDigest:(SGCacheDigest)digest size:(unsigned long long)size
+      created:(NSTimeInterval)created lastAccess:(NSTimeInterval)lastAccess {
+    @synchronized (self) {
+        SGCacheIndexSlot *slot = [self insertionSlotForDigest:digest];
+        if (!slot) {
+            [self lostEntryForDigest:digest];
+            return NO;
+        }
+        if (slot->state == SGCacheIndexSlotUsed) {
+            return YES;
+        }
+        [self claimSlot:slot forDigest:digest created:created];
+        slot->size = size;
+        slot->lastAccess = lastAccess;
+        _header->totalBytes += size;
+        return YES;
+    }
+}
+
+// the file is on disk but not in the index. remembered in the file, so the
+// next session sweeps for it even if this one is killed
+- (void)lostEntryForDigest:(SGCacheDigest)digest {
+    if (_header && !SGCacheDigestIsEmpty(digest)) {
+        _header->lostEntries = 1;
+    }
+}
+
+- (void)beginWrite {
+    @synchronized (self) {
+        if (_header) {
+            _header->pendingWrites++;
+        }
+    }
+}
+
+- (void)endWrite {
+    @synchronized (self) {
+        if (_header && _header->pendingWrites) {
+            _header->pendingWrites--;
+        }
+    }
+}
+
+- (BOOL)definitelyLacksDigest:(SGCacheDigest)digest {
+    @synchronized (self) {
+        if (!_header || !_header->complete || _header->lostEntries) {
+            return NO;
+        }
+        return ![self slotForDigest:digest];
+    }
+}
+
+- (void)touchDigest:(SGCacheDigest)digest {
+    NSTimeInterval now = NSDate.timeIntervalSinceReferenceDate;
+    @synchronized (self) {
+        SGCacheIndexSlot *slot = [self slotForDigest:digest];
+        if (slot) {
+            slot->lastAccess = now;
+            slot->hits++;
+        }
+    }
+}
+
+- (void)removeDigest:(SGCacheDigest)digest {
+    @synchronized (self) {
+        SGCacheIndexSlot *slot = [self slotForDigest:digest];
+        if (!slot) {
+            return;
+        }
+        slot->state = SGCacheIndexSlotRemoved;
+        _header->count--;
+        _header->removed++;
+        _header->totalBytes -= slot->size;
+    }
+}
+
+- (void)beginRebuild {
+    @synchronized (self) {
+        _needsSweep = NO;
+        if (_header) {
+            _header->complete = 0;
+            _header->lostEntries = 0;
+        }
+    }
+}
+
+- (void)finishRebuild {
+    @synchronized (self) {
+        if (_header) {
+            _header->complete = 1;
+        }
+    }
+}
+
+- (BOOL)getLeastRecentlyUsedDigest:(SGCacheDigest *)digest {
+    @synchronized (self) {
+        if (!_header || !_header->count) {
+            return NO;
+        }
+        uint64_t capacity = _header->capacity;
+        uint64_t start = arc4random_uniform((uint32_t)capacity);
+        SGCacheIndexSlot *oldest = NULL;
+        int sampled = 0;
+        for (uint64_t i = 0; i < capacity && sampled < EVICTION_SAMPLE_SIZE; i++) {
+            SGCacheIndexSlot *slot = &_slots[(start + i) & (capacity - 1)];
+            if (slot->state != SGCacheIndexSlotUsed) {
+                continue;
+            }
+            sampled++;
+            if (!oldest || slot->lastAccess < oldest->lastAccess) {
+                oldest = slot;
+            }
+        }
+        if (!oldest) {
+            return NO;
+        }
+        *digest = oldest->digest;
+        return YES;
+    }
+}
+
+- (BOOL)getDigests:(SGCacheDigest *)digests count:(NSUInteger *)count max:(NSUInteger)max
+      createdBefore:(NSTimeInterval)cutoff cursor:(uint64_t *)cursor {
+    *count = 0;
+    @synchronized (self) {
+        if (!_header) {
+            return NO;
+        }
+        uint64_t capacity = _header->capacity, i = *cursor;
+        uint64_t end = MIN(capacity, i + MAX_SCAN_LENGTH);
+        for (; i < end && *count < max; i++) {
+            SGCacheIndexSlot *slot = &_slots[i];
+            if (slot->state == SGCacheIndexSlotUsed && slot->created < cutoff) {
+                digests[(*count)++] = slot->digest;
+            }
+        }
+        *cursor = i;
+        return i < capacity;
+    }
+}
+
+#pragma mark - Hash Table
+
+- (SGCacheIndexSlot *)slotForDigest:(SGCacheDigest)digest {
+    if (!_header) {
+        return NULL;
+    }
+    uint64_t mask = _header->capacity - 1, hash;
+    memcpy(&hash, digest.bytes, sizeof(hash));
+    for (uint64_t i = 0; i <= mask; i++) {
+        SGCacheIndexSlot *slot = &_slots[(hash + i) & mask];
+        if (slot->state == SGCacheIndexSlotEmpty) {
+            return NULL;
+        }
+        if (slot->state == SGCacheIndexSlotUsed && SGCacheDigestEqual(slot->digest, digest)) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// returns the existing slot for the digest, or a free slot to claim for it
+- (SGCacheIndexSlot *)insertionSlotForDigest:(SGCacheDigest)digest {
+    if (!_header || SGCacheDigestIsEmpty(digest)) {
+        return NULL;
+    }
+    if (_header->count + _header->removed + 1 > _header->capacity * MAX_LOAD_FACTOR) {
+        uint64_t capacity = _header->capacity;
+        if (_header->count + 1 > capacity * MAX_LOAD_FACTOR / 2) {
+            capacity *= 2;
+        }
+        [self replaceWithCapacity:capacity];
+        if (!_header) {
+            return NULL;
+        }
+    }
+    uint64_t mask = _header->capacity - 1, hash;
+    memcpy(&hash, digest.bytes, sizeof(hash));
+    SGCacheIndexSlot *firstRemoved = NULL;
+    for (uint64_t i = 0; i <= mask; i++) {
+        SGCacheIndexSlot *slot = &_slots[(hash + i) & mask];
+        if (slot->state == SGCacheIndexSlotEmpty) {
+            return firstRemoved ?: slot;
+        }
+        if (slot->state == SGCacheIndexSlotRemoved) {
+            firstRemoved = firstRemoved ?: slot;
+        } else if (SGCacheDigestEqual(slot->digest, digest)) {
+            return slot;
+        }
+    }
+    return firstRemoved;
+}
+
+- (void)claimSlot:(SGCacheIndexSlot *)slot forDigest:(SGCacheDigest)digest
+      created:(NSTimeInterval)created {
+    if (slot->state == SGCacheIndexSlotRemoved) {
+        _header->removed--;
+    }
+    slot->digest = digest;
+    slot->size = 0;
+    slot->created = created;
+    slot->lastAccess = created;
+    slot->hits = 0;
+    slot->state = SGCacheIndexSlotUsed;
+    _header->count++;
+}
+
+#pragma mark - File Mapping
+
+- (BOOL)openExisting {
+    int fd = open(_path.fileSystemRepresentation, O_RDWR);
+    if (fd < 0) {
+        return NO;
+    }
+    struct stat info;
+    if (fstat(fd, &info) || info.st_size < (off_t)sizeof(SGCacheIndexHeader)) {
+        close(fd);
+        return NO;
+    }
+    size_t length = (size_t)info.st_size;
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NO;
+    }
+
+    // anything unexpected means the index is discarded and rebuilt
+    SGCacheIndexHeader *header = map;
+    uint64_t capacity = header->capacity;
+    if (header->magic != INDEX_MAGIC || header->version != INDEX_VERSION || !capacity
+          || (capacity & (capacity - 1)) || length != SGCacheIndexLength(capacity)) {
+        munmap(map, length);
+        close(fd);
+        return NO;
+    }
+
+    _fd = fd;
+    _length = length;
+    _header = header;
+    _slots = (SGCacheIndexSlot *)(header + 1);
+    [self recount];
+
+    // nothing is being written yet, so any writes still open were cut short
+    _needsSweep = header->pendingWrites || header->lostEntries;
+    header->pendingWrites = 0;
+    return YES;
+}
+
+// the header totals may be stale if the app was killed mid update
+- (void)recount {
+    uint64_t count = 0, removed = 0, totalBytes = 0;
+    for (uint64_t i = 0; i < _header->capacity; i++) {
+        SGCacheIndexSlot *slot = &_slots[i];
+        if (slot->state == SGCacheIndexSlotUsed && SGCacheDigestIsEmpty(slot->digest)) {
+            slot->state = SGCacheIndexSlotRemoved;
+        }
+        switch (slot->state) {
+            case SGCacheIndexSlotEmpty:
+                break;
+            case SGCacheIndexSlotUsed:
+                count++;
+                totalBytes += slot->size;
+                break;
+            default:
+                slot->state = SGCacheIndexSlotRemoved;
+                removed++;
+                break;
+        }
+    }
+    _header->count = count;
+    _header->removed = removed;
+    _header->totalBytes = totalBytes;
+}
+
+// builds a new index file of the given capacity, carrying over any current
+// entries, and swaps it into place
+- (void)replaceWithCapacity:(uint64_t)capacity {
+    NSString *tempPath = [_path stringByAppendingString:@".tmp"];
+    size_t length = SGCacheIndexLength(capacity);
+
+    int fd = open(tempPath.fileSystemRepresentation, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    if (ftruncate(fd, (off_t)length)) {
+        close(fd);
+        unlink(tempPath.fileSystemRepresentation);
+        return;
+    }
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        unlink(tempPath.fileSystemRepresentation);
+        return;
+    }
+
+    SGCacheIndexHeader *header = map;
+    SGCacheIndexSlot *slots = (SGCacheIndexSlot *)(header + 1);
+    header->magic = INDEX_MAGIC;
+    header->version = INDEX_VERSION;
+    header->capacity = capacity;
+    header->complete = _header ? _header->complete : 0;
+    header->pendingWrites = _header ? _header->pendingWrites : 0;
+    header->lostEntries = _header ? _header->lostEntries : 0;
+
+    for (uint64_t i = 0; _header && i < _header->capacity; i++) {
+        SGCacheIndexSlot *slot = &_slots[i];
+        if (slot->state != SGCacheIndexSlotUsed) {
+            continue;
+        }
+        uint64_t hash;
+        memcpy(&hash, slot->digest.bytes, sizeof(hash));
+        for (uint64_t j = 0; j < capacity; j++) {
+            SGCacheIndexSlot *target = &slots[(hash + j) & (capacity - 1)];
+            if (target->state == SGCacheIndexSlotEmpty) {
+                *target = *slot;
+                header->count++;
+                header->totalBytes += slot->size;
+                break;
+            }
+        }
+    }
+
+    msync(map, length, MS_SYNC);
+    if (rename(tempPath.fileSystemRepresentation, _path.fileSystemRepresentation)) {
+        munmap(map, length);
+        close(fd);
+        unlink(tempPath.fileSystemRepresentation);
+        return;
+    }
+
+    [self unmap];
+    _fd = fd;
+    _length = length;
+    _header = header;
+    _slots = slots;
+}
+
+- (void)unmap {
+    if (_header) {
+        munmap(_header, _length);
+        _header = NULL;
+        _slots = NULL;
+    }
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+@end
@@ -0,0 +1,120 @@
+//
+//  SGCacheMetrics.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSUInteger, SGCacheCounter) {
+    SGCacheCounterMemoryHits,
+    SGCacheCounterMemoryMisses,
+    SGCacheCounterDiskHits,
+    SGCacheCounterDiskMisses,
+    SGCacheCounterNetworkFetches,
+    SGCacheCounterNotModified,
+    SGCacheCounterBytesDownloaded,
+    SGCacheCounterBytesResumed,
+    SGCacheCounterBytesRead,
+    SGCacheCounterBytesWritten,
+    SGCacheCounterDedupeMerges,
+    SGCacheCounterRetries,
+    SGCacheCounterDiskEvictions,
+    SGCacheCounterMemoryEvictions
+};
+
+typedef NS_ENUM(NSUInteger, SGCacheGauge) {
+    SGCacheGaugeQueuedTasks,
+    SGCacheGaugeActiveDownloads
+};
+
+typedef NS_ENUM(NSUInteger, SGCacheTimer) {
+    SGCacheTimerQueueWait,
+    SGCacheTimerTimeToFirstByte,
+    SGCacheTimerDownload,
+    SGCacheTimerDecode,
+    SGCacheTimerDiskWrite
+};
+
+@class SGCacheMetrics, SGCacheMetricsSnapshot;
+
+@protocol SGCacheMetricsDelegate <NSObject>
+
+/** Called on the main thread every <reportingInterval> seconds. */
+- (void)cacheMetrics:(SGCacheMetrics *)metrics didTakeSnapshot:(SGCacheMetricsSnapshot *)snapshot;
+
+@end
+
+/**
+* A summary of one timer's recorded durations, in seconds. Percentiles are
+* accurate to within an eighth of their value.
+*/
+
+@interface SGCacheHistogramSnapshot : NSObject
+
+@property (nonatomic, readonly) unsigned long long count;
+@property (nonatomic, readonly) NSTimeInterval mean;
+@property (nonatomic, readonly) NSTimeInterval p50;
+@property (nonatomic, readonly) NSTimeInterval p95;
+@property (nonatomic, readonly) NSTimeInterval p99;
+@property (nonatomic, readonly) NSTimeInterval max;
+
+@end
+
+/**
+* The cache's counters, gauges and timers at a point in time. Counters and
+* timers cover everything since launch or the last <[SGCacheMetrics reset]>.
+*/
+
+@interface SGCacheMetricsSnapshot : NSObject
+
+@property (nonatomic, readonly) NSDate *date;
+
+- (unsigned long long)valueForCounter:(SGCacheCounter)counter;
+- (long long)valueForGauge:(SGCacheGauge)gauge;
+- (SGCacheHistogramSnapshot *)histogramForTimer:(SGCacheTimer)timer;
+
+/** The fraction of memory cache lookups which found an image. */
+@property (nonatomic, readonly) double memoryHitRate;
+
+/** The fraction of disk cache reads which found a file. */
+@property (nonatomic, readonly) double diskHitRate;
+
+/**
+* Everything in the snapshot as plist types, keyed by name, for logging or
+* sending to an analytics service.
+*/
+- (NSDictionary *)dictionaryRepresentation;
+
+@end
+
+/**
+* Counts and times the work the cache does: hits and misses in each tier,
+* bytes moved, time spent queued, waiting on and downloading from the
+* network, decoding and writing to disk, fetches saved by joining an
+* existing fetch, retries and evictions.
+*
+* Recording is a relaxed atomic add, and never takes a lock. All methods
+* are thread safe.
+*/
+
+@interface SGCacheMetrics : NSObject
+
++ (instancetype)sharedMetrics;
+
+/** Set to NO to stop recording (defaults to YES). */
+@property (atomic, assign) BOOL enabled;
+
+/**
+* Given a snapshot every <reportingInterval> seconds while set. Held weakly.
+*/
+@property (atomic, weak) id <SGCacheMetricsDelegate> delegate;
+
+/** How often the delegate is given a snapshot (defaults to 60 seconds). */
+@property (atomic, assign) NSTimeInterval reportingInterval;
+
+- (SGCacheMetricsSnapshot *)snapshot;
+
+/** Zero all counters and timers. Gauges are left as they are. */
+- (void)reset;
+
+@end
@@ -0,0 +1,355 @@
+//
+//  SGCacheMetrics.m
+//  Pods
+//
+
+#import "SGCacheMetrics.h"
+#import "SGCacheMetricsPrivate.h"
+#import <stdatomic.h>
+#import <mach/mach_time.h>
+
+#define COUNTER_COUNT (SGCacheCounterMemoryEvictions + 1)
+#define GAUGE_COUNT (SGCacheGaugeActiveDownloads + 1)
+#define TIMER_COUNT (SGCacheTimerDiskWrite + 1)
+#define DEFAULT_REPORTING_INTERVAL 60.0
+
+// Durations are kept in microseconds, in log-linear buckets: each power of two
+// is split into 8 equal steps, so a bucket is never wider than an eighth of
+// the values in it. Values under 8µs get a bucket each.
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_EXPONENT 36
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    _Atomic(uint64_t) buckets[HISTOGRAM_BUCKETS];
+    _Atomic(uint64_t) count;
+    _Atomic(uint64_t) sum;
+    _Atomic(uint64_t) max;
+} SGCacheHistogram;
+
+static _Atomic(uint64_t) gCounters[COUNTER_COUNT];
+static _Atomic(int64_t) gGauges[GAUGE_COUNT];
+static SGCacheHistogram gHistograms[TIMER_COUNT];
+static atomic_bool gMetricsEnabled = true;
+
+static NSString *const SGCacheCounterNames[COUNTER_COUNT] = {
+    @"memoryHits", @"memoryMisses", @"diskHits", @"diskMisses", @"networkFetches",
+    @"notModified", @"bytesDownloaded", @"bytesResumed", @"bytesRead", @"bytesWritten",
+    @"dedupeMerges", @"retries", @"diskEvictions", @"memoryEvictions"
+};
+
+static NSString *const SGCacheGaugeNames[GAUGE_COUNT] = {
+    @"queuedTasks", @"activeDownloads"
+};
+
+static NSString *const SGCacheTimerNames[TIMER_COUNT] = {
+    @"queueWait", @"timeToFirstByte", @"download", @"decode", @"diskWrite"
+};
+
+static int SGCacheHistogramBucket(uint64_t micros) {
+    if (micros < HISTOGRAM_SUB_BUCKETS) {
+        return (int)micros;
+    }
+    int exponent = 63 - __builtin_clzll(micros);
+    int sub = (int)((micros >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+    int bucket = (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+    return MIN(bucket, HISTOGRAM_BUCKETS - 1);
+}
+
+// the middle of the bucket's range, in microseconds
+static double SGCacheHistogramBucketValue(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    int sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    double width = (double)(1ull << (exponent - HISTOGRAM_SUB_BITS));
+    return (HISTOGRAM_SUB_BUCKETS + sub) * width + width / 2;
+}
+
+#pragma mark - Recording
+
+NSTimeInterval SGCacheMetricsNow(void) {
+    static mach_timebase_info_data_t timebase;
+    static dispatch_once_t token = 0;
+    dispatch_once(&token, ^{
+        mach_timebase_info(&timebase);
+    });
+    return (double)mach_absolute_time() * timebase.numer / timebase.denom / NSEC_PER_SEC;
+}
+
+void SGCacheMetricsCount(SGCacheCounter counter, unsigned long long amount) {
+    if (counter >= COUNTER_COUNT || !atomic_load_explicit(&gMetricsEnabled, memory_order_relaxed)) {
+        return;
+    }
+    atomic_fetch_add_explicit(&gCounters[counter], amount, memory_order_relaxed);
+}
+
+// gauges track current state, so they're kept up to date even while disabled
+void SGCacheMetricsAdjustGauge(SGCacheGauge gauge, long long delta) {
+    if (gauge >= GAUGE_COUNT) {
+        return;
+    }
+    atomic_fetch_add_explicit(&gGauges[gauge], delta, memory_order_relaxed);
+}
+
+void SGCacheMetricsRecordTime(SGCacheTimer timer, NSTimeInterval seconds) {
+    if (timer >= TIMER_COUNT || seconds < 0
+          || !atomic_load_explicit(&gMetricsEnabled, memory_order_relaxed)) {
+        return;
+    }
+    SGCacheHistogram *histogram = &gHistograms[timer];
+    uint64_t micros = (uint64_t)(seconds * USEC_PER_SEC);
+    atomic_fetch_add_explicit(&histogram->buckets[SGCacheHistogramBucket(micros)], 1,
+          memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, micros, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (micros > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, micros,
+          memory_order_relaxed, memory_order_relaxed));
+}
+
+#pragma mark - Histogram Snapshot
+
+@interface SGCacheHistogramSnapshot ()
+@property (nonatomic, assign) unsigned long long count;
+@property (nonatomic, assign) NSTimeInterval mean;
+@property (nonatomic, assign) NSTimeInterval p50;
+@property (nonatomic, assign) NSTimeInterval p95;
+@property (nonatomic, assign) NSTimeInterval p99;
+@property (nonatomic, assign) NSTimeInterval max;
+@end
+
+@implementation SGCacheHistogramSnapshot
+
++ (instancetype)snapshotOfHistogram:(SGCacheHistogram *)histogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        buckets[i] = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        count += buckets[i];
+    }
+
+    SGCacheHistogramSnapshot *snapshot = self.new;
+    snapshot.count = count;
+    if (!count) {
+        return snapshot;
+    }
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    snapshot.max = (double)max / USEC_PER_SEC;
+    snapshot.mean = (double)atomic_load_explicit(&histogram->sum, memory_order_relaxed)
+          / count / USEC_PER_SEC;
+    snapshot.p50 = [self percentile:0.5 ofBuckets:buckets count:count max:max];
+    snapshot.p95 = [self percentile:0.95 ofBuckets:buckets count:count max:max];
+    snapshot.p99 = [self percentile:0.99 ofBuckets:buckets count:count max:max];
+    return snapshot;
+}
+
++ (NSTimeInterval)percentile:(double)percentile ofBuckets:(uint64_t *)buckets
+      count:(uint64_t)count max:(uint64_t)max {
+    uint64_t target = (uint64_t)ceil(percentile * count), seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return MIN(SGCacheHistogramBucketValue(i), (double)max) / USEC_PER_SEC;
+        }
+    }
+    return (double)max / USEC_PER_SEC;
+}
+
+- (NSDictionary *)dictionaryRepresentation {
+    return @{@"count" : @(self.count), @"mean" : @(self.mean), @"p50" : @(self.p50),
+          @"p95" : @(self.p95), @"p99" : @(self.p99), @"max" : @(self.max)};
+}
+
+@end
+
+#pragma mark - Snapshot
+
+@interface SGCacheMetricsSnapshot ()
+@property (nonatomic, strong) NSDate *date;
+@property (nonatomic, strong) NSArray <SGCacheHistogramSnapshot *> *histograms;
+@end
+
+@implementation SGCacheMetricsSnapshot {
+    unsigned long long _counters[COUNTER_COUNT];
+    long long _gauges[GAUGE_COUNT];
+}
+
+- (id)init {
+    self = [super init];
+    _date = NSDate.date;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        _counters[i] = atomic_load_explicit(&gCounters[i], memory_order_relaxed);
+    }
+    for (int i = 0; i < GAUGE_COUNT; i++) {
+        _gauges[i] = atomic_load_explicit(&gGauges[i], memory_order_relaxed);
+    }
+    NSMutableArray *histograms = NSMutableArray.new;
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        [histograms addObject:[SGCacheHistogramSnapshot snapshotOfHistogram:&gHistograms[i]]];
+    }
+    _histograms = histograms;
+    return self;
+}
+
+- (unsigned long long)valueForCounter:(SGCacheCounter)counter {
+    return counter < COUNTER_COUNT ? _counters[counter] : 0;
+}
+
+- (long long)valueForGauge:(SGCacheGauge)gauge {
+    return gauge < GAUGE_COUNT ? _gauges[gauge] : 0;
+}
+
+- (SGCacheHistogramSnapshot *)histogramForTimer:(SGCacheTimer)timer {
+    return timer < TIMER_COUNT ? self.histograms[timer] : nil;
+}
+
+- (double)memoryHitRate {
+    unsigned long long hits = _counters[SGCacheCounterMemoryHits];
+    unsigned long long lookups = hits + _counters[SGCacheCounterMemoryMisses];
+    return lookups ? (double)hits / lookups : 0;
+}
+
+- (double)diskHitRate {
+    unsigned long long hits = _counters[SGCacheCounterDiskHits];
+    unsigned long long reads = hits + _counters[SGCacheCounterDiskMisses];
+    return reads ? (double)hits / reads : 0;
+}
+
+- (NSDictionary *)dictionaryRepresentation {
+    NSMutableDictionary *counters = NSMutableDictionary.new;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        counters[SGCacheCounterNames[i]] = @(_counters[i]);
+    }
+    NSMutableDictionary *gauges = NSMutableDictionary.new;
+    for (int i = 0; i < GAUGE_COUNT; i++) {
+        gauges[SGCacheGaugeNames[i]] = @(_gauges[i]);
+    }
+    NSMutableDictionary *timers = NSMutableDictionary.new;
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        timers[SGCacheTimerNames[i]] = self.histograms[i].dictionaryRepresentation;
+    }
+    return @{@"date" : @(self.date.timeIntervalSince1970), @"counters" : counters,
+          @"gauges" : gauges, @"timers" : timers, @"memoryHitRate" : @(self.memoryHitRate),
+          @"diskHitRate" : @(self.diskHitRate)};
+}
+
+@end
+
+#pragma mark - Metrics
+
+@implementation SGCacheMetrics {
+    __weak id <SGCacheMetricsDelegate> _delegate;
+    NSTimeInterval _reportingInterval;
+    dispatch_source_t _reportingTimer;
+}
+
++ (instancetype)sharedMetrics {
+    static SGCacheMetrics *singleton;
+    static dispatch_once_t token = 0;
+    dispatch_once(&token, ^{
+        singleton = self.new;
+    });
+    return singleton;
+}
+
+- (id)init {
+    self = [super init];
+    _reportingInterval = DEFAULT_REPORTING_INTERVAL;
+    return self;
+}
+
+- (SGCacheMetricsSnapshot *)snapshot {
+    return SGCacheMetricsSnapshot.new;
+}
+
+- (void)reset {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        atomic_store_explicit(&gCounters[i], 0, memory_order_relaxed);
+    }
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        SGCacheHistogram *histogram = &gHistograms[i];
+        for (int j = 0; j < HISTOGRAM_BUCKETS; j++) {
+            atomic_store_explicit(&histogram->buckets[j], 0, memory_order_relaxed);
+        }
+        atomic_store_explicit(&histogram->count, 0, memory_order_relaxed);
+        atomic_store_explicit(&histogram->sum, 0, memory_order_relaxed);
+        atomic_store_explicit(&histogram->max, 0, memory_order_relaxed);
+    }
+}
+
+#pragma mark - Reporting
+
+- (void)scheduleReporting {
+    @synchronized (self) {
+        if (_reportingTimer) {
+            dispatch_source_cancel(_reportingTimer);
+            _reportingTimer = nil;
+        }
+        if (!_delegate || _reportingInterval <= 0) {
+            return;
+        }
+        uint64_t interval = (uint64_t)(_reportingInterval * NSEC_PER_SEC);
+        _reportingTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0,
+              dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+        dispatch_source_set_timer(_reportingTimer, dispatch_time(DISPATCH_TIME_NOW, interval),
+              interval, interval / 10);
+        __weak SGCacheMetrics *me = self;
+        dispatch_source_set_event_handler(_reportingTimer, ^{
+            [me report];
+        });
+        dispatch_resume(_reportingTimer);
+    }
+}
+
+- (void)report {
+    if (!self.delegate) {
+        return;
+    }
+    SGCacheMetricsSnapshot *snapshot = self.snapshot;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self.delegate cacheMetrics:self didTakeSnapshot:snapshot];
+    });
+}
+
+#pragma mark - Setters
+
+- (void)setDelegate:(id <SGCacheMetricsDelegate>)delegate {
+    @synchronized (self) {
+        _delegate = delegate;
+    }
+    [self scheduleReporting];
+}
+
+- (void)setReportingInterval:(NSTimeInterval)interval {
+    @synchronized (self) {
+        _reportingInterval = interval;
+    }
+    [self scheduleReporting];
+}
+
+- (void)setEnabled:(BOOL)enabled {
+    atomic_store_explicit(&gMetricsEnabled, enabled, memory_order_relaxed);
+}
+
+#pragma mark - Getters
+
+- (id <SGCacheMetricsDelegate>)delegate {
+    @synchronized (self) {
+        return _delegate;
+    }
+}
+
+- (NSTimeInterval)reportingInterval {
+    @synchronized (self) {
+        return _reportingInterval;
+    }
+}
+
+- (BOOL)enabled {
+    return atomic_load_explicit(&gMetricsEnabled, memory_order_relaxed);
+}
+
+@end
@@ -0,0 +1,18 @@
+//
+//  SGCacheMetricsPrivate.h
+//  Pods
+//
+
+#ifndef Pods_SGCacheMetricsPrivate_h
+#define Pods_SGCacheMetricsPrivate_h
+
+#import "SGCacheMetrics.h"
+
+/** A monotonic clock in seconds, for timing with SGCacheMetricsRecordTime. */
+NSTimeInterval SGCacheMetricsNow(void);
+
+void SGCacheMetricsCount(SGCacheCounter counter, unsigned long long amount);
+void SGCacheMetricsAdjustGauge(SGCacheGauge gauge, long long delta);
+void SGCacheMetricsRecordTime(SGCacheTimer timer, NSTimeInterval seconds);
+
+#endif
@@ -0,0 +1,35 @@
+//
+//  SGCachePackStore.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+#import "SGCacheDigest.h"
+
+/**
+* A log structured store for small cache entries.
+*
+* Entries are appended to segment files as they're written, and removals
+* append a tombstone. An in memory offset index, rebuilt by replaying the
+* segments on open, maps each digest to its location so reads are a single
+* `pread`. Each record carries a CRC-32 of its payload, and replay stops at
+* the first record that doesn't match. Segments that are mostly dead space are compacted in the
+* background by copying their live entries forward and deleting the segment.
+* All methods are thread safe.
+*/
+
+@interface SGCachePackStore : NSObject
+
+- (instancetype)initWithPath:(NSString *)path;
+
+- (BOOL)hasDataForDigest:(SGCacheDigest)digest;
+- (NSData *)dataForDigest:(SGCacheDigest)digest;
+- (BOOL)writeData:(NSData *)data forDigest:(SGCacheDigest)digest;
+- (void)removeDataForDigest:(SGCacheDigest)digest;
+
+/**
+* Calls the block with the digest and size of every live entry.
+*/
+- (void)enumerateEntriesUsingBlock:(void (^)(SGCacheDigest digest, unsigned long long size))block;
+
+@end
@@ -0,0 +1,424 @@
+//
+//  SGCachePackStore.m
+//  Pods
+//
+
+#import "SGCachePackStore.h"
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/mman.h>
+#import <zlib.h>
+
+#define PACK_MAGIC 0x4b504753 // "SGPK"
+#define PACK_EXTENSION @"pack"
+#define MAX_SEGMENT_SIZE (4 * 1024 * 1024)
+#define COMPACTION_THRESHOLD 0.5
+#define MIN_MAPPED_ENTRY_SIZE (16 * 1024)
+#define CHECKSUM_CHUNK_SIZE (64 * 1024)
+
+typedef NS_OPTIONS(uint32_t, SGCachePackRecordFlags) {
+    SGCachePackRecordTombstone = 1 << 0
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t flags;
+    SGCacheDigest digest;
+    uint32_t length;
+    uint32_t crc; // CRC-32 of the payload
+} SGCachePackRecordHeader;
+
+#pragma mark - Segments and Entries
+
+@interface SGCachePackSegment : NSObject
+@property (nonatomic, assign) uint32_t number;
+@property (nonatomic, assign) int fd;
+@property (nonatomic, assign) off_t size;
+@property (nonatomic, assign) off_t deadBytes;
+@end
+
+@implementation SGCachePackSegment
+
+// the descriptor outlives the segment file, so reads that started before a
+// compaction can still finish
+- (void)dealloc {
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+@end
+
+@interface SGCachePackEntry : NSObject
+@property (nonatomic, strong) SGCachePackSegment *segment;
+@property (nonatomic, assign) off_t offset;
+@property (nonatomic, assign) uint32_t length;
+@end
+
+@implementation SGCachePackEntry
+@end
+
+#pragma mark - Pack Store
+
+@implementation SGCachePackStore {
+    NSString *_path;
+    NSMutableDictionary *_entries;
+    NSMutableDictionary *_segments;
+    SGCachePackSegment *_activeSegment;
+    NSMutableIndexSet *_compacting;
+    dispatch_queue_t _compactionQueue;
+    BOOL _loaded;
+}
+
+- (instancetype)initWithPath:(NSString *)path {
+    self = [super init];
+    _path = path.copy;
+    _entries = NSMutableDictionary.new;
+    _segments = NSMutableDictionary.new;
+    _compacting = NSMutableIndexSet.new;
+    dispatch_queue_attr_t attr = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL,
+          QOS_CLASS_BACKGROUND, 0);
+    _compactionQueue = dispatch_queue_create("com.seatgeek.sgcache.compaction", attr);
+    [NSFileManager.defaultManager createDirectoryAtPath:path withIntermediateDirectories:YES
+          attributes:nil error:nil];
+    [self loadSegments];
+    return self;
+}
+
+#pragma mark - Public API
+
+- (BOOL)hasDataForDigest:(SGCacheDigest)digest {
+    NSData *key = [self keyForDigest:digest];
+    @synchronized (self) {
+        return _entries[key] != nil;
+    }
+}
+
+- (NSData *)dataForDigest:(SGCacheDigest)digest {
+    NSData *key = [self keyForDigest:digest];
+    SGCachePackEntry *entry;
+    @synchronized (self) {
+        entry = _entries[key];
+    }
+    if (!entry) {
+        return nil;
+    }
+    if (entry.length >= MIN_MAPPED_ENTRY_SIZE) {
+        NSData *data = [self mappedDataForEntry:entry];
+        if (data) {
+            return data;
+        }
+    }
+    NSMutableData *data = [NSMutableData dataWithLength:entry.length];
+    ssize_t got = pread(entry.segment.fd, data.mutableBytes, entry.length, entry.offset);
+    return got == (ssize_t)entry.length ? data : nil;
+}
+
+- (BOOL)writeData:(NSData *)data forDigest:(SGCacheDigest)digest {
+    if (!data || data.length > MAX_SEGMENT_SIZE / 2) {
+        return NO;
+    }
+    NSData *key = [self keyForDigest:digest];
+    @synchronized (self) {
+        SGCachePackEntry *entry = [self appendRecordForDigest:digest flags:0 bytes:data.bytes
+              length:(uint32_t)data.length];
+        if (!entry) {
+            return NO;
+        }
+        [self markDead:_entries[key]];
+        _entries[key] = entry;
+    }
+    return YES;
+}
+
+- (void)removeDataForDigest:(SGCacheDigest)digest {
+    NSData *key = [self keyForDigest:digest];
+    @synchronized (self) {
+        SGCachePackEntry *entry = _entries[key];
+        if (!entry) {
+            return;
+        }
+        SGCachePackEntry *tombstone = [self appendRecordForDigest:digest
+              flags:SGCachePackRecordTombstone bytes:NULL length:0];
+        if (!tombstone) {
+            return;
+        }
+        [_entries removeObjectForKey:key];
+        [self markDead:entry];
+        [self markDead:tombstone];
+    }
+}
+
+- (void)enumerateEntriesUsingBlock:(void (^)(SGCacheDigest, unsigned long long))block {
+    NSDictionary *entries;
+    @synchronized (self) {
+        entries = _entries.copy;
+    }
+    [entries enumerateKeysAndObjectsUsingBlock:^(NSData *key, SGCachePackEntry *entry, BOOL *stop) {
+        SGCacheDigest digest;
+        [key getBytes:digest.bytes length:SGCacheDigestLength];
+        block(digest, entry.length);
+    }];
+}
+
+#pragma mark - Appending
+
+// must be called while synchronized
+- (SGCachePackEntry *)appendRecordForDigest:(SGCacheDigest)digest flags:(uint32_t)flags
+      bytes:(const void *)bytes length:(uint32_t)length {
+    off_t recordLength = sizeof(SGCachePackRecordHeader) + length;
+    if (!_activeSegment || _activeSegment.size + recordLength > MAX_SEGMENT_SIZE) {
+        [self startNewSegment];
+    }
+    SGCachePackSegment *segment = _activeSegment;
+    if (!segment) {
+        return nil;
+    }
+
+    uint32_t crc = length ? (uint32_t)crc32(0, bytes, length) : 0;
+    SGCachePackRecordHeader header = {PACK_MAGIC, flags, digest, length, crc};
+    off_t offset = segment.size;
+    BOOL written = pwrite(segment.fd, &header, sizeof(header), offset) == sizeof(header);
+    if (written && length) {
+        written = pwrite(segment.fd, bytes, length, offset + sizeof(header)) == (ssize_t)length;
+    }
+    if (!written) {
+        ftruncate(segment.fd, offset);
+        return nil;
+    }
+    segment.size += recordLength;
+
+    SGCachePackEntry *entry = SGCachePackEntry.new;
+    entry.segment = segment;
+    entry.offset = offset + sizeof(header);
+    entry.length = length;
+    return entry;
+}
+
+- (void)startNewSegment {
+    uint32_t number = 1;
+    for (NSNumber *existing in _segments) {
+        number = MAX(number, existing.unsignedIntValue + 1);
+    }
+    int fd = open([self pathForSegment:number].fileSystemRepresentation, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        _activeSegment = nil;
+        return;
+    }
+    SGCachePackSegment *segment = SGCachePackSegment.new;
+    segment.number = number;
+    segment.fd = fd;
+    _segments[@(number)] = segment;
+    _activeSegment = segment;
+}
+
+#pragma mark - Loading
+
+- (void)loadSegments {
+    NSArray *files = [NSFileManager.defaultManager contentsOfDirectoryAtPath:_path error:nil];
+    NSMutableArray *numbers = NSMutableArray.new;
+    for (NSString *file in files) {
+        if ([file.pathExtension isEqualToString:PACK_EXTENSION]) {
+            [numbers addObject:@(file.stringByDeletingPathExtension.longLongValue)];
+        }
+    }
+    [numbers sortUsingSelector:@selector(compare:)];
+
+    @synchronized (self) {
+        for (NSNumber *number in numbers) {
+            [self replaySegment:number.unsignedIntValue];
+        }
+
+        // keep appending to the newest segment if it has room
+        SGCachePackSegment *newest = numbers.count ? _segments[numbers.lastObject] : nil;
+        if (newest.size < MAX_SEGMENT_SIZE) {
+            _activeSegment = newest;
+        }
+
+        _loaded = YES;
+        for (SGCachePackSegment *segment in _segments.allValues) {
+            [self compactIfNeeded:segment];
+        }
+    }
+}
+
+- (void)replaySegment:(uint32_t)number {
+    int fd = open([self pathForSegment:number].fileSystemRepresentation, O_RDWR);
+    if (fd < 0) {
+        return;
+    }
+    SGCachePackSegment *segment = SGCachePackSegment.new;
+    segment.number = number;
+    segment.fd = fd;
+    _segments[@(number)] = segment;
+
+    off_t fileSize = lseek(fd, 0, SEEK_END), offset = 0;
+    SGCachePackRecordHeader header;
+    while (offset + (off_t)sizeof(header) <= fileSize) {
+        if (pread(fd, &header, sizeof(header), offset) != sizeof(header)
+              || header.magic != PACK_MAGIC
+              || offset + (off_t)sizeof(header) + header.length > fileSize
+              || ![self payloadAtOffset:offset + sizeof(header) inFile:fd matchesHeader:header]) {
+            break;
+        }
+        NSData *key = [self keyForDigest:header.digest];
+        SGCachePackEntry *entry = SGCachePackEntry.new;
+        entry.segment = segment;
+        entry.offset = offset + sizeof(header);
+        entry.length = header.length;
+        offset += sizeof(header) + header.length;
+        segment.size = offset;
+
+        [self markDead:_entries[key]];
+        if (header.flags & SGCachePackRecordTombstone) {
+            [_entries removeObjectForKey:key];
+            [self markDead:entry];
+        } else {
+            _entries[key] = entry;
+        }
+    }
+
+    // drop a partly written or damaged record, and anything after it, since
+    // nothing past a bad record can be trusted to line up
+    if (offset < fileSize) {
+        ftruncate(fd, offset);
+    }
+}
+
+// reads in chunks, so a large payload isn't held in memory just to check it
+- (BOOL)payloadAtOffset:(off_t)offset inFile:(int)fd
+      matchesHeader:(SGCachePackRecordHeader)header {
+    uLong crc = crc32(0, Z_NULL, 0);
+    uint8_t buffer[CHECKSUM_CHUNK_SIZE];
+    uint32_t remaining = header.length;
+    while (remaining) {
+        uint32_t chunk = MIN(remaining, (uint32_t)CHECKSUM_CHUNK_SIZE);
+        if (pread(fd, buffer, chunk, offset) != (ssize_t)chunk) {
+            return NO;
+        }
+        crc = crc32(crc, buffer, chunk);
+        offset += chunk;
+        remaining -= chunk;
+    }
+    return (uint32_t)crc == header.crc;
+}
+
+#pragma mark - Compaction
+
+// must be called while synchronized
+- (void)markDead:(SGCachePackEntry *)entry {
+    if (!entry) {
+        return;
+    }
+    entry.segment.deadBytes += sizeof(SGCachePackRecordHeader) + entry.length;
+    [self compactIfNeeded:entry.segment];
+}
+
+// must be called while synchronized
+- (void)compactIfNeeded:(SGCachePackSegment *)segment {
+    if (!_loaded || segment == _activeSegment || [_compacting containsIndex:segment.number]
+          || segment.deadBytes < segment.size * COMPACTION_THRESHOLD) {
+        return;
+    }
+    [_compacting addIndex:segment.number];
+    dispatch_async(_compactionQueue, ^{
+        [self compactSegment:segment];
+    });
+}
+
+// copies the segment's live records forward, then deletes it. the segment is
+// no longer appended to, so it can be read without holding the lock
+- (void)compactSegment:(SGCachePackSegment *)segment {
+    off_t offset = 0;
+    SGCachePackRecordHeader header;
+    while (offset < segment.size) {
+        if (pread(segment.fd, &header, sizeof(header), offset) != sizeof(header)) {
+            break;
+        }
+        off_t dataOffset = offset + sizeof(header);
+        offset = dataOffset + header.length;
+        NSData *key = [self keyForDigest:header.digest];
+
+        @synchronized (self) {
+            if (header.flags & SGCachePackRecordTombstone) {
+
+                // keep the tombstone while an older segment might hold the record
+                if (!_entries[key] && [self hasSegmentOlderThan:segment.number]) {
+                    SGCachePackEntry *tombstone = [self appendRecordForDigest:header.digest
+                          flags:SGCachePackRecordTombstone bytes:NULL length:0];
+                    [self markDead:tombstone];
+                }
+                continue;
+            }
+
+            SGCachePackEntry *entry = _entries[key];
+            if (entry.segment != segment || entry.offset != dataOffset) {
+                continue;
+            }
+            NSMutableData *data = [NSMutableData dataWithLength:header.length];
+            if (pread(segment.fd, data.mutableBytes, header.length, dataOffset) != (ssize_t)header.length) {
+                continue;
+            }
+            SGCachePackEntry *moved = [self appendRecordForDigest:header.digest flags:0
+                  bytes:data.bytes length:header.length];
+            if (moved) {
+                _entries[key] = moved;
+            }
+        }
+    }
+
+    @synchronized (self) {
+        for (SGCachePackEntry *entry in _entries.allValues) {
+            if (entry.segment == segment) { // couldn't be moved. try again later
+                [_compacting removeIndex:segment.number];
+                return;
+            }
+        }
+        [_segments removeObjectForKey:@(segment.number)];
+        [_compacting removeIndex:segment.number];
+        unlink([self pathForSegment:segment.number].fileSystemRepresentation);
+    }
+}
+
+- (BOOL)hasSegmentOlderThan:(uint32_t)number {
+    for (NSNumber *existing in _segments) {
+        if (existing.unsignedIntValue < number) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+// maps just the pages holding the entry. smaller entries are cheaper to copy
+- (NSData *)mappedDataForEntry:(SGCachePackEntry *)entry {
+    static off_t pageSize;
+    static dispatch_once_t token = 0;
+    dispatch_once(&token, ^{
+        pageSize = getpagesize();
+    });
+
+    off_t start = entry.offset - entry.offset % pageSize;
+    size_t length = (size_t)(entry.offset - start) + entry.length;
+    void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, entry.segment.fd, start);
+    if (map == MAP_FAILED) {
+        return nil;
+    }
+    uint8_t *bytes = (uint8_t *)map + (entry.offset - start);
+    return [[NSData alloc] initWithBytesNoCopy:bytes length:entry.length
+          deallocator:^(void *unused, NSUInteger unusedLength) {
+        munmap(map, length);
+    }];
+}
+
+#pragma mark - Helpers
+
+- (NSString *)pathForSegment:(uint32_t)number {
+    return [_path stringByAppendingPathComponent:[NSString stringWithFormat:@"%08u.%@", number,
+          PACK_EXTENSION]];
+}
+
+- (NSData *)keyForDigest:(SGCacheDigest)digest {
+    return [NSData dataWithBytes:digest.bytes length:SGCacheDigestLength];
+}
+
+@end
@@ -0,0 +1,49 @@
+//
+//  SGCachePrefetch.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+
+@class SGCachePrefetch;
+
+typedef void(^SGCachePrefetchProgress)(SGCachePrefetch *prefetch);
+
+/**
+* A handle on a batch of prefetches started with
+* [prefetchFilesForURLs:](<+[SGCache prefetchFilesForURLs:]>).
+*
+* Counts are updated as the batch's files arrive, fail, or are found to be
+* already cached. <onProgress> is called on the main thread after each
+* change.
+*/
+
+@interface SGCachePrefetch : NSObject
+
+/** The number of distinct files in the batch. Zero until the batch is queued. */
+@property (nonatomic, readonly) NSUInteger total;
+
+/** Files which are now cached, whether they were fetched or already present. */
+@property (nonatomic, readonly) NSUInteger completed;
+
+/** Files which could not be fetched. */
+@property (nonatomic, readonly) NSUInteger failed;
+
+/** Files which were already cached when the batch was queued. */
+@property (nonatomic, readonly) NSUInteger alreadyCached;
+
+/** The fraction of the batch which has completed or failed, from 0 to 1. */
+@property (nonatomic, readonly) double progress;
+
+@property (nonatomic, readonly, getter=isFinished) BOOL finished;
+@property (nonatomic, readonly, getter=isCancelled) BOOL cancelled;
+
+@property (nonatomic, copy) SGCachePrefetchProgress onProgress;
+
+/**
+* Unsubscribe the batch from its fetches. Fetches nobody else is waiting on
+* are cancelled, including any downloads in progress.
+*/
+- (void)cancel;
+
+@end
@@ -0,0 +1,145 @@
+//
+//  SGCachePrefetch.m
+//  Pods
+//
+
+#import "SGCachePrefetch.h"
+#import "SGCachePrefetchPrivate.h"
+#import "SGCacheTask.h"
+#import "SGCachePrivate.h"
+#import "SGCacheTaskRegistry.h"
+
+@implementation SGCachePrefetch {
+    NSUInteger _total, _completed, _failed, _alreadyCached;
+    BOOL _queued, _cancelled;
+    NSMutableSet *_finishedKeys;
+    NSMutableArray *_subscriptions;
+}
+
+- (id)init {
+    self = [super init];
+    _finishedKeys = NSMutableSet.new;
+    _subscriptions = NSMutableArray.new;
+    return self;
+}
+
+#pragma mark - Batch progress
+
+- (void)setTotal:(NSUInteger)total alreadyCached:(NSUInteger)cached {
+    @synchronized (self) {
+        _total = total;
+        _alreadyCached = cached;
+        _completed += cached;
+        _queued = YES;
+    }
+    [self didChange];
+}
+
+// a subscription made while the batch is being cancelled is ended at once,
+// since cancel has already taken the ones it knows about
+- (void)addSubscription:(SGCacheSubscription *)subscription {
+    @synchronized (self) {
+        if (!_cancelled) {
+            [_subscriptions addObject:subscription];
+            return;
+        }
+    }
+    [self endSubscription:subscription];
+}
+
+- (void)finishedCacheKey:(NSString *)cacheKey succeeded:(BOOL)succeeded {
+    @synchronized (self) {
+        if (!cacheKey || [_finishedKeys containsObject:cacheKey]) {
+            return;
+        }
+        [_finishedKeys addObject:cacheKey];
+        if (succeeded) {
+            _completed++;
+        } else {
+            _failed++;
+        }
+    }
+    [self didChange];
+}
+
+- (void)didChange {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (self.onProgress) {
+            self.onProgress(self);
+        }
+    });
+}
+
+#pragma mark - Cancelling
+
+- (void)cancel {
+    NSArray *subscriptions;
+    @synchronized (self) {
+        if (_cancelled) {
+            return;
+        }
+        _cancelled = YES;
+        subscriptions = _subscriptions.copy;
+        [_subscriptions removeAllObjects];
+    }
+
+    for (SGCacheSubscription *subscription in subscriptions) {
+        [self endSubscription:subscription];
+    }
+}
+
+// a subscription follows its fetch through merges, moves and retries
+- (void)endSubscription:(SGCacheSubscription *)subscription {
+    SGCacheTask *task = subscription.task;
+    Class cacheClass = task.cacheClass;
+    [cacheClass unsubscribeFromTask:[[cacheClass cache].taskRegistry endSubscription:subscription]];
+}
+
+#pragma mark - Getters
+
+- (NSUInteger)total {
+    @synchronized (self) {
+        return _total;
+    }
+}
+
+- (NSUInteger)completed {
+    @synchronized (self) {
+        return _completed;
+    }
+}
+
+- (NSUInteger)failed {
+    @synchronized (self) {
+        return _failed;
+    }
+}
+
+- (NSUInteger)alreadyCached {
+    @synchronized (self) {
+        return _alreadyCached;
+    }
+}
+
+- (double)progress {
+    @synchronized (self) {
+        if (!_total) {
+            return _queued ? 1 : 0;
+        }
+        return (double)(_completed + _failed) / _total;
+    }
+}
+
+- (BOOL)isFinished {
+    @synchronized (self) {
+        return _queued && _completed + _failed >= _total;
+    }
+}
+
+- (BOOL)isCancelled {
+    @synchronized (self) {
+        return _cancelled;
+    }
+}
+
+@end
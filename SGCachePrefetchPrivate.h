@@ -0,0 +1,17 @@
+//
+//  SGCachePrefetchPrivate.h
+//  Pods
+//
+
+#ifndef Pods_SGCachePrefetchPrivate_h
+#define Pods_SGCachePrefetchPrivate_h
+
+@class SGCacheSubscription;
+
+@interface SGCachePrefetch ()
+- (void)setTotal:(NSUInteger)total alreadyCached:(NSUInteger)cached;
+- (void)addSubscription:(SGCacheSubscription *)subscription;
+- (void)finishedCacheKey:(NSString *)cacheKey succeeded:(BOOL)succeeded;
+@end
+
+#endif
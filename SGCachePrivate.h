@@ -9,25 +9,63 @@
 #ifndef Pods_SGCachePrivate_h
 #define Pods_SGCachePrivate_h
 
+#import "SGCacheDigest.h"
+
 void backgroundDo(void(^block)(void));
 
-@class SGCacheTask;
+@class SGCacheTask, SGCacheTaskRegistry, SGCacheIndex, SGCachePackStore, SGCacheEntryMetadata;
 
 @interface SGCache ()
 
 @property (atomic, copy) NSString *folderName;
 @property (atomic, copy) NSString *cachePath;
+@property (nonatomic, strong) SGCacheTaskRegistry *taskRegistry;
+@property (nonatomic, strong) SGCacheIndex *diskIndex;
+@property (atomic, assign) unsigned long long diskCacheLimit;
+@property (nonatomic, strong) dispatch_queue_t evictionQueue;
+@property (atomic, assign) BOOL diskTrimScheduled;
+@property (atomic, assign) BOOL shardingComplete;
+@property (atomic, assign) SGCacheStorage storage;
+@property (nonatomic, strong) SGCachePackStore *packStore;
+@property (atomic, assign) BOOL packStoreChecked;
+@property (atomic, assign) BOOL streamsDownloads;
+@property (atomic, assign) NSTimeInterval unsubscribeGracePeriod;
+@property (atomic, assign) BOOL skipsRefreshWhileFresh;
+@property (nonatomic, strong) NSMutableSet *activeDownloadPaths;
 
 + (SGCache *)cache;
 
 - (NSString *)makeCachePath;
+- (NSOperationQueue *)queueForPriority:(SGCachePriority)priority;
+- (NSString *)pathForDigest:(SGCacheDigest)digest;
 - (NSString *)pathForCacheKey:(NSString *)cacheKey;
 - (NSString *)pathForURL:(NSString *)url requestHeaders:(NSDictionary *)headers;
 - (NSString *)cacheKeyFor:(NSString *)url requestHeaders:(NSDictionary *)headers;
+- (void)scheduleDiskTrim;
+- (NSString *)downloadPath;
+- (NSString *)claimDownloadPathForDigest:(SGCacheDigest)digest;
+- (void)releaseDownloadPath:(NSString *)path;
+- (NSData *)mappedDataAtPath:(NSString *)path;
+- (BOOL)writeData:(NSData *)data forDigest:(SGCacheDigest)digest;
+- (BOOL)moveFileAtPath:(NSString *)from toPath:(NSString *)to;
+- (void)removeFileForDigest:(SGCacheDigest)digest;
+- (BOOL)definitelyLacksDigest:(SGCacheDigest)digest;
+- (BOOL)migrateLegacyFileForCacheKey:(NSString *)cacheKey toDigest:(SGCacheDigest)digest;
+- (NSString *)metadataPathForDigest:(SGCacheDigest)digest;
+
++ (BOOL)haveFileForDigest:(SGCacheDigest)digest;
++ (NSData *)fileForDigest:(SGCacheDigest)digest;
++ (void)addData:(NSData *)data forDigest:(SGCacheDigest)digest;
++ (void)removeDataForDigest:(SGCacheDigest)digest;
++ (NSData *)addFileAtPath:(NSString *)path forDigest:(SGCacheDigest)digest;
++ (SGCacheEntryMetadata *)metadataForDigest:(SGCacheDigest)digest;
++ (void)setMetadata:(SGCacheEntryMetadata *)metadata forDigest:(SGCacheDigest)digest;
 
 + (SGCacheTask *)existingSlowQueueTaskFor:(NSString *)cacheKey;
 + (SGCacheTask *)existingFastQueueTaskFor:(NSString *)cacheKey;
++ (void)addTask:(SGCacheTask *)task toQueue:(NSOperationQueue *)queue;
 + (void)taskFailed:(SGCacheTask *)task;
++ (void)unsubscribeFromTask:(SGCacheTask *)task;
 
 + (SGCacheTask *)taskForPromise:(SGCachePromise *)promise;
 + (void)addRetryForPromise:(SGCachePromise *)promise retryBlock:(SGCacheFetchOnRetry)retry;
@@ -35,4 +73,9 @@ void backgroundDo(void(^block)(void));
 
 @end
 
+@interface SGCachePromise ()
+// a disk read the promise is waiting on, cancelled if it's unsubscribed from
+@property (atomic, weak) NSOperation *pendingLoad;
+@end
+
 #endif
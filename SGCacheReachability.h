@@ -0,0 +1,27 @@
+//
+//  SGCacheReachability.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+* Watches whether the device has a network connection, so fetches that failed
+* for want of one can wait for it to come back instead of using up their
+* retries. All methods are thread safe.
+*/
+
+@interface SGCacheReachability : NSObject
+
++ (instancetype)sharedReachability;
+
+/** NO while the system reports no route to the internet. */
+@property (nonatomic, readonly) BOOL isReachable;
+
+/**
+* Calls `block` on a background queue once the network is reachable, or
+* straight away if it already is.
+*/
+- (void)whenReachableDo:(void(^)(void))block;
+
+@end
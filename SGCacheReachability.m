@@ -0,0 +1,102 @@
+//
+//  SGCacheReachability.m
+//  Pods
+//
+
+#import "SGCacheReachability.h"
+#import <SystemConfiguration/SystemConfiguration.h>
+#import <netinet/in.h>
+
+static BOOL SGCacheFlagsAreReachable(SCNetworkReachabilityFlags flags) {
+    if (!(flags & kSCNetworkReachabilityFlagsReachable)) {
+        return NO;
+    }
+    // a connection that has to be set up by the user isn't there yet
+    return !(flags & kSCNetworkReachabilityFlagsConnectionRequired)
+          || (flags & kSCNetworkReachabilityFlagsConnectionOnDemand
+              && !(flags & kSCNetworkReachabilityFlagsInterventionRequired));
+}
+
+@interface SGCacheReachability ()
+- (void)reachabilityChanged:(SCNetworkReachabilityFlags)flags;
+@end
+
+static void SGCacheReachabilityCallback(SCNetworkReachabilityRef target,
+      SCNetworkReachabilityFlags flags, void *info) {
+    [(__bridge SGCacheReachability *)info reachabilityChanged:flags];
+}
+
+@implementation SGCacheReachability {
+    SCNetworkReachabilityRef _reachability;
+    dispatch_queue_t _queue;
+    NSMutableArray *_waiting;
+    BOOL _reachable;
+}
+
++ (instancetype)sharedReachability {
+    static SGCacheReachability *singleton;
+    static dispatch_once_t token = 0;
+    dispatch_once(&token, ^{
+        singleton = self.new;
+    });
+    return singleton;
+}
+
+- (id)init {
+    self = [super init];
+    _waiting = NSMutableArray.new;
+    _reachable = YES; // until told otherwise
+    _queue = dispatch_queue_create("SGCacheReachability", DISPATCH_QUEUE_SERIAL);
+
+    struct sockaddr_in address = {0};
+    address.sin_len = sizeof(address);
+    address.sin_family = AF_INET;
+    _reachability = SCNetworkReachabilityCreateWithAddress(kCFAllocatorDefault,
+          (const struct sockaddr *)&address);
+    if (_reachability) {
+        SCNetworkReachabilityFlags flags;
+        if (SCNetworkReachabilityGetFlags(_reachability, &flags)) {
+            _reachable = SGCacheFlagsAreReachable(flags);
+        }
+        SCNetworkReachabilityContext context = {0, (__bridge void *)self, NULL, NULL, NULL};
+        SCNetworkReachabilitySetCallback(_reachability, SGCacheReachabilityCallback, &context);
+        SCNetworkReachabilitySetDispatchQueue(_reachability, _queue);
+    }
+    return self;
+}
+
+- (BOOL)isReachable {
+    @synchronized (self) {
+        return _reachable;
+    }
+}
+
+- (void)whenReachableDo:(void(^)(void))block {
+    if (!block) {
+        return;
+    }
+    @synchronized (self) {
+        if (!_reachable) {
+            [_waiting addObject:[block copy]];
+            return;
+        }
+    }
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), block);
+}
+
+- (void)reachabilityChanged:(SCNetworkReachabilityFlags)flags {
+    NSArray *blocks;
+    @synchronized (self) {
+        _reachable = SGCacheFlagsAreReachable(flags);
+        if (!_reachable) {
+            return;
+        }
+        blocks = _waiting.copy;
+        [_waiting removeAllObjects];
+    }
+    for (void (^block)(void) in blocks) {
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), block);
+    }
+}
+
+@end
@@ -4,15 +4,18 @@
 
 #import "SGCache.h"
 #import "SGCachePromise.h"
+#import "SGCacheDigest.h"
 
 @interface SGCacheTask : NSOperation
 
 @property (nonatomic, copy) NSString *url;
 @property (nonatomic, copy) NSDictionary *requestHeaders;
 @property (nonatomic, copy) NSString *cacheKey;
+@property (nonatomic, readonly) SGCacheDigest digest;
 @property (nonatomic, assign) BOOL succeeded;
 @property (nonatomic, assign) int attempt;
 @property (nonatomic, assign) BOOL remoteFetchOnly;
+@property (nonatomic, assign) SGCachePriority priority;
 @property (nonatomic, weak) SGCachePromise *promise;
 @property (nonatomic, assign) Class cacheClass;
 
@@ -31,6 +34,11 @@
 - (void)addRetryBlock:(SGCacheFetchOnRetry)retry;
 - (void)addRetryBlocks:(NSMutableOrderedSet *)retries;
 
+- (NSUInteger)subscriberCount;
+- (void)addSubscribers:(NSUInteger)count;
+- (NSUInteger)removeSubscriber;
+- (void)cancelIfUnsubscribed;
+
 - (BOOL)matchesCacheKey:(NSString *)cacheKey;
 
 @end
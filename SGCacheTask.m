@@ -6,18 +6,46 @@
 #import "SGHTTPRequest.h"
 #import "SGCachePrivate.h"
 #import "SGCachePromise.h"
+#import "SGCacheTaskPrivate.h"
+#import "SGCacheTaskRegistry.h"
+#import "SGCacheDownload.h"
+#import "SGCacheCircuitBreaker.h"
+#import "SGCacheHostLimiter.h"
+#import "SGCacheReachability.h"
+#import "SGCacheEntryMetadata.h"
+#import "SGCacheMetricsPrivate.h"
+#import "SGCacheDelivery.h"
 
 @interface SGCacheTask ()
 @property (nonatomic, strong) SGHTTPRequest *request;
+@property (nonatomic, strong) SGCacheDownload *download;
 @property (nonatomic, strong) NSError *currentErrorStatus;
 @property (nonatomic, assign) BOOL currentErrorRetry;
+@property (atomic, copy) NSString *slotHost;
+@property (atomic, strong) id hostWaiter;
+@property (nonatomic, assign) NSTimeInterval fetchStarted;
 @end
 
+float SGCacheTransferPriority(SGCachePriority priority) {
+    switch (priority) {
+        case SGCachePriorityPrefetch:
+            return 0.1;
+        case SGCachePriorityLow:
+            return NSURLSessionTaskPriorityLow;
+        case SGCachePriorityNormal:
+            return NSURLSessionTaskPriorityDefault;
+        case SGCachePriorityHigh:
+            return NSURLSessionTaskPriorityHigh;
+    }
+    return NSURLSessionTaskPriorityDefault;
+}
+
 @implementation SGCacheTask {
     BOOL _isExecuting, _isFinished;
     NSMutableOrderedSet *_completions;
     NSMutableOrderedSet *_failBlocks;
     NSMutableOrderedSet *_retryBlocks;
+    NSUInteger _subscriberCount;
 }
 
 - (id)init {
@@ -26,6 +54,7 @@
     _failBlocks = NSMutableOrderedSet.new;
     _retryBlocks = NSMutableOrderedSet.new;
     _cacheClass = SGCache.class;
+    _priority = SGCachePriorityNormal;
     return self;
 }
 
@@ -89,25 +118,114 @@
 
 - (void)start {
     self.executing = YES;
+    if (self.queuedTime) {
+        SGCacheMetricsAdjustGauge(SGCacheGaugeQueuedTasks, -1);
+        SGCacheMetricsRecordTime(SGCacheTimerQueueWait, SGCacheMetricsNow() - self.queuedTime);
+    }
     if (self.isCancelled) {
         [self finish];
         return;
     }
-    if (!self.remoteFetchOnly && [self.cacheClass haveFileForURL:self.url]) {
-        [self completedWithFile:[self.cacheClass fileForURL:self.url]];
-    } else {
+    if (self.remoteFetchOnly) {
+        [self refreshRemoteFile];
+        return;
+    }
+    // disk hits are only read. nothing is written until a fetch brings new data
+    if (![self completedWithCachedFile]) {
         [self fetchRemoteFile];
     }
 }
 
+// a cached file with validators is revalidated instead of fetched in full, and
+// while fresh isn't fetched at all if the cache is set to skip fresh refreshes
+- (void)refreshRemoteFile {
+    SGCacheEntryMetadata *metadata = [self.cacheClass metadataForDigest:self.digest];
+    if (metadata.isFresh && [self.cacheClass cache].skipsRefreshWhileFresh
+          && [self completedWithCachedFile]) {
+        return;
+    }
+    if (metadata.canRevalidate && [self.cacheClass haveFileForDigest:self.digest]) {
+        self.validators = metadata;
+    }
+    [self fetchRemoteFile];
+}
+
+- (NSDictionary *)remoteRequestHeaders {
+    if (!self.validators) {
+        return self.requestHeaders;
+    }
+    NSMutableDictionary *headers = self.validators.conditionalRequestHeaders.mutableCopy;
+    [headers addEntriesFromDictionary:self.requestHeaders];
+    return headers;
+}
+
 - (void)fetchRemoteFile {
+    // don't add to the load on a host that keeps failing
+    NSString *host = [NSURL URLWithString:self.url].host;
+    if (![SGCacheCircuitBreaker.sharedBreaker allowRequestToHost:host]) {
+        NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotConnectToHost
+              userInfo:@{NSLocalizedDescriptionKey : @"Host is failing, request skipped"}];
+        [self failedWithError:error allowRetry:YES];
+        [self finish];
+        return;
+    }
+
+    // wait here for a slot on the host, rather than queueing in the network stack
+    id waiter = [SGCacheHostLimiter.sharedLimiter acquireSlotForHost:host priority:self.priority
+          thenDo:^{
+        [self startRemoteFetchForHost:host];
+    }];
+    if (waiter) {
+        self.hostWaiter = waiter;
+        // catch a priority change made before the waiter was known
+        [SGCacheHostLimiter.sharedLimiter updatePriority:self.priority forWaiter:waiter];
+    }
+}
+
+- (void)startRemoteFetchForHost:(NSString *)host {
+    @synchronized (self) {
+        self.slotHost = host;
+    }
+    self.hostWaiter = nil;
+    if (host) {
+        SGCacheMetricsAdjustGauge(SGCacheGaugeActiveDownloads, 1);
+    }
+    if (self.isCancelled || self.isFinished) {
+        [self releaseHostSlot];
+        return;
+    }
+    SGCacheMetricsCount(SGCacheCounterNetworkFetches, 1);
+    self.fetchStarted = SGCacheMetricsNow();
+
+    if ([self.cacheClass cache].streamsDownloads) {
+        [self streamRemoteFile];
+    } else {
+        [self requestRemoteFile];
+    }
+}
+
+- (void)releaseHostSlot {
+    NSString *host;
+    @synchronized (self) {
+        host = self.slotHost;
+        self.slotHost = nil;
+    }
+    if (host) {
+        SGCacheMetricsAdjustGauge(SGCacheGaugeActiveDownloads, -1);
+    }
+    [SGCacheHostLimiter.sharedLimiter releaseSlotForHost:host];
+}
+
+- (void)requestRemoteFile {
+    NSString *host = [NSURL URLWithString:self.url].host;
     self.currentErrorStatus = nil;
     self.request = [SGHTTPRequest requestWithURL:[NSURL URLWithString:self.url]];
     self.request.responseFormat = SGHTTPDataTypeHTTP;
     self.request.allowCacheToDisk = NO;
 
-    if (self.requestHeaders) {
-        self.request.requestHeaders = self.requestHeaders;
+    NSDictionary *headers = self.remoteRequestHeaders;
+    if (headers) {
+        self.request.requestHeaders = headers;
     }
 
     self.request.logging = SGHTTPLogNothing;
@@ -123,9 +241,19 @@
 
     __weakSelf me = self;
     self.request.onSuccess = ^(SGHTTPRequest *req) {
+        SGCacheMetricsRecordTime(SGCacheTimerDownload, SGCacheMetricsNow() - me.fetchStarted);
+        SGCacheMetricsCount(SGCacheCounterBytesDownloaded, req.responseData.length);
+        [me releaseHostSlot];
+        [SGCacheCircuitBreaker.sharedBreaker recordSuccessForHost:host];
         me.currentErrorStatus = nil;
         dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-            [me completedWithFile:req.responseData];
+            if (req.statusCode == 304) {
+                [me completedNotModifiedWithHeaders:req.responseHeaders];
+                return;
+            }
+            [me.cacheClass setMetadata:[SGCacheEntryMetadata
+                  metadataWithResponseHeaders:req.responseHeaders] forDigest:me.digest];
+            [me completedWithFetchedData:req.responseData];
         });
     };
     self.request.onNetworkReachable = ^{
@@ -133,8 +261,17 @@
         [me fetchRemoteFile];
     };
     self.request.onFailure = ^(SGHTTPRequest *req) {
-        me.currentErrorStatus = req.error;
         NSInteger code = req.statusCode;
+        [me releaseHostSlot];
+        if (code == 304) { // not an error, the cached file is still good
+            [SGCacheCircuitBreaker.sharedBreaker recordSuccessForHost:host];
+            dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                [me completedNotModifiedWithHeaders:req.responseHeaders];
+            });
+            return;
+        }
+        me.currentErrorStatus = req.error;
+        [me recordHealthOfHost:host statusCode:code error:req.error];
         if (code >= 400 && code < 408) { // give up on 4XX http errors
             me.currentErrorRetry = NO;
             [me failedWithError:req.error allowRetry:NO];
@@ -146,15 +283,161 @@
     [self.request start];
 }
 
-- (void)completedWithFile:(NSData *)data {
-    [self.cacheClass addData:data forCacheKey:self.cacheKey];
+// writes the response body straight to disk, then moves it into the cache
+- (void)streamRemoteFile {
+    SGCache *cache = [self.cacheClass cache];
+    NSString *claimed = [cache claimDownloadPathForDigest:self.digest];
+    self.download = [SGCacheDownload downloadWithURL:[NSURL URLWithString:self.url]
+          toPath:claimed ?: cache.downloadPath];
+    self.download.requestHeaders = self.remoteRequestHeaders;
+    self.download.priority = SGCacheTransferPriority(self.priority);
+    self.download.resumable = !!claimed;
+
+    __weakSelf me = self;
+    NSString *host = self.download.url.host;
+    self.download.onSuccess = ^(SGCacheDownload *download) {
+        if (download.timeToFirstByte) {
+            SGCacheMetricsRecordTime(SGCacheTimerTimeToFirstByte, download.timeToFirstByte);
+        }
+        SGCacheMetricsRecordTime(SGCacheTimerDownload, download.duration);
+        SGCacheMetricsCount(SGCacheCounterBytesDownloaded, download.bytesReceived);
+        SGCacheMetricsCount(SGCacheCounterBytesResumed, download.bytesResumed);
+        [SGCacheHostLimiter.sharedLimiter recordTimeToFirstByte:download.timeToFirstByte
+              bytes:download.bytesReceived duration:download.duration forHost:host];
+        [me releaseHostSlot];
+        [SGCacheCircuitBreaker.sharedBreaker recordSuccessForHost:host];
+        if (download.statusCode == 304) {
+            [cache releaseDownloadPath:claimed];
+            [me completedNotModifiedWithHeaders:download.response.allHeaderFields];
+            return;
+        }
+        if (![me validateData:[cache mappedDataAtPath:download.path]]) {
+            unlink(download.path.fileSystemRepresentation);
+            [cache releaseDownloadPath:claimed];
+            [me failedWithError:me.invalidDataError allowRetry:YES];
+            [me finish];
+            return;
+        }
+        NSData *data = [me.cacheClass addFileAtPath:download.path forDigest:me.digest];
+        [cache releaseDownloadPath:claimed];
+        if (!data) {
+            [me failedWithError:nil allowRetry:YES];
+            [me finish];
+            return;
+        }
+        [me.cacheClass setMetadata:[SGCacheEntryMetadata
+              metadataWithResponseHeaders:download.response.allHeaderFields] forDigest:me.digest];
+        [me completedWithFile:data];
+    };
+    self.download.onFailure = ^(SGCacheDownload *download) {
+        [cache releaseDownloadPath:claimed]; // what arrived is kept for the next attempt
+        [me releaseHostSlot];
+        if (me.isCancelled) {
+            return;
+        }
+        NSInteger code = download.statusCode;
+
+        // offline. wait for the network instead of using up retries, as
+        // requests without streaming do
+        if (!code && !SGCacheReachability.sharedReachability.isReachable) {
+            [me failedWithError:download.error allowRetry:YES];
+            [SGCacheReachability.sharedReachability whenReachableDo:^{
+                if (me.isCancelled || me.isFinished) {
+                    return;
+                }
+                [me willRetry];
+                [me fetchRemoteFile];
+            }];
+            return;
+        }
 
+        [me recordHealthOfHost:host statusCode:code error:download.error];
+        BOOL fatal = code >= 400 && code < 408; // give up on 4XX http errors
+        [me failedWithError:download.error allowRetry:!fatal];
+        if (!fatal) { // the retry is queued when the task finishes unsucceeded
+            [me finish];
+        }
+    };
+    [self.download start];
+}
+
+// server errors, timeouts and refused connections count against the host. client
+// errors, and failures on our side like being offline, say nothing about it
+- (void)recordHealthOfHost:(NSString *)host statusCode:(NSInteger)code error:(NSError *)error {
+    BOOL unreachable = !code && [error.domain isEqualToString:NSURLErrorDomain]
+          && (error.code == NSURLErrorTimedOut || error.code == NSURLErrorCannotConnectToHost);
+    if (code >= 500 || unreachable) {
+        [SGCacheCircuitBreaker.sharedBreaker recordFailureForHost:host];
+        [SGCacheHostLimiter.sharedLimiter recordFailureForHost:host];
+    } else if (code) {
+        [SGCacheCircuitBreaker.sharedBreaker recordSuccessForHost:host];
+    }
+}
+
+// the server says the cached file hasn't changed, so it's used as is
+- (void)completedNotModifiedWithHeaders:(NSDictionary *)headers {
+    SGCacheMetricsCount(SGCacheCounterNotModified, 1);
+    if (SGCache.logging & SGImageCacheLogResponses) {
+        NSLog(@"NOT MODIFIED %@", self.url);
+    }
+    SGCacheEntryMetadata *metadata = [self.validators
+          metadataRevalidatedWithResponseHeaders:headers];
+    [self.cacheClass setMetadata:metadata forDigest:self.digest];
+    if ([self completedWithCachedFile]) {
+        return;
+    }
+
+    // evicted while revalidating. the retry fetches it in full
+    [self.cacheClass setMetadata:nil forDigest:self.digest];
+    [self failedWithError:nil allowRetry:YES];
+    [self finish];
+}
+
+// completes with the file already in the cache, without writing it again.
+// reading it records the access for eviction. returns NO if the file is gone
+- (BOOL)completedWithCachedFile {
+    NSData *data = [self.cacheClass fileForDigest:self.digest];
+    if (!data && [[self.cacheClass cache] migrateLegacyFileForCacheKey:self.cacheKey
+          toDigest:self.digest]) {
+        data = [self.cacheClass fileForDigest:self.digest];
+    }
+    if (!data) {
+        return NO;
+    }
+    [self completedWithFile:data];
+    return YES;
+}
+
+// completes with data fetched into memory, which is stored first
+- (void)completedWithFetchedData:(NSData *)data {
+    if (![self validateData:data]) {
+        [self failedWithError:self.invalidDataError allowRetry:YES];
+        [self finish];
+        return;
+    }
+    [self.cacheClass addData:data forDigest:self.digest];
+    [self completedWithFile:data];
+}
+
+// checked before a fetched body is stored, so that something like an error
+// page served with a 200 never ends up cached under the key
+- (BOOL)validateData:(NSData *)data {
+    return !!data;
+}
+
+- (NSError *)invalidDataError {
+    return [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotDecodeContentData
+          userInfo:@{NSLocalizedDescriptionKey : @"Response body isn't valid for this cache"}];
+}
+
+// hands over a file that's already stored
+- (void)completedWithFile:(NSData *)data {
     // call the completion blocks on the main thread
-    dispatch_async(dispatch_get_main_queue(), ^{
+    [SGCacheDelivery.sharedDelivery deliver:^{
         for (SGCacheFetchCompletion completion in self.completions) {
             completion(data);
         }
-    });
+    }];
 
     self.succeeded = YES;
     [self finish];
@@ -162,13 +445,14 @@
 
 - (void)failedWithError:(NSError *)error allowRetry:(BOOL)allowRetry {
     self.succeeded = NO;
+    self.failedFatally = !allowRetry;
 
     // call the completion blocks on the main thread
-    dispatch_async(dispatch_get_main_queue(), ^{
+    [SGCacheDelivery.sharedDelivery deliver:^{
         for (SGCacheFetchFail failBlock in self.onFailBlocks) {
             failBlock(error, !allowRetry);
         }
-    });
+    }];
 
     if (!allowRetry) {
         [self finish];
@@ -176,24 +460,71 @@
 }
 
 - (void)willRetry {
-    dispatch_async(dispatch_get_main_queue(), ^{
+    [SGCacheDelivery.sharedDelivery deliver:^{
         for (SGCacheFetchOnRetry retryBlock in self.onRetryBlocks) {
             retryBlock();
         }
-    });
+    }];
 }
 
 - (void)finish {
+    [self releaseHostSlot];
+    [[self.cacheClass cache].taskRegistry removeTask:self];
     self.executing = NO;
     self.finished = YES;
 }
 
+// marked cancelled before finishing, so the completion block and the failure
+// handlers all see it and nothing is retried
 - (void)cancel {
+    [[self.cacheClass cache].taskRegistry removeTask:self];
+    [super cancel];
+
+    // a waiter that's already started finds the task cancelled and gives its slot back
+    [SGCacheHostLimiter.sharedLimiter removeWaiter:self.hostWaiter];
+    self.hostWaiter = nil;
     if (self.isExecuting) {
         [self.request cancel];
+        [self.download cancel];
         [self finish];
     }
-    [super cancel];
+}
+
+#pragma mark - Subscribers
+
+- (void)addSubscribers:(NSUInteger)count {
+    @synchronized (self) {
+        _subscriberCount += count;
+    }
+}
+
+// returns the number of subscribers left
+- (NSUInteger)removeSubscriber {
+    @synchronized (self) {
+        if (_subscriberCount) {
+            _subscriberCount--;
+        }
+        return _subscriberCount;
+    }
+}
+
+// called through the registry's cancelTaskIfUnsubscribed:, which holds its lock
+- (void)cancelIfUnsubscribed {
+    @synchronized (self) {
+        if (_subscriberCount || self.isFinished || self.isCancelled) {
+            return;
+        }
+        if (SGCache.logging & SGImageCacheLogRequests) {
+            NSLog(@"Cancelling unwanted fetch: %@", self.url);
+        }
+        [self cancel];
+    }
+}
+
+- (NSUInteger)subscriberCount {
+    @synchronized (self) {
+        return _subscriberCount;
+    }
 }
 
 #pragma mark - Equivalence
@@ -204,6 +535,33 @@
 
 #pragma mark - Setters
 
+- (void)setPriority:(SGCachePriority)priority {
+    _priority = priority;
+    switch (priority) {
+        case SGCachePriorityPrefetch:
+            self.queuePriority = NSOperationQueuePriorityVeryLow;
+            break;
+        case SGCachePriorityLow:
+            self.queuePriority = NSOperationQueuePriorityLow;
+            break;
+        case SGCachePriorityNormal:
+            self.queuePriority = NSOperationQueuePriorityNormal;
+            break;
+        case SGCachePriorityHigh:
+            self.queuePriority = NSOperationQueuePriorityVeryHigh;
+            break;
+    }
+    self.download.priority = SGCacheTransferPriority(priority);
+
+    // still waiting for a host slot? then wait in the right place
+    [SGCacheHostLimiter.sharedLimiter updatePriority:priority forWaiter:self.hostWaiter];
+}
+
+- (void)setCacheKey:(NSString *)cacheKey {
+    _cacheKey = [cacheKey copy];
+    _digest = SGCacheDigestMake(_cacheKey);
+}
+
 - (void)setExecuting:(BOOL)executing {
     [self willChangeValueForKey:@"isExecuting"];
     _isExecuting = executing;
@@ -217,6 +575,11 @@
 }
 
 - (void)setPromise:(SGCachePromise *)promise {
+    // unsubscribed before the task was made, so give back its subscriber
+    if (![[self.cacheClass cache].taskRegistry setTask:self forPromise:promise]) {
+        [self.cacheClass unsubscribeFromTask:self];
+        return;
+    }
     _promise = promise;
     if (promise.onRetry) {
         [self addRetryBlock:promise.onRetry];
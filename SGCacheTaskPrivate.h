@@ -5,8 +5,22 @@
 #ifndef Pods_SGCacheTaskPrivate_h
 #define Pods_SGCacheTaskPrivate_h
 
+@class SGCacheEntryMetadata;
+
 @interface SGCacheTask ()
+@property (atomic, weak) NSOperationQueue *registeredQueue;
+@property (nonatomic, assign) BOOL failedFatally;
+@property (nonatomic, strong) SGCacheEntryMetadata *validators;
+@property (atomic, assign) NSTimeInterval queuedTime;
+- (BOOL)completedWithCachedFile;
+- (void)completedWithFetchedData:(NSData *)data;
+- (void)completedWithFile:(NSData *)data;
+- (BOOL)validateData:(NSData *)data;
+- (NSError *)invalidDataError;
+- (void)failedWithError:(NSError *)error allowRetry:(BOOL)allowRetry;
 - (void)finish;
 @end
 
+float SGCacheTransferPriority(SGCachePriority priority);
+
 #endif
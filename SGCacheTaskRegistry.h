@@ -0,0 +1,85 @@
+//
+//  SGCacheTaskRegistry.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+#import "SGCache.h"
+#import "SGCacheDigest.h"
+
+@class SGCacheTask, SGCachePromise;
+
+/**
+* One subscriber's (a promise's, or one fetch of a prefetch batch) hold on a
+* task. When a task is replaced by another, whether merged, moved to another
+* queue or retried, its subscriptions are moved to the replacement, so every
+* subscriber can still find the task that's doing its fetch.
+*/
+@interface SGCacheSubscription : NSObject
+@property (atomic, weak, readonly) SGCacheTask *task;
+@end
+
+/**
+* Tracks in-flight cache tasks by cache key and by promise, so that finding a
+* task to merge with or promote doesn't require scanning queue operations.
+*
+* Tasks are added when enqueued and removed when they finish or are cancelled.
+* While a task is registered its digest is pinned, so eviction leaves its
+* cache file alone. All methods are thread safe.
+*/
+
+@interface SGCacheTaskRegistry : NSObject
+
+- (void)addTask:(SGCacheTask *)task forQueue:(NSOperationQueue *)queue;
+- (void)removeTask:(SGCacheTask *)task;
+
+- (SGCacheTask *)taskForCacheKey:(NSString *)cacheKey inQueue:(NSOperationQueue *)queue;
+
+- (SGCacheSubscription *)subscribeToTask:(SGCacheTask *)task;
+
+/**
+* Ends a subscription, returning the task it was on by then, or nil if it had
+* already ended.
+*/
+- (SGCacheTask *)endSubscription:(SGCacheSubscription *)subscription;
+
+/**
+* Moves every subscription on `task` to `replacement`.
+*/
+- (void)moveSubscriptionsFromTask:(SGCacheTask *)task toTask:(SGCacheTask *)replacement;
+
+/**
+* Joins a new fetch to `task`, taking over `other` (if any) as well: its
+* completion, fail and retry blocks, subscribers and subscriptions move to
+* `task`, and `other` is unregistered and cancelled. `task` gains a subscriber
+* for the new fetch, and is raised to `priority` if it's below it. Done under
+* the registry's lock, so the merge can't interleave with an unsubscribe.
+*/
+- (void)mergeTask:(SGCacheTask *)other intoTask:(SGCacheTask *)task
+      priority:(SGCachePriority)priority;
+
+/**
+* Cancels the task if nothing is subscribed to it any more, checked under the
+* registry's lock so a merge can't add a subscriber between the check and the
+* cancel.
+*/
+- (void)cancelTaskIfUnsubscribed:(SGCacheTask *)task;
+
+/**
+* Subscribes the promise to the task, ending any subscription it had. Returns
+* NO, without subscribing, if the promise has already been unsubscribed.
+*/
+- (BOOL)setTask:(SGCacheTask *)task forPromise:(SGCachePromise *)promise;
+- (SGCacheTask *)taskForPromise:(SGCachePromise *)promise;
+
+/**
+* Ends the promise's subscription, returning the task it was on. The promise
+* is remembered as unsubscribed, so that a task made for it afterwards, eg.
+* once a disk read misses, isn't subscribed to.
+*/
+- (SGCacheTask *)endSubscriptionForPromise:(SGCachePromise *)promise;
+- (BOOL)isPromiseUnsubscribed:(SGCachePromise *)promise;
+
+- (BOOL)isDigestPinned:(SGCacheDigest)digest;
+
+@end
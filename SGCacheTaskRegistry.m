@@ -0,0 +1,259 @@
+//
+//  SGCacheTaskRegistry.m
+//  Pods
+//
+
+#import "SGCacheTaskRegistry.h"
+#import "SGCacheTask.h"
+#import "SGCacheTaskPrivate.h"
+
+@interface SGCacheSubscription ()
+@property (atomic, weak, readwrite) SGCacheTask *task;
+@end
+
+@implementation SGCacheSubscription
+@end
+
+@implementation SGCacheTaskRegistry {
+    NSMapTable *_queueTasks;
+    NSMapTable *_taskSubscriptions;
+    NSMapTable *_promiseSubscriptions;
+    NSHashTable *_unsubscribedPromises;
+    NSCountedSet *_pinnedDigests;
+}
+
+- (id)init {
+    self = [super init];
+    NSPointerFunctionsOptions pointerKeys = NSPointerFunctionsObjectPointerPersonality;
+    _queueTasks = [NSMapTable mapTableWithKeyOptions:pointerKeys
+          valueOptions:NSPointerFunctionsStrongMemory];
+    _taskSubscriptions = [NSMapTable mapTableWithKeyOptions:pointerKeys | NSPointerFunctionsWeakMemory
+          valueOptions:NSPointerFunctionsStrongMemory];
+    _promiseSubscriptions = [NSMapTable mapTableWithKeyOptions:pointerKeys | NSPointerFunctionsWeakMemory
+          valueOptions:NSPointerFunctionsStrongMemory];
+    _unsubscribedPromises = [NSHashTable hashTableWithOptions:pointerKeys
+          | NSPointerFunctionsWeakMemory];
+    _pinnedDigests = NSCountedSet.new;
+    return self;
+}
+
+#pragma mark - Tasks by cache key
+
+- (void)addTask:(SGCacheTask *)task forQueue:(NSOperationQueue *)queue {
+    if (!task || !queue) {
+        return;
+    }
+    @synchronized (self) {
+        [self removeTaskLocked:task];
+        task.registeredQueue = queue;
+        if (!task.cacheKey) {
+            return;
+        }
+        [_pinnedDigests addObject:[self keyForDigest:task.digest]];
+        NSMutableDictionary *tasks = [_queueTasks objectForKey:queue];
+        if (!tasks) {
+            tasks = NSMutableDictionary.new;
+            [_queueTasks setObject:tasks forKey:queue];
+        }
+        tasks[task.cacheKey] = task;
+    }
+}
+
+- (void)removeTask:(SGCacheTask *)task {
+    if (!task) {
+        return;
+    }
+    @synchronized (self) {
+        [self removeTaskLocked:task];
+    }
+}
+
+- (void)removeTaskLocked:(SGCacheTask *)task {
+    NSOperationQueue *queue = task.registeredQueue;
+    if (!queue) {
+        return;
+    }
+    task.registeredQueue = nil;
+    if (!task.cacheKey) {
+        return;
+    }
+    [_pinnedDigests removeObject:[self keyForDigest:task.digest]];
+    NSMutableDictionary *tasks = [_queueTasks objectForKey:queue];
+
+    // only remove the entry if a newer task hasn't since taken the key
+    if (tasks[task.cacheKey] == task) {
+        [tasks removeObjectForKey:task.cacheKey];
+    }
+}
+
+- (SGCacheTask *)taskForCacheKey:(NSString *)cacheKey inQueue:(NSOperationQueue *)queue {
+    if (!cacheKey || !queue) {
+        return nil;
+    }
+    @synchronized (self) {
+        return [_queueTasks objectForKey:queue][cacheKey];
+    }
+}
+
+#pragma mark - Pinning
+
+- (BOOL)isDigestPinned:(SGCacheDigest)digest {
+    @synchronized (self) {
+        return [_pinnedDigests countForObject:[self keyForDigest:digest]] > 0;
+    }
+}
+
+- (NSData *)keyForDigest:(SGCacheDigest)digest {
+    return [NSData dataWithBytes:digest.bytes length:SGCacheDigestLength];
+}
+
+#pragma mark - Subscriptions
+
+// a task's subscriptions outlive its registration, since a retry is made
+// after the failed task has finished
+- (SGCacheSubscription *)subscribeToTask:(SGCacheTask *)task {
+    @synchronized (self) {
+        return [self subscribeLockedToTask:task];
+    }
+}
+
+- (SGCacheSubscription *)subscribeLockedToTask:(SGCacheTask *)task {
+    SGCacheSubscription *subscription = SGCacheSubscription.new;
+    if (task) {
+        subscription.task = task;
+        [[self subscriptionsLockedForTask:task] addObject:subscription];
+    }
+    return subscription;
+}
+
+- (SGCacheTask *)endSubscription:(SGCacheSubscription *)subscription {
+    @synchronized (self) {
+        return [self endSubscriptionLocked:subscription];
+    }
+}
+
+- (SGCacheTask *)endSubscriptionLocked:(SGCacheSubscription *)subscription {
+    SGCacheTask *task = subscription.task;
+    if (!task) {
+        return nil;
+    }
+    subscription.task = nil;
+    [[_taskSubscriptions objectForKey:task] removeObject:subscription];
+    return task;
+}
+
+- (void)moveSubscriptionsFromTask:(SGCacheTask *)task toTask:(SGCacheTask *)replacement {
+    if (!task || !replacement || task == replacement) {
+        return;
+    }
+    @synchronized (self) {
+        [self moveSubscriptionsLockedFromTask:task toTask:replacement];
+    }
+}
+
+- (void)moveSubscriptionsLockedFromTask:(SGCacheTask *)task toTask:(SGCacheTask *)replacement {
+    NSMutableArray *subscriptions = [_taskSubscriptions objectForKey:task];
+    if (!subscriptions.count) {
+        return;
+    }
+    for (SGCacheSubscription *subscription in subscriptions) {
+        subscription.task = replacement;
+    }
+    [[self subscriptionsLockedForTask:replacement] addObjectsFromArray:subscriptions];
+    [_taskSubscriptions removeObjectForKey:task];
+}
+
+- (NSMutableArray *)subscriptionsLockedForTask:(SGCacheTask *)task {
+    NSMutableArray *subscriptions = [_taskSubscriptions objectForKey:task];
+    if (!subscriptions) {
+        subscriptions = NSMutableArray.new;
+        [_taskSubscriptions setObject:subscriptions forKey:task];
+    }
+    return subscriptions;
+}
+
+#pragma mark - Merging
+
+// the task lock is only ever taken inside the registry lock, never around it
+- (void)mergeTask:(SGCacheTask *)other intoTask:(SGCacheTask *)task
+      priority:(SGCachePriority)priority {
+    if (!task || task == other) {
+        return;
+    }
+    @synchronized (self) {
+        [task addCompletions:other.completions];
+        [task addFailBlocks:other.onFailBlocks];
+        [task addRetryBlocks:other.onRetryBlocks];
+        [task addSubscribers:other.subscriberCount + 1];
+        if (task.priority < priority) {
+            task.priority = priority;
+        }
+        if (other) {
+            [self moveSubscriptionsLockedFromTask:other toTask:task];
+            [self removeTaskLocked:other];
+        }
+    }
+
+    // unregistered already, so nothing new can join it before it's cancelled
+    [other cancel];
+}
+
+- (void)cancelTaskIfUnsubscribed:(SGCacheTask *)task {
+    if (!task) {
+        return;
+    }
+    @synchronized (self) {
+        [task cancelIfUnsubscribed];
+    }
+}
+
+#pragma mark - Tasks by promise
+
+- (BOOL)setTask:(SGCacheTask *)task forPromise:(SGCachePromise *)promise {
+    if (!promise) {
+        return YES;
+    }
+    @synchronized (self) {
+        if ([_unsubscribedPromises containsObject:promise]) {
+            return NO;
+        }
+        [self endSubscriptionLocked:[_promiseSubscriptions objectForKey:promise]];
+        if (!task) {
+            [_promiseSubscriptions removeObjectForKey:promise];
+            return YES;
+        }
+        [_promiseSubscriptions setObject:[self subscribeLockedToTask:task] forKey:promise];
+        return YES;
+    }
+}
+
+- (SGCacheTask *)taskForPromise:(SGCachePromise *)promise {
+    if (!promise) {
+        return nil;
+    }
+    SGCacheTask *task;
+    @synchronized (self) {
+        task = [[_promiseSubscriptions objectForKey:promise] task];
+    }
+    return task.registeredQueue ? task : nil;
+}
+
+- (SGCacheTask *)endSubscriptionForPromise:(SGCachePromise *)promise {
+    if (!promise) {
+        return nil;
+    }
+    @synchronized (self) {
+        SGCacheTask *task = [self endSubscriptionLocked:[_promiseSubscriptions objectForKey:promise]];
+        [_promiseSubscriptions removeObjectForKey:promise];
+        [_unsubscribedPromises addObject:promise];
+        return task;
+    }
+}
+
+- (BOOL)isPromiseUnsubscribed:(SGCachePromise *)promise {
+    @synchronized (self) {
+        return promise && [_unsubscribedPromises containsObject:promise];
+    }
+}
+
+@end
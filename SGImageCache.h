@@ -8,6 +8,19 @@
 #import <PromiseKit/PromiseKit.h>
 #pragma clang pop
 #import "SGCache.h"
+#import "SGImageMemoryCache.h"
+
+typedef NS_ENUM(NSInteger, SGImageCacheMemoryPressure) {
+    SGImageCacheMemoryPressureWarning = 1,
+    SGImageCacheMemoryPressureCritical = 2
+};
+
+#define SGImageCacheMemoryTrimmed           @"SGImageCacheMemoryTrimmed"
+#define SGImageCacheMemoryTrimLevelKey      @"level"
+#define SGImageCacheMemoryTrimBytesKey      @"trimmedBytes"
+#define SGImageCacheMemoryTrimHitsKey       @"hits"
+#define SGImageCacheMemoryTrimMissesKey     @"misses"
+#define SGImageCacheMemoryTrimMissRateKey   @"missRate"
 
 /**
 `SGImageCache` provides a fast and simple disk and memory cache for images
@@ -44,6 +57,10 @@ Returns a PromiseKit promise that resolves with a UIImage.
   existing task completes.
 - If the URL is already in <slowQueue> it will be moved to <fastQueue> and
   the promise will resolve when the existing task completes.
+- If the image is already in the memory cache, the promise is returned
+  already resolved, and no task is queued.
+- If the image is on disk, it's read and decoded off the main thread, ahead
+  of any downloads, and no task is queued.
 */
 + (nonnull SGCachePromise *)getImageForURL:(nonnull NSString *)url
 NS_SWIFT_UNAVAILABLE("Use getImage(url:onReceive:) instead");
@@ -199,6 +216,29 @@ resolve when the existing task completes.
                                       cacheKey:(nonnull NSString *)cacheKey
 NS_SWIFT_UNAVAILABLE("Use slowGetImage(url:requestHeaders:cacheKey:onReceive:) instead");
 
+/**
+Warm the cache with a batch of images. Returns a handle which reports the
+batch's progress and can cancel it.
+
+    self.prefetch = [SGImageCache prefetchImagesForURLs:urls];
+    ...
+    [self.prefetch cancel]; // the user navigated away
+
+- Cache keys are computed once, and images already cached are skipped.
+- Images already queued or in progress join the existing task.
+- The remaining images are added to <slowQueue> in a single pass.
+*/
++ (nonnull SGCachePrefetch *)prefetchImagesForURLs:(nonnull NSArray <NSString *> *)urls;
+
+/**
+Warm the cache with a batch of images, sending HTTP headers with each request
+and queueing the fetches at the given priority. Images prefetched at
+`SGCachePriorityNormal` or above are also decoded into the memory cache.
+*/
++ (nonnull SGCachePrefetch *)prefetchImagesForURLs:(nonnull NSArray <NSString *> *)urls
+                                    requestHeaders:(nullable NSDictionary *)headers
+                                          priority:(SGCachePriority)priority;
+
 #pragma mark - House Keeping
 
 /** @name House keeping */
@@ -248,7 +288,8 @@ NS_SWIFT_UNAVAILABLE("Use slowGetImage(url:requestHeaders:cacheKey:onReceive:) i
 
 /**
 * Retrieves an imagewith matching cache key if found in the cache.
-* Returns nil if the image is not found in the cache.
+* Returns nil if the image is not found in the cache. Images read from disk
+* are only decoded up front when called off the main thread.
 *
 * @warning If you want a single method which will return an image from either
 * cache or remote, use
@@ -280,12 +321,32 @@ NS_SWIFT_UNAVAILABLE("Use slowGetImage(url:requestHeaders:cacheKey:onReceive:) i
 
 /**
  * Set Memory Cache Size in MB (defaults to 100MB)
- * This is not a hard limit and iOS will determine
- * periodically when and which items to purge from memory.
+ * The limit applies to the decoded bitmap bytes of cached images. Least
+ * recently used images are evicted as soon as it is exceeded.
  */
 + (void)setMemoryCacheSize:(NSUInteger)megaBytes;
 
-+ (nonnull NSCache *)globalMemCache;
+/**
+ * The shared memory cache, with its hit, miss and eviction counters.
+ */
++ (nonnull SGImageMemoryCache *)globalMemCache;
+
+/**
+ * Trim the memory cache in response to memory pressure. Called automatically
+ * on system memory pressure events, once per event.
+ *
+ * Images currently shown by on screen image views loaded through
+ * `UIImageView+SGImageCache` are kept. At `SGImageCacheMemoryPressureWarning`
+ * the least recently used of the rest are released until the cache is at
+ * half its size limit. At `SGImageCacheMemoryPressureCritical` all of the rest
+ * are released, off screen `SGImageView`s release their images, and
+ * `SGCacheFlushed` is triggered.
+ *
+ * Ten seconds later `SGImageCacheMemoryTrimmed` is triggered with a dictionary
+ * holding the pressure level, the bytes trimmed, and the memory cache hits,
+ * misses and miss rate since the trim.
+ */
++ (void)trimMemoryCacheForPressure:(SGImageCacheMemoryPressure)level;
 
 @end
 
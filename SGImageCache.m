@@ -8,9 +8,17 @@
 #import "SGCachePrivate.h"
 #import "SGCachePromise.h"
 #import "SGImageCachePrivate.h"
+#import "SGCacheTaskRegistry.h"
+#import "SGCacheIndex.h"
+#import "SGCacheMetricsPrivate.h"
+#import "SGCacheDelivery.h"
 
 #define FOLDER_NAME @"SGImageCache"
 #define MAX_RETRIES 5
+#define MEMORY_WARNING_TRIM_RATIO 0.5
+#define MEMORY_TRIM_REPORT_DELAY 10
+#define DISK_QUEUE_CONCURRENCY 2
+#define TOUCH_BATCH_DELAY 1.0
 
 @implementation SGImageCache
 
@@ -61,8 +69,12 @@
         return image;
     }
 
-    NSData *data = [NSData dataWithContentsOfFile:[self.cache pathForCacheKey:cacheKey]];
+    // decoding would hold up the main thread for longer than the first draw does
+    NSData *data = [self fileForCacheKey:cacheKey];
     image = [UIImage imageWithData:data];
+    if (image && !NSThread.isMainThread) {
+        image = [self decodedImage:image];
+    }
     if (!image) {
         return nil;
     }
@@ -87,15 +99,8 @@
 }
 
 + (void)addImage:(UIImage *)image forURL:(NSString *)url {
-    int height = image.size.height,
-    width = image.size.width;
-    int bytesPerRow = 4 * width;
-    if (bytesPerRow % 16) {
-        bytesPerRow = ((bytesPerRow / 16) + 1) * 16;
-    }
-    NSUInteger imageCost = height * bytesPerRow;
     NSString *cacheKey = [self.cache cacheKeyFor:url requestHeaders:nil];
-    [self.globalMemCache setObject:image forKey:cacheKey cost:imageCost];
+    [self setImageInMemCache:image forCacheKey:cacheKey];
     NSData *data = UIImagePNGRepresentation(image);
     [SGImageCache addData:data forCacheKey:cacheKey];
 }
@@ -117,18 +122,45 @@
 
 + (SGCachePromise *)getImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers
       cacheKey:(NSString *)cacheKey {
+    return [self getImageForURL:url requestHeaders:headers cacheKey:cacheKey onDelivery:nil];
+}
+
++ (SGCachePromise *)getImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers
+      cacheKey:(NSString *)cacheKey onDelivery:(void(^)(UIImage *image))delivered {
+    SGCachePromise *hit = [self promiseForMemCachedImageForCacheKey:cacheKey onDelivery:delivered];
+    if (hit) {
+        return hit;
+    }
+    // the disk read is cancelled if the promise is unsubscribed from while it waits
+    __block NSOperation *load;
     __block SGCachePromise *promise = [SGCachePromise new:^(PMKPromiseFulfiller fulfill, PMKPromiseRejecter reject) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        // run in the delivery batch. the delivery block goes first, while it's
+        // still inside the frame budget, unlike any promise handlers
+        void (^resolve)(UIImage *) = ^(UIImage *image) {
+            if (delivered && !promise.rejected) {
+                delivered(image);
+            }
+            fulfill(image);
+        };
+        load = [self loadImageFromDiskForCacheKey:cacheKey priority:NSOperationQueuePriorityHigh
+              thenDo:^(UIImage *image) {
+            if (image) {
+                [SGCacheDelivery.sharedDelivery deliver:^{
+                    resolve(image);
+                }];
+                return;
+            }
             [self getImageForURL:url requestHeaders:headers cacheKey:cacheKey remoteFetchOnly:NO
                           thenDo:^(UIImage *image) {
-                              fulfill(image);
+                              resolve(image);
                           } onFail:^(NSError *error, BOOL wasFatal) {
                               if (wasFatal) {
                                   reject(error);
                               }
                           } promise:promise];
-        });
+        }];
     }];
+    promise.pendingLoad = load;
     return promise;
 }
 
@@ -143,11 +175,24 @@
 
 + (SGCachePromise *)getRemoteImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers
                             cacheKey:(NSString *)cacheKey {
+    return [self getRemoteImageForURL:url requestHeaders:headers cacheKey:cacheKey onDelivery:nil];
+}
+
++ (SGCachePromise *)getRemoteImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers
+      cacheKey:(NSString *)cacheKey onDelivery:(void(^)(UIImage *image))delivered {
     __block SGCachePromise *promise = [SGCachePromise new:^(PMKPromiseFulfiller fulfill, PMKPromiseRejecter reject) {
+        // run in the delivery batch. the delivery block goes first, while it's
+        // still inside the frame budget, unlike any promise handlers
+        void (^resolve)(UIImage *) = ^(UIImage *image) {
+            if (delivered && !promise.rejected) {
+                delivered(image);
+            }
+            fulfill(image);
+        };
         dispatch_async(dispatch_get_main_queue(), ^{
             [self getImageForURL:url requestHeaders:headers cacheKey:cacheKey remoteFetchOnly:YES
                           thenDo:^(UIImage *image) {
-                              fulfill(image);
+                              resolve(image);
                           } onFail:^(NSError *error, BOOL wasFatal) {
                               if (wasFatal) {
                                   reject(error);
@@ -169,21 +214,117 @@
 
 + (SGCachePromise *)slowGetImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers
       cacheKey:(NSString *)cacheKey {
+    return [self slowGetImageForURL:url requestHeaders:headers cacheKey:cacheKey onDelivery:nil];
+}
+
++ (SGCachePromise *)slowGetImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers
+      cacheKey:(NSString *)cacheKey onDelivery:(void(^)(UIImage *image))delivered {
+    SGCachePromise *hit = [self promiseForMemCachedImageForCacheKey:cacheKey onDelivery:delivered];
+    if (hit) {
+        return hit;
+    }
+    // the disk read is cancelled if the promise is unsubscribed from while it waits
+    __block NSOperation *load;
     __block SGCachePromise *promise = [SGCachePromise new:^(PMKPromiseFulfiller fulfill, PMKPromiseRejecter reject) {
-        dispatch_async(dispatch_get_main_queue(), ^{
-        [self slowGetImageForURL:url requestHeaders:headers cacheKey:cacheKey
+        // run in the delivery batch. the delivery block goes first, while it's
+        // still inside the frame budget, unlike any promise handlers
+        void (^resolve)(UIImage *) = ^(UIImage *image) {
+            if (delivered && !promise.rejected) {
+                delivered(image);
+            }
+            fulfill(image);
+        };
+        load = [self loadImageFromDiskForCacheKey:cacheKey priority:NSOperationQueuePriorityLow
               thenDo:^(UIImage *image) {
-                  fulfill(image);
-              } onFail:^(NSError *error, BOOL wasFatal) {
-                  if (wasFatal) {
-                      reject(error);
-                  }
-              } promise:promise];
-        });
+            if (image) {
+                [SGCacheDelivery.sharedDelivery deliver:^{
+                    resolve(image);
+                }];
+                return;
+            }
+            [self slowGetImageForURL:url requestHeaders:headers cacheKey:cacheKey
+                  thenDo:^(UIImage *image) {
+                      resolve(image);
+                  } onFail:^(NSError *error, BOOL wasFatal) {
+                      if (wasFatal) {
+                          reject(error);
+                      }
+                  } promise:promise];
+        }];
     }];
+    promise.pendingLoad = load;
     return promise;
 }
 
+// A memory hit needs no task, no queue and no thread hops, so it's answered
+// on the spot with a promise that's already resolved. The disk entry is
+// touched later so it stays as recently used as the image is.
++ (SGCachePromise *)promiseForMemCachedImageForCacheKey:(NSString *)cacheKey
+      onDelivery:(void(^)(UIImage *image))delivered {
+    UIImage *image = [self imageFromMemCacheForCacheKey:cacheKey];
+    if (!image) {
+        return nil;
+    }
+    [self touchCacheKeyLater:cacheKey];
+    if (delivered) {
+        [SGCacheDelivery.sharedDelivery deliver:^{
+            delivered(image);
+        }];
+    }
+    return [SGCachePromise new:^(PMKPromiseFulfiller fulfill, PMKPromiseRejecter reject) {
+        fulfill(image);
+    }];
+}
+
+// memory hits waiting to be touched in the disk index, as digest data
++ (NSMutableSet *)pendingTouches {
+    static NSMutableSet *touches;
+    static dispatch_once_t token = 0;
+    dispatch_once(&token, ^{
+        touches = NSMutableSet.new;
+    });
+    return touches;
+}
+
+// Memory hits are mostly on the main thread, so they only add the key's digest
+// to a set, which also drops repeat hits. Touching the index, which takes its
+// lock and may have to open it first, is left to a background batch.
++ (void)touchCacheKeyLater:(NSString *)cacheKey {
+    SGCacheDigest digest = SGCacheDigestMake(cacheKey);
+    if (SGCacheDigestIsEmpty(digest)) {
+        return;
+    }
+    NSData *touch = [NSData dataWithBytes:digest.bytes length:SGCacheDigestLength];
+    NSMutableSet *touches = self.pendingTouches;
+    BOOL first;
+    @synchronized (touches) {
+        first = !touches.count;
+        [touches addObject:touch];
+    }
+
+    // the first touch since the last batch schedules the next one
+    if (first) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(TOUCH_BATCH_DELAY * NSEC_PER_SEC)),
+              dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+            [self applyPendingTouches];
+        });
+    }
+}
+
++ (void)applyPendingTouches {
+    NSMutableSet *touches = self.pendingTouches;
+    NSArray *batch;
+    @synchronized (touches) {
+        batch = touches.allObjects;
+        [touches removeAllObjects];
+    }
+    for (NSData *touch in batch) {
+        SGCacheDigest digest;
+        memcpy(digest.bytes, touch.bytes, SGCacheDigestLength);
+        [self.cache.diskIndex touchDigest:digest];
+    }
+}
+
 + (void)getImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers
       cacheKey:(NSString *)cacheKey remoteFetchOnly:(BOOL)remoteOnly
                 thenDo:(SGCacheFetchCompletion)completion
@@ -194,33 +335,38 @@
     }
 
     backgroundDo(^{
+        // unsubscribed before there was a task to subscribe to
+        if ([self.cache.taskRegistry isPromiseUnsubscribed:promise]) {
+            return;
+        }
         SGImageCacheTask *slowTask = (id)[self existingSlowQueueTaskFor:cacheKey];
         SGImageCacheTask *fastTask = (id)[self existingFastQueueTaskFor:cacheKey];
 
         if (slowTask.isExecuting) { // reuse an executing slow task
+
+            SGCacheMetricsCount(SGCacheCounterDedupeMerges, 1);
             [slowTask addCompletion:completion];
-            [slowTask addCompletions:fastTask.completions];
             [slowTask addFailBlock:failBlock];
-            [slowTask addFailBlocks:fastTask.onFailBlocks];
-            slowTask.forceDecompress = YES;
+            [self.cache.taskRegistry mergeTask:fastTask intoTask:slowTask
+                  priority:SGCachePriorityNormal];
             slowTask.promise = promise;
-            [fastTask cancel];
         } else if (fastTask) { // reuse a fast task
+            SGCacheMetricsCount(SGCacheCounterDedupeMerges, 1);
             [fastTask addCompletion:completion];
-            [fastTask addCompletions:slowTask.completions];
             [fastTask addFailBlock:failBlock];
-            [fastTask addFailBlocks:slowTask.onFailBlocks];
+            [self.cache.taskRegistry mergeTask:slowTask intoTask:fastTask
+                  priority:SGCachePriorityNormal];
             fastTask.promise = promise;
-            [slowTask cancel];
         } else { // add a fresh task to fast queue
             SGImageCacheTask *task = (id)[self taskForURL:url requestHeaders:headers
                   cacheKey:cacheKey attempt:1];
             task.remoteFetchOnly = remoteOnly;
             [task addCompletion:completion];
             [task addFailBlock:failBlock];
+            [task addSubscribers:1];
             task.promise = promise;
             task.forceDecompress = YES;
-            [self.cache.fastQueue addOperation:task];
+            [self addTask:task toQueue:self.cache.fastQueue];
         }
     });
 }
@@ -234,34 +380,50 @@
     }
 
     backgroundDo(^{
+        // unsubscribed before there was a task to subscribe to
+        if ([self.cache.taskRegistry isPromiseUnsubscribed:promise]) {
+            return;
+        }
         SGImageCacheTask *slowTask = (id)[self existingSlowQueueTaskFor:cacheKey];
         SGImageCacheTask *fastTask = (id)[self existingFastQueueTaskFor:cacheKey];
 
         if (fastTask && !slowTask.isExecuting) { // reuse existing fast task
+
+            SGCacheMetricsCount(SGCacheCounterDedupeMerges, 1);
             [fastTask addCompletion:completion];
-            [fastTask addCompletions:slowTask.completions];
             [fastTask addFailBlock:failBlock];
-            [fastTask addFailBlocks:slowTask.onFailBlocks];
+            [self.cache.taskRegistry mergeTask:slowTask intoTask:fastTask
+                  priority:SGCachePriorityPrefetch];
             fastTask.promise = promise;
-            [slowTask cancel];
         } else if (slowTask) { // reuse existing slow task
+            SGCacheMetricsCount(SGCacheCounterDedupeMerges, 1);
             [slowTask addCompletion:completion];
-            [slowTask addCompletions:fastTask.completions];
             [slowTask addFailBlock:failBlock];
-            [slowTask addFailBlocks:fastTask.onFailBlocks];
+            [self.cache.taskRegistry mergeTask:fastTask intoTask:slowTask
+                  priority:SGCachePriorityPrefetch];
             slowTask.promise = promise;
-            [fastTask cancel];
         } else { // add a fresh task to slow queue
             SGImageCacheTask *task = (id)[self taskForURL:url requestHeaders:headers
                   cacheKey:cacheKey attempt:1];
             [task addCompletion:completion];
             [task addFailBlock:failBlock];
+            [task addSubscribers:1];
+            task.priority = SGCachePriorityPrefetch;
             task.promise = promise;
-            [self.cache.slowQueue addOperation:task];
+            [self addTask:task toQueue:self.cache.slowQueue];
         }
     });
 }
 
++ (SGCachePrefetch *)prefetchImagesForURLs:(NSArray *)urls {
+    return [self prefetchFilesForURLs:urls];
+}
+
++ (SGCachePrefetch *)prefetchImagesForURLs:(NSArray *)urls requestHeaders:(NSDictionary *)headers
+      priority:(SGCachePriority)priority {
+    return [self prefetchFilesForURLs:urls requestHeaders:headers priority:priority];
+}
+
 + (void)flushImagesOlderThan:(NSTimeInterval)age {
     [self flushFilesOlderThan:age];
 }
@@ -272,19 +434,103 @@
     return [self.globalMemCache objectForKey:cacheKey];
 }
 
+// for lookups a caller didn't ask for, which shouldn't count as hits or misses
++ (UIImage *)uncountedImageFromMemCacheForCacheKey:(NSString *)cacheKey {
+    return [self.globalMemCache uncountedObjectForKey:cacheKey];
+}
+
 + (void)setImageInMemCache:(UIImage *)image forCacheKey:(NSString *)cacheKey {
     if (!image) {
         [self.globalMemCache removeObjectForKey:cacheKey];
         return;
     }
-    // quickly guess rough byte size of the image
-    int height = image.size.height, width = image.size.width;
-    int bytesPerRow = 4 * width;
-    if (bytesPerRow % 16) {
-        bytesPerRow = ((bytesPerRow / 16) + 1) * 16;
+    [self.globalMemCache setObject:image forKey:cacheKey
+          cost:[SGImageMemoryCache costForImage:image]];
+}
+
+// Draws the image into a bitmap in the format the display uses, at its full
+// pixel size, so the pixels are decoded once here and not again on the main
+// thread at first draw. Scale, orientation and RGB colour spaces (eg Display P3)
+// are kept as decoded. Other colour models are drawn into device RGB.
++ (UIImage *)decodedImage:(UIImage *)image {
+    CGImageRef cgImage = image.CGImage;
+    if (!cgImage || image.images) {
+        return image;
+    }
+    size_t width = CGImageGetWidth(cgImage), height = CGImageGetHeight(cgImage);
+    if (!width || !height) {
+        return image;
+    }
+
+    CGImageAlphaInfo alpha = CGImageGetAlphaInfo(cgImage);
+    BOOL opaque = alpha == kCGImageAlphaNone || alpha == kCGImageAlphaNoneSkipFirst
+          || alpha == kCGImageAlphaNoneSkipLast;
+    CGBitmapInfo info = kCGBitmapByteOrder32Host
+          | (opaque ? kCGImageAlphaNoneSkipFirst : kCGImageAlphaPremultipliedFirst);
+
+    CGColorSpaceRef source = CGImageGetColorSpace(cgImage);
+    CGColorSpaceRef colorSpace = source && CGColorSpaceGetModel(source) == kCGColorSpaceModelRGB
+          ? CGColorSpaceRetain(source) : CGColorSpaceCreateDeviceRGB();
+    CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, info);
+    CGColorSpaceRelease(colorSpace);
+    if (!context) {
+        return image;
+    }
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), cgImage);
+    CGImageRef decoded = CGBitmapContextCreateImage(context);
+    CGContextRelease(context);
+    if (!decoded) {
+        return image;
     }
-    NSUInteger imageCost = height * bytesPerRow;
-    [self.globalMemCache setObject:image forKey:cacheKey cost:imageCost];
+
+    UIImage *result = [UIImage imageWithCGImage:decoded scale:image.scale
+          orientation:image.imageOrientation];
+    CGImageRelease(decoded);
+    return result;
+}
+
+#pragma mark - Disk Loading
+
+// Disk hits are read in a lane of their own, so they're never stuck behind
+// downloads in the fetch queues. As with fetches, only images wanted at high
+// priority are decoded up front and kept in the memory cache. Completes on
+// the lane's thread, with nil if the file isn't there or won't decode.
+// Cancelling the returned operation before it starts drops the load, without
+// completing.
++ (NSOperation *)loadImageFromDiskForCacheKey:(NSString *)cacheKey
+      priority:(NSOperationQueuePriority)priority thenDo:(void(^)(UIImage *image))completion {
+    BOOL decode = priority >= NSOperationQueuePriorityHigh;
+    NSBlockOperation *load = [NSBlockOperation blockOperationWithBlock:^{
+        // misses are left for the fetch task to count, when it looks for itself
+        UIImage *image;
+        NSData *data = [self haveFileForCacheKey:cacheKey] ? [self fileForCacheKey:cacheKey] : nil;
+        if (data) {
+            NSTimeInterval decodeStart = SGCacheMetricsNow();
+            image = [UIImage imageWithData:data];
+            if (decode) {
+                image = [self decodedImage:image];
+            }
+            SGCacheMetricsRecordTime(SGCacheTimerDecode, SGCacheMetricsNow() - decodeStart);
+        }
+        if (image && decode) {
+            [self setImageInMemCache:image forCacheKey:cacheKey];
+        }
+        completion(image);
+    }];
+    load.queuePriority = priority;
+    [self.diskQueue addOperation:load];
+    return load;
+}
+
++ (NSOperationQueue *)diskQueue {
+    static NSOperationQueue *diskQueue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        diskQueue = NSOperationQueue.new;
+        diskQueue.maxConcurrentOperationCount = DISK_QUEUE_CONCURRENCY;
+        diskQueue.qualityOfService = NSQualityOfServiceUserInitiated;
+    });
+    return diskQueue;
 }
 
 #pragma mark - Task Factory
@@ -295,7 +541,7 @@
           attempt:attempt];
     __weak SGImageCacheTask *wTask = task;
     task.completionBlock = ^{
-        if (!wTask.succeeded) {
+        if (!wTask.succeeded && !wTask.isCancelled) {
             [SGImageCache taskFailed:wTask];
         }
     };
@@ -306,34 +552,133 @@
     self.globalMemCache.totalCostLimit = megaBytes * 1000000;
 }
 
-+ (NSCache *)globalMemCache {
-    static NSCache *globalCache;
++ (SGImageMemoryCache *)globalMemCache {
+    static SGImageMemoryCache *globalCache;
     static dispatch_once_t onceToken;
     dispatch_once(&onceToken, ^{
 #if !TARGET_OS_WATCH
-        globalCache = NSCache.new;
+        globalCache = SGImageMemoryCache.new;
         globalCache.totalCostLimit = 100000000;  // 100 MB ish
-        [NSNotificationCenter.defaultCenter
-             addObserverForName:UIApplicationDidReceiveMemoryWarningNotification
-             object:nil
-             queue:[NSOperationQueue mainQueue]
-             usingBlock:^(NSNotification *note) {
-                 // attempt to flush the cache, and then reactivate it some-time later
-                 NSInteger costLimit = globalCache.totalCostLimit;
-                 globalCache.totalCostLimit = 1;
-                 dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(10 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
-                     globalCache.totalCostLimit = costLimit;
-                 });
-                 [SGImageCache trigger:SGCacheFlushed];
-             }];
+
+        // the system's own pressure levels, which can reach critical before a warning is sent.
+        // a warning also posts UIApplicationDidReceiveMemoryWarningNotification, which isn't
+        // observed as well, so that one warning only trims once
+        static dispatch_source_t pressureSource;
+        pressureSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0,
+              DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL,
+              dispatch_get_main_queue());
+        dispatch_source_set_event_handler(pressureSource, ^{
+            unsigned long status = dispatch_source_get_data(pressureSource);
+            [SGImageCache trimMemoryCacheForPressure:status & DISPATCH_MEMORYPRESSURE_CRITICAL
+                  ? SGImageCacheMemoryPressureCritical : SGImageCacheMemoryPressureWarning];
+        });
+        dispatch_resume(pressureSource);
 #else
-        globalCache = NSCache.new;
+        globalCache = SGImageMemoryCache.new;
         globalCache.totalCostLimit = 10000000;  // 10 MB ish
 #endif
     });
     return globalCache;
 }
 
+#pragma mark - Memory Pressure
+
++ (void)trimMemoryCacheForPressure:(SGImageCacheMemoryPressure)level {
+    if (!NSThread.isMainThread) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self trimMemoryCacheForPressure:level];
+        });
+        return;
+    }
+
+    SGImageMemoryCache *memCache = self.globalMemCache;
+    NSUInteger target = 0;
+    if (level == SGImageCacheMemoryPressureWarning) {
+        NSUInteger budget = memCache.totalCostLimit ?: memCache.totalCost;
+        target = (NSUInteger)(budget * MEMORY_WARNING_TRIM_RATIO);
+    }
+    NSUInteger trimmed = [memCache trimToCost:target excludingKeys:self.displayedCacheKeys];
+
+    // a partial trim keeps what's on screen, so it's only reported as a flush
+    // when everything else is gone. SGImageCacheMemoryTrimmed covers both.
+    // off screen image views only let go of their images at that point too,
+    // since they'd reload them from disk on their way back on screen
+    if (level == SGImageCacheMemoryPressureCritical) {
+        [SGImageCache trigger:SGImageCacheReleaseOffscreenImages];
+        [SGImageCache trigger:SGCacheFlushed];
+    }
+
+    [self reportMemoryTrim:trimmed forPressure:level];
+}
+
++ (void)reportMemoryTrim:(NSUInteger)trimmed forPressure:(SGImageCacheMemoryPressure)level {
+    SGImageMemoryCache *memCache = self.globalMemCache;
+    BOOL logging = SGImageCache.logging & SGImageCacheLogMemoryFlushing;
+    if (logging) {
+        NSLog(@"SGImageCache trimmed %lu bytes from memory at pressure level %ld, %lu bytes remain",
+              (unsigned long)trimmed, (long)level, (unsigned long)memCache.totalCost);
+    }
+
+    // measure what the trim cost us in misses over the following seconds
+    unsigned long long hits = memCache.hits, misses = memCache.misses;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(MEMORY_TRIM_REPORT_DELAY * NSEC_PER_SEC)),
+          dispatch_get_main_queue(), ^{
+        unsigned long long newHits = memCache.hits - hits, newMisses = memCache.misses - misses;
+        double missRate = newHits + newMisses ? (double)newMisses / (newHits + newMisses) : 0;
+        NSDictionary *report = @{
+              SGImageCacheMemoryTrimLevelKey: @(level),
+              SGImageCacheMemoryTrimBytesKey: @(trimmed),
+              SGImageCacheMemoryTrimHitsKey: @(newHits),
+              SGImageCacheMemoryTrimMissesKey: @(newMisses),
+              SGImageCacheMemoryTrimMissRateKey: @(missRate)
+        };
+        if (logging) {
+            NSLog(@"SGImageCache memory miss rate after trim: %.2f (%llu hits, %llu misses)",
+                  missRate, newHits, newMisses);
+        }
+        [SGImageCache trigger:SGImageCacheMemoryTrimmed withContext:report];
+    });
+}
+
+#if !TARGET_OS_WATCH
+
++ (NSMapTable *)displayingImageViews {
+    static NSMapTable *imageViews;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        imageViews = NSMapTable.weakToStrongObjectsMapTable;
+    });
+    return imageViews;
+}
+
++ (void)setDisplayedCacheKey:(NSString *)cacheKey forImageView:(UIImageView *)imageView {
+    if (cacheKey) {
+        [self.displayingImageViews setObject:cacheKey forKey:imageView];
+    } else {
+        [self.displayingImageViews removeObjectForKey:imageView];
+    }
+}
+
+// keys of images shown by image views that are currently in a window
++ (NSSet *)displayedCacheKeys {
+    NSMutableSet *keys = NSMutableSet.new;
+    NSMapTable *imageViews = self.displayingImageViews;
+    for (UIImageView *imageView in imageViews) {
+        if (imageView.window && imageView.image) {
+            [keys addObject:[imageViews objectForKey:imageView]];
+        }
+    }
+    return keys;
+}
+
+#else
+
++ (NSSet *)displayedCacheKeys {
+    return nil;
+}
+
+#endif
+
 @end
 
 #pragma mark - Simple Interface for Swift
@@ -341,91 +686,59 @@
 @implementation SGImageCache (SGImageCache_Simple)
 
 + (void)getImageForURL:(NSString *)url onReceive:(void (^)(UIImage *))onReceive {
-    [self getImageForURL:url].then(^(UIImage *image) {
-        if (onReceive) {
-            onReceive(image);
-        }
-    });
+    NSString *cacheKey = [self.cache cacheKeyFor:url requestHeaders:nil];
+    [self getImageForURL:url requestHeaders:nil cacheKey:cacheKey onDelivery:onReceive];
 }
 
 + (void)getImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers onReceive:(void (^)(UIImage *))onReceive {
-    [self getImageForURL:url requestHeaders:headers].then(^(UIImage *image) {
-        if (onReceive) {
-            onReceive(image);
-        }
-    });
+    NSString *cacheKey = [self.cache cacheKeyFor:url requestHeaders:headers];
+    [self getImageForURL:url requestHeaders:headers cacheKey:cacheKey onDelivery:onReceive];
 }
 
 + (void)getImageForURL:(NSString *)url
         requestHeaders:(NSDictionary *)headers
               cacheKey:(NSString *)cacheKey
              onReceive:(void (^)(UIImage *))onReceive {
-    [self getImageForURL:url requestHeaders:headers cacheKey:cacheKey].then(^(UIImage *image) {
-        if (onReceive) {
-            onReceive(image);
-        }
-    });
+    [self getImageForURL:url requestHeaders:headers cacheKey:cacheKey onDelivery:onReceive];
 }
 
 + (void)getRemoteImageForURL:(NSString *)url onReceive:(void (^)(UIImage *))onReceive {
-    [self getRemoteImageForURL:url].then(^(UIImage *image) {
-        if (onReceive) {
-            onReceive(image);
-        }
-    });
+    NSString *cacheKey = [self.cache cacheKeyFor:url requestHeaders:nil];
+    [self getRemoteImageForURL:url requestHeaders:nil cacheKey:cacheKey onDelivery:onReceive];
 }
 
 + (void)getRemoteImageForURL:(NSString *)url
               requestHeaders:(NSDictionary *)headers
                    onReceive:(void (^)(UIImage *))onReceive {
-    [self getRemoteImageForURL:url requestHeaders:headers].then(^(UIImage *image) {
-        if (onReceive) {
-            onReceive(image);
-        }
-    });
+    NSString *cacheKey = [self.cache cacheKeyFor:url requestHeaders:headers];
+    [self getRemoteImageForURL:url requestHeaders:headers cacheKey:cacheKey onDelivery:onReceive];
 }
 
 + (void)getRemoteImageForURL:(NSString *)url
               requestHeaders:(NSDictionary *)headers
                     cacheKey:(NSString *)cacheKey
                    onReceive:(void (^)(UIImage *))onReceive {
-    [self getRemoteImageForURL:url
-                requestHeaders:headers
-                      cacheKey:cacheKey].then(^(UIImage *image) {
-        if (onReceive) {
-            onReceive(image);
-        }
-    });
+    [self getRemoteImageForURL:url requestHeaders:headers cacheKey:cacheKey onDelivery:onReceive];
 }
 
 + (void)slowGetImageForURL:(NSString *)url
                  onReceive:(void (^)(UIImage *))onReceive {
-    [self slowGetImageForURL:url].then(^(UIImage *image) {
-        if (onReceive) {
-            onReceive(image);
-        }
-    });
+    NSString *cacheKey = [self.cache cacheKeyFor:url requestHeaders:nil];
+    [self slowGetImageForURL:url requestHeaders:nil cacheKey:cacheKey onDelivery:onReceive];
 }
 
 + (void)slowGetImageForURL:(NSString *)url
             requestHeaders:(NSDictionary *)headers
                  onReceive:(void (^)(UIImage *))onReceive {
-    [self slowGetImageForURL:url requestHeaders:headers].then(^(UIImage *image) {
-        if (onReceive) {
-            onReceive(image);
-        }
-    });
+    NSString *cacheKey = [self.cache cacheKeyFor:url requestHeaders:headers];
+    [self slowGetImageForURL:url requestHeaders:headers cacheKey:cacheKey onDelivery:onReceive];
 }
 
 + (void)slowGetImageForURL:(NSString *)url
             requestHeaders:(NSDictionary *)headers
                   cacheKey:(NSString *)cacheKey
                  onReceive:(void (^)(UIImage *))onReceive {
-    [self slowGetImageForURL:url requestHeaders:headers cacheKey:cacheKey].then(^(UIImage *image) {
-        if (onReceive) {
-            onReceive(image);
-        }
-    });
+    [self slowGetImageForURL:url requestHeaders:headers cacheKey:cacheKey onDelivery:onReceive];
 }
 
 @end
@@ -9,9 +9,28 @@
 #ifndef Pods_SGImageCachePrivate_h
 #define Pods_SGImageCachePrivate_h
 
+// asks off screen SGImageViews to let go of their images
+#define SGImageCacheReleaseOffscreenImages @"SGImageCacheReleaseOffscreenImages"
+
 @interface SGImageCache ()
 + (UIImage *)imageFromMemCacheForCacheKey:(NSString *)cacheKey;
++ (UIImage *)uncountedImageFromMemCacheForCacheKey:(NSString *)cacheKey;
 + (void)setImageInMemCache:(UIImage *)image forCacheKey:(NSString *)cacheKey;
++ (UIImage *)decodedImage:(UIImage *)image;
++ (NSOperation *)loadImageFromDiskForCacheKey:(NSString *)cacheKey
+      priority:(NSOperationQueuePriority)priority thenDo:(void(^)(UIImage *image))completion;
+
+// these run `delivered` on the main thread in the delivery batch, within its
+// frame budget, before the promise's handlers
++ (SGCachePromise *)getImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers
+      cacheKey:(NSString *)cacheKey onDelivery:(void(^)(UIImage *image))delivered;
++ (SGCachePromise *)getRemoteImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers
+      cacheKey:(NSString *)cacheKey onDelivery:(void(^)(UIImage *image))delivered;
++ (SGCachePromise *)slowGetImageForURL:(NSString *)url requestHeaders:(NSDictionary *)headers
+      cacheKey:(NSString *)cacheKey onDelivery:(void(^)(UIImage *image))delivered;
+#if !TARGET_OS_WATCH
++ (void)setDisplayedCacheKey:(NSString *)cacheKey forImageView:(UIImageView *)imageView;
+#endif
 @end
 
 #endif
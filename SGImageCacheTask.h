@@ -7,6 +7,10 @@
 
 @interface SGImageCacheTask : SGCacheTask
 
+/**
+* Decode the image into a display ready bitmap before completing, and keep
+* the decoded image in the memory cache. Set for urgent fetches.
+*/
 @property (nonatomic, assign) BOOL forceDecompress;
 
 @end
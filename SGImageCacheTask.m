@@ -7,6 +7,9 @@
 #import "SGCachePrivate.h"
 #import "SGImageCache.h"
 #import "SGImageCachePrivate.h"
+#import "SGCacheIndex.h"
+#import "SGCacheMetricsPrivate.h"
+#import "SGCacheDelivery.h"
 
 @implementation SGImageCacheTask
 
@@ -16,33 +19,78 @@
     return self;
 }
 
-- (void)completedWithFile:(NSData *)data {
-    UIImage *image = [UIImage imageWithData:data];
+- (void)setPriority:(SGCachePriority)priority {
+    [super setPriority:priority];
+    if (priority >= SGCachePriorityNormal) { // wanted on screen, so decode up front
+        self.forceDecompress = YES;
+    }
+}
 
-    if (image) {
-        if ([SGImageCache imageFromMemCacheForCacheKey:self.cacheKey]) {
-            [SGImageCache setImageInMemCache:image forCacheKey:self.cacheKey];
-        }
-        [SGImageCache addData:data forCacheKey:self.cacheKey];
-    } else {
+// an image still in memory is handed over as is, without reading or decoding the file
+- (BOOL)completedWithCachedFile {
+    UIImage *image = [SGImageCache uncountedImageFromMemCacheForCacheKey:self.cacheKey];
+    if (!image || ![SGImageCache haveFileForDigest:self.digest]) {
+        return [super completedWithCachedFile];
+    }
+    [SGImageCache.cache.diskIndex touchDigest:self.digest];
+    [self completedWithImage:image];
+    return YES;
+}
+
+// only data that decodes as an image is worth storing
+- (BOOL)validateData:(NSData *)data {
+    return data && [UIImage imageWithData:data];
+}
+
+- (void)completedWithFetchedData:(NSData *)data {
+    UIImage *image = [self imageWithData:data];
+    if (!image) {
+        [self failedWithError:self.invalidDataError allowRetry:YES];
         [self finish];
         return;
     }
+    [SGImageCache addData:data forDigest:self.digest];
+    [self completedWithImage:image];
+}
 
-    // force a decompress
+// a stored file that won't decode is removed, so the retry fetches it again
+- (void)completedWithFile:(NSData *)data {
+    UIImage *image = [self imageWithData:data];
+    if (!image) {
+        [SGImageCache removeDataForDigest:self.digest];
+        [self failedWithError:self.invalidDataError allowRetry:YES];
+        [self finish];
+        return;
+    }
+    [self completedWithImage:image];
+}
+
+- (UIImage *)imageWithData:(NSData *)data {
+    NSTimeInterval started = SGCacheMetricsNow();
+    UIImage *image = [UIImage imageWithData:data];
+    if (!image) {
+        return nil;
+    }
+
+    // decode now, off the main thread, so the first draw doesn't have to
     if (self.forceDecompress) {
-        UIGraphicsBeginImageContext(CGSizeMake(1, 1));
-        CGContextRef context = UIGraphicsGetCurrentContext();
-        CGContextDrawImage(context, CGRectMake(0, 0, 1, 1), image.CGImage);
-        UIGraphicsEndImageContext();
+        image = [SGImageCache decodedImage:image];
     }
+    SGCacheMetricsRecordTime(SGCacheTimerDecode, SGCacheMetricsNow() - started);
+
+    if (self.forceDecompress || [SGImageCache uncountedImageFromMemCacheForCacheKey:self.cacheKey]) {
+        [SGImageCache setImageInMemCache:image forCacheKey:self.cacheKey];
+    }
+    return image;
+}
 
+- (void)completedWithImage:(UIImage *)image {
     // call the completion blocks on the main thread
-    dispatch_async(dispatch_get_main_queue(), ^{
+    [SGCacheDelivery.sharedDelivery deliver:^{
         for (SGCacheFetchCompletion completion in self.completions) {
             completion(image);
         }
-    });
+    }];
 
     self.succeeded = YES;
     [self finish];
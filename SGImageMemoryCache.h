@@ -0,0 +1,63 @@
+//
+//  SGImageMemoryCache.h
+//  Pods
+//
+
+#import <UIKit/UIKit.h>
+
+/**
+* The in memory image cache behind `+[SGImageCache globalMemCache]`.
+*
+* Images are costed by the exact byte size of their bitmaps and evicted in
+* least recently used order, across the whole cache, once <totalCostLimit> is
+* exceeded. Keys are spread over lock striped shards so lookups from
+* different threads rarely contend. An image bigger than the whole limit isn't
+* kept.
+*
+* It subclasses NSCache so existing callers keep working, but keeps its own
+* storage: `countLimit` is ignored and entries are never purged behind its
+* back. A delegate is told about entries evicted to stay under the limit.
+*/
+
+@interface SGImageMemoryCache : NSCache
+
+/** Bytes currently held across all shards. */
+@property (nonatomic, readonly) NSUInteger totalCost;
+
+/** Number of entries currently held. */
+@property (nonatomic, readonly) NSUInteger count;
+
+/** Lookups that found an entry. */
+@property (nonatomic, readonly) unsigned long long hits;
+
+/** Lookups that found nothing. */
+@property (nonatomic, readonly) unsigned long long misses;
+
+/** Entries dropped to stay within the cost limit or by a trim. */
+@property (nonatomic, readonly) unsigned long long evictions;
+
+/**
+* Same as `objectForKey:`, but not counted as a hit or miss. For the image
+* cache's own lookups, so the counts only reflect what callers asked for.
+*/
+- (id)uncountedObjectForKey:(id)key;
+
+/**
+* Evict least recently used entries until no more than `cost` bytes remain.
+* The cost limit is left unchanged.
+*/
+- (void)trimToCost:(NSUInteger)cost;
+
+/**
+* Evict least recently used entries, skipping any whose key is in `keys`,
+* until no more than `cost` bytes remain or only skipped entries are left.
+* Returns the number of bytes evicted.
+*/
+- (NSUInteger)trimToCost:(NSUInteger)cost excludingKeys:(NSSet *)keys;
+
+/**
+* The bitmap byte size of an image, summed over frames for animated images.
+*/
++ (NSUInteger)costForImage:(UIImage *)image;
+
+@end
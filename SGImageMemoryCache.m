@@ -0,0 +1,456 @@
+//
+//  SGImageMemoryCache.m
+//  Pods
+//
+
+#import "SGImageMemoryCache.h"
+#import "SGCacheMetricsPrivate.h"
+#import <pthread.h>
+#import <stdatomic.h>
+
+#define SHARD_COUNT 8
+
+#pragma mark - Entry
+
+@interface SGImageMemoryCacheEntry : NSObject {
+  @public
+    id _key;
+    id _object;
+    NSUInteger _cost;
+    uint64_t _stamp;
+    __unsafe_unretained SGImageMemoryCacheEntry *_prev;
+    __unsafe_unretained SGImageMemoryCacheEntry *_next;
+}
+@end
+
+@implementation SGImageMemoryCacheEntry
+@end
+
+#pragma mark - Shard
+
+// Entries are retained by the dictionary and linked most recently used first.
+// Every access stamps the entry from a clock shared by all shards, so each
+// shard's list is also in stamp order and the cache can find the globally
+// least recently used entry by comparing the shards' tails. Every method takes
+// the shard's lock, and evicted entries are handed back to the caller so they
+// are released outside it.
+@interface SGImageMemoryCacheShard : NSObject
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, readonly) unsigned long long hits, misses, evictions;
+- (instancetype)initWithClock:(atomic_ullong *)clock;
+- (id)objectForKey:(id)key counted:(BOOL)counted;
+- (SGImageMemoryCacheEntry *)setObject:(id)object forKey:(id)key cost:(NSUInteger)cost;
+- (SGImageMemoryCacheEntry *)removeObjectForKey:(id)key;
+- (NSArray *)removeAllObjects;
+- (uint64_t)oldestStampExcludingKeys:(NSSet *)keys;
+- (SGImageMemoryCacheEntry *)evictOldestExcludingKeys:(NSSet *)keys;
+@end
+
+@implementation SGImageMemoryCacheShard {
+    pthread_mutex_t _lock;
+    atomic_ullong *_clock;
+    NSMutableDictionary *_entries;
+    __unsafe_unretained SGImageMemoryCacheEntry *_head;
+    __unsafe_unretained SGImageMemoryCacheEntry *_tail;
+    unsigned long long _hits, _misses, _evictions;
+}
+
+- (instancetype)initWithClock:(atomic_ullong *)clock {
+    self = [super init];
+    pthread_mutex_init(&_lock, NULL);
+    _clock = clock;
+    _entries = NSMutableDictionary.new;
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+#pragma mark - List
+
+- (void)unlink:(SGImageMemoryCacheEntry *)entry {
+    if (entry->_prev) {
+        entry->_prev->_next = entry->_next;
+    } else {
+        _head = entry->_next;
+    }
+    if (entry->_next) {
+        entry->_next->_prev = entry->_prev;
+    } else {
+        _tail = entry->_prev;
+    }
+    entry->_prev = nil;
+    entry->_next = nil;
+}
+
+- (void)insertAtHead:(SGImageMemoryCacheEntry *)entry {
+    entry->_prev = nil;
+    entry->_next = _head;
+    if (_head) {
+        _head->_prev = entry;
+    }
+    _head = entry;
+    if (!_tail) {
+        _tail = entry;
+    }
+}
+
+- (void)touch:(SGImageMemoryCacheEntry *)entry {
+    entry->_stamp = atomic_fetch_add(_clock, 1);
+    if (entry != _head) {
+        [self unlink:entry];
+        [self insertAtHead:entry];
+    }
+}
+
+- (SGImageMemoryCacheEntry *)oldestLockedExcludingKeys:(NSSet *)keys {
+    SGImageMemoryCacheEntry *entry = _tail;
+    while (entry && [keys containsObject:entry->_key]) {
+        entry = entry->_prev;
+    }
+    return entry;
+}
+
+#pragma mark - Access
+
+- (id)objectForKey:(id)key counted:(BOOL)counted {
+    pthread_mutex_lock(&_lock);
+    SGImageMemoryCacheEntry *entry = _entries[key];
+    id object;
+    if (entry) {
+        [self touch:entry];
+        object = entry->_object;
+    }
+    if (counted && entry) {
+        _hits++;
+    } else if (counted) {
+        _misses++;
+    }
+    pthread_mutex_unlock(&_lock);
+    return object;
+}
+
+// returns the entry that was replaced, if any, for its cost and release
+- (SGImageMemoryCacheEntry *)setObject:(id)object forKey:(id)key cost:(NSUInteger)cost {
+    SGImageMemoryCacheEntry *entry = SGImageMemoryCacheEntry.new;
+    entry->_key = [key copy];
+    entry->_object = object;
+    entry->_cost = cost;
+    pthread_mutex_lock(&_lock);
+    SGImageMemoryCacheEntry *replaced = _entries[key];
+    if (replaced) {
+        [self unlink:replaced];
+    }
+    _entries[entry->_key] = entry;
+    entry->_stamp = atomic_fetch_add(_clock, 1);
+    [self insertAtHead:entry];
+    pthread_mutex_unlock(&_lock);
+    return replaced;
+}
+
+- (SGImageMemoryCacheEntry *)removeObjectForKey:(id)key {
+    pthread_mutex_lock(&_lock);
+    SGImageMemoryCacheEntry *entry = _entries[key];
+    if (entry) {
+        [self unlink:entry];
+        [_entries removeObjectForKey:key];
+    }
+    pthread_mutex_unlock(&_lock);
+    return entry;
+}
+
+- (NSArray *)removeAllObjects {
+    pthread_mutex_lock(&_lock);
+    NSArray *removed = _entries.allValues;
+    [_entries removeAllObjects];
+    _head = nil;
+    _tail = nil;
+    pthread_mutex_unlock(&_lock);
+    return removed;
+}
+
+#pragma mark - Eviction
+
+// UINT64_MAX if there's nothing to evict
+- (uint64_t)oldestStampExcludingKeys:(NSSet *)keys {
+    pthread_mutex_lock(&_lock);
+    SGImageMemoryCacheEntry *entry = [self oldestLockedExcludingKeys:keys];
+    uint64_t stamp = entry ? entry->_stamp : UINT64_MAX;
+    pthread_mutex_unlock(&_lock);
+    return stamp;
+}
+
+- (SGImageMemoryCacheEntry *)evictOldestExcludingKeys:(NSSet *)keys {
+    pthread_mutex_lock(&_lock);
+    SGImageMemoryCacheEntry *entry = [self oldestLockedExcludingKeys:keys];
+    if (entry) {
+        [self unlink:entry];
+        _evictions++;
+        [_entries removeObjectForKey:entry->_key];
+    }
+    pthread_mutex_unlock(&_lock);
+    return entry;
+}
+
+#pragma mark - Getters
+
+- (NSUInteger)count {
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = _entries.count;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (unsigned long long)hits {
+    pthread_mutex_lock(&_lock);
+    unsigned long long hits = _hits;
+    pthread_mutex_unlock(&_lock);
+    return hits;
+}
+
+- (unsigned long long)misses {
+    pthread_mutex_lock(&_lock);
+    unsigned long long misses = _misses;
+    pthread_mutex_unlock(&_lock);
+    return misses;
+}
+
+- (unsigned long long)evictions {
+    pthread_mutex_lock(&_lock);
+    unsigned long long evictions = _evictions;
+    pthread_mutex_unlock(&_lock);
+    return evictions;
+}
+
+@end
+
+#pragma mark - Cache
+
+@implementation SGImageMemoryCache {
+    NSArray <SGImageMemoryCacheShard *> *_shards;
+    atomic_ullong _clock;
+    atomic_ulong _totalCost;
+    NSUInteger _totalCostLimit;
+    pthread_mutex_t _evictionLock;
+}
+
+- (id)init {
+    self = [super init];
+    atomic_init(&_clock, 0);
+    atomic_init(&_totalCost, 0);
+    pthread_mutex_init(&_evictionLock, NULL);
+    NSMutableArray *shards = NSMutableArray.new;
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        [shards addObject:[[SGImageMemoryCacheShard alloc] initWithClock:&_clock]];
+    }
+    _shards = shards.copy;
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_evictionLock);
+}
+
++ (NSUInteger)costForImage:(UIImage *)image {
+    if (image.images.count) {
+        NSUInteger cost = 0;
+        for (UIImage *frame in image.images) {
+            cost += [self costForImage:frame];
+        }
+        return cost;
+    }
+    CGImageRef cgImage = image.CGImage;
+    if (cgImage) {
+        return CGImageGetBytesPerRow(cgImage) * CGImageGetHeight(cgImage);
+    }
+    CGFloat scale = image.scale;
+    return 4 * (NSUInteger)(image.size.width * scale) * (NSUInteger)(image.size.height * scale);
+}
+
+- (SGImageMemoryCacheShard *)shardForKey:(id)key {
+    NSUInteger hash = [key hash];
+    hash ^= hash >> 16;
+    return _shards[hash % SHARD_COUNT];
+}
+
+// returns the number of bytes evicted
+- (NSUInteger)didEvictEntries:(NSArray <SGImageMemoryCacheEntry *> *)entries {
+    NSUInteger cost = 0;
+    id <NSCacheDelegate> delegate = self.delegate;
+    BOOL notify = [delegate respondsToSelector:@selector(cache:willEvictObject:)];
+    for (SGImageMemoryCacheEntry *entry in entries) {
+        cost += entry->_cost;
+        if (notify) {
+            [delegate cache:self willEvictObject:entry->_object];
+        }
+    }
+    SGCacheMetricsCount(SGCacheCounterMemoryEvictions, entries.count);
+    return cost;
+}
+
+- (void)didRemoveEntry:(SGImageMemoryCacheEntry *)entry {
+    if (entry) {
+        atomic_fetch_sub(&_totalCost, entry->_cost);
+    }
+}
+
+#pragma mark - NSCache
+
+- (id)objectForKey:(id)key {
+    if (!key) {
+        return nil;
+    }
+    id object = [[self shardForKey:key] objectForKey:key counted:YES];
+    SGCacheMetricsCount(object ? SGCacheCounterMemoryHits : SGCacheCounterMemoryMisses, 1);
+    return object;
+}
+
+- (id)uncountedObjectForKey:(id)key {
+    if (!key) {
+        return nil;
+    }
+    return [[self shardForKey:key] objectForKey:key counted:NO];
+}
+
+- (void)setObject:(id)object forKey:(id)key {
+    [self setObject:object forKey:key cost:0];
+}
+
+- (void)setObject:(id)object forKey:(id)key cost:(NSUInteger)cost {
+    if (!key) {
+        return;
+    }
+    if (!object) {
+        [self removeObjectForKey:key];
+        return;
+    }
+    if ([object isKindOfClass:UIImage.class]) {
+        cost = [self.class costForImage:object];
+    }
+
+    // something bigger than the whole budget would only push everything else
+    // out and then itself, so it isn't kept
+    NSUInteger limit = self.totalCostLimit;
+    if (limit && cost > limit) {
+        [self removeObjectForKey:key];
+        return;
+    }
+
+    atomic_fetch_add(&_totalCost, cost);
+    [self didRemoveEntry:[[self shardForKey:key] setObject:object forKey:key cost:cost]];
+    if (limit && atomic_load(&_totalCost) > limit) {
+        [self didEvictEntries:[self evictToCost:limit excludingKeys:nil]];
+    }
+}
+
+- (void)removeObjectForKey:(id)key {
+    if (!key) {
+        return;
+    }
+    [self didRemoveEntry:[[self shardForKey:key] removeObjectForKey:key]];
+}
+
+- (void)removeAllObjects {
+    for (SGImageMemoryCacheShard *shard in _shards) {
+        for (SGImageMemoryCacheEntry *entry in [shard removeAllObjects]) {
+            [self didRemoveEntry:entry];
+        }
+    }
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit {
+    @synchronized (self) {
+        _totalCostLimit = totalCostLimit;
+    }
+    // zero means no limit, as with NSCache
+    if (totalCostLimit) {
+        [self trimToCost:totalCostLimit];
+    }
+}
+
+- (NSUInteger)totalCostLimit {
+    @synchronized (self) {
+        return _totalCostLimit;
+    }
+}
+
+#pragma mark - Trimming
+
+- (void)trimToCost:(NSUInteger)cost {
+    [self trimToCost:cost excludingKeys:nil];
+}
+
+- (NSUInteger)trimToCost:(NSUInteger)cost excludingKeys:(NSSet *)keys {
+    return [self didEvictEntries:[self evictToCost:cost excludingKeys:keys]];
+}
+
+// evicts in global least recently used order, by repeatedly taking the
+// oldest of the shards' oldest entries. one evictor at a time, while lookups
+// and inserts carry on in the shards
+- (NSArray *)evictToCost:(NSUInteger)cost excludingKeys:(NSSet *)keys {
+    NSMutableArray *evicted;
+    pthread_mutex_lock(&_evictionLock);
+    while (atomic_load(&_totalCost) > cost) {
+        SGImageMemoryCacheShard *oldestShard;
+        uint64_t oldest = UINT64_MAX;
+        for (SGImageMemoryCacheShard *shard in _shards) {
+            uint64_t stamp = [shard oldestStampExcludingKeys:keys];
+            if (stamp < oldest) {
+                oldest = stamp;
+                oldestShard = shard;
+            }
+        }
+        SGImageMemoryCacheEntry *entry = [oldestShard evictOldestExcludingKeys:keys];
+        if (!entry) {
+            break;
+        }
+        [self didRemoveEntry:entry];
+        if (!evicted) {
+            evicted = NSMutableArray.new;
+        }
+        [evicted addObject:entry];
+    }
+    pthread_mutex_unlock(&_evictionLock);
+    return evicted;
+}
+
+#pragma mark - Stats
+
+- (NSUInteger)totalCost {
+    return atomic_load(&_totalCost);
+}
+
+- (NSUInteger)count {
+    NSUInteger count = 0;
+    for (SGImageMemoryCacheShard *shard in _shards) {
+        count += shard.count;
+    }
+    return count;
+}
+
+- (unsigned long long)hits {
+    unsigned long long hits = 0;
+    for (SGImageMemoryCacheShard *shard in _shards) {
+        hits += shard.hits;
+    }
+    return hits;
+}
+
+- (unsigned long long)misses {
+    unsigned long long misses = 0;
+    for (SGImageMemoryCacheShard *shard in _shards) {
+        misses += shard.misses;
+    }
+    return misses;
+}
+
+- (unsigned long long)evictions {
+    unsigned long long evictions = 0;
+    for (SGImageMemoryCacheShard *shard in _shards) {
+        evictions += shard.evictions;
+    }
+    return evictions;
+}
+
+@end
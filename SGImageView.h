@@ -16,7 +16,7 @@
 *
 * When assigning an image using one of the `setImageForURL:` methods
 * from `UIImage+SGImageCache`, the `SGImageView` will flush its image
-* if not on screen and the app receives a memory warning. If the image has
+* if not on screen and the system reaches critical memory pressure. If the image has
 * been flushed, the contents will be reloaded from cache if the image view
 * returns to screen.
 */
@@ -10,6 +10,9 @@
 
 #import "SGImageView.h"
 #import "SGImageCache.h"
+#import "SGCachePrivate.h"
+#import "SGImageCachePrivate.h"
+#import "SGCacheDelivery.h"
 #import <MGEvents/MGEvents.h>
 
 @interface SGImageView ()
@@ -18,14 +21,20 @@
 @property (nonatomic,assign) BOOL registeredForNotifications;
 @property (nonatomic,strong) NSString *cachedImageURL;
 @property (nonatomic,strong) NSString *cachedImageName;
+@property (nonatomic,strong) NSOperation *restoreLoad;
 @end
 
 @implementation SGImageView
 
+- (void)dealloc {
+    [_restoreLoad cancel];
+}
+
 - (void)setImageForURL:(NSString *)url
            placeholder:(UIImage *)placeholder
      crossFadeDuration:(NSTimeInterval)duration {
     self.imageReleasingEnabled = YES;
+    [self cancelRestore];
     self.cachedImageName = nil;
     self.cachedImageURL = url;
     [super setImageForURL:url placeholder:placeholder crossFadeDuration:duration];
@@ -33,6 +42,7 @@
 - (void)setImageWithName:(NSString *)name
        crossFadeDuration:(NSTimeInterval)duration {
     self.imageReleasingEnabled = YES;
+    [self cancelRestore];
     self.cachedImageURL = nil;
     self.cachedImageName = name;
     [super setImageWithName:name crossFadeDuration:duration];
@@ -44,6 +54,9 @@
     [super willMoveToWindow:newWindow];
     if (newWindow) {
         [self restoreImageIfAble];
+    } else if (self.restoreLoad && !self.image) { // not needed now, so try again next time
+        [self cancelRestore];
+        self.haveReleasedImage = YES;
     }
 }
 
@@ -57,9 +70,24 @@
             NSLog(@"Restoring image: %@", self.cachedImageName);
         }
     } else if (self.cachedImageURL) {
-        self.image = [SGImageCache imageForURL:self.cachedImageURL];
+        NSString *url = self.cachedImageURL;
+        NSString *cacheKey = [SGImageCache.cache cacheKeyFor:url requestHeaders:nil];
+        UIImage *image = [SGImageCache imageFromMemCacheForCacheKey:cacheKey];
+        if (image) {
+            self.image = image;
+        } else { // read back from disk off the main thread. never fetched again from here
+            __weakSelf me = self;
+            self.restoreLoad = [SGImageCache loadImageFromDiskForCacheKey:cacheKey
+                  priority:NSOperationQueuePriorityHigh thenDo:^(UIImage *image) {
+                [SGCacheDelivery.sharedDelivery deliver:^{
+                    if (image && !me.image && [url isEqualToString:me.cachedImageURL]) {
+                        me.image = image;
+                    }
+                }];
+            }];
+        }
         if (SGImageCache.logging & SGImageCacheLogMemoryFlushing) {
-            NSLog(@"Restoring image: %@", self.cachedImageURL);
+            NSLog(@"Restoring image: %@", url);
         }
     }
     self.haveReleasedImage = NO;
@@ -76,10 +104,16 @@
             NSLog(@"SGImageView releasing image: %@", self.cachedImageName);
         }
     }
+    [self cancelRestore];
     self.image = nil;
     self.haveReleasedImage = YES;
 }
 
+- (void)cancelRestore {
+    [self.restoreLoad cancel];
+    self.restoreLoad = nil;
+}
+
 - (void)setImageReleasingEnabled:(BOOL)imageReleasingEnabled {
     if (_imageReleasingEnabled == imageReleasingEnabled) {
         return;
@@ -99,7 +133,7 @@
     }
     self.registeredForNotifications = YES;
     __weakSelf me = self;
-    [self when:SGImageCache.class does:SGCacheFlushed do:^{
+    [self when:SGImageCache.class does:SGImageCacheReleaseOffscreenImages do:^{
         [me releaseImageIfAble];
     }];
 }
@@ -0,0 +1,132 @@
+//
+//  SGCacheResumeTests.m
+//  Pods
+//
+
+#import <XCTest/XCTest.h>
+#import "SGCache.h"
+#import "SGCacheMetrics.h"
+#import "SGCacheCircuitBreaker.h"
+#import "SGTestHTTPServer.h"
+
+#define FETCH_TIMEOUT 30.0
+#define PAYLOAD_SIZE (256 * 1024)
+
+@interface SGCacheResumeTests : XCTestCase
+@property (nonatomic, strong) SGTestHTTPServer *server;
+@property (nonatomic, strong) NSData *payload;
+@end
+
+@implementation SGCacheResumeTests
+
+- (void)setUp {
+    [super setUp];
+    self.server = SGTestHTTPServer.server;
+    XCTAssertNotNil(self.server);
+    [SGCache setStreamsDownloads:YES];
+    [SGCacheCircuitBreaker.sharedBreaker recordSuccessForHost:@"127.0.0.1"];
+    [SGCacheMetrics.sharedMetrics reset];
+
+    NSMutableData *payload = [NSMutableData dataWithLength:PAYLOAD_SIZE];
+    arc4random_buf(payload.mutableBytes, payload.length);
+    self.payload = payload;
+}
+
+- (void)tearDown {
+    [self.server stop];
+    [super tearDown];
+}
+
+#pragma mark - Helpers
+
+- (NSString *)uniquePath {
+    return [NSString stringWithFormat:@"/%@", NSUUID.UUID.UUIDString];
+}
+
+- (NSData *)fetchURL:(NSString *)url {
+    XCTestExpectation *settled = [self expectationWithDescription:url];
+    __block NSData *result;
+    [SGCache getFileForURL:url].then(^(NSData *data) {
+        result = data;
+        [settled fulfill];
+    }).catch(^(NSError *error) {
+        [settled fulfill];
+    });
+    [self waitForExpectationsWithTimeout:FETCH_TIMEOUT handler:nil];
+    return result;
+}
+
+// the first response is cut off half way, then `later` answers the rest
+- (void)servePath:(NSString *)path cutThen:(SGTestHTTPHandler)later {
+    NSData *payload = self.payload;
+    [self.server handlePath:path with:^SGTestHTTPResponse *(SGTestHTTPRequest *request,
+          NSUInteger count) {
+        if (count > 1) {
+            return later(request, count);
+        }
+        SGTestHTTPResponse *response = [SGTestHTTPResponse responseWithStatus:200 body:payload];
+        response.headers = @{@"ETag" : @"\"v1\""};
+        response.cutAfterBytes = payload.length / 2;
+        return response;
+    }];
+}
+
+#pragma mark - Tests
+
+- (void)testCutDownloadResumesFromWhereItStopped {
+    NSString *path = self.uniquePath;
+    NSData *payload = self.payload;
+    [self servePath:path cutThen:^SGTestHTTPResponse *(SGTestHTTPRequest *request, NSUInteger count) {
+        SGTestHTTPResponse *response = [SGTestHTTPResponse responseWithStatus:200 body:payload];
+        response.headers = @{@"ETag" : @"\"v1\""};
+        return response;
+    }];
+
+    XCTAssertEqualObjects([self fetchURL:[self.server URLForPath:path]], payload);
+    NSArray <SGTestHTTPRequest *> *requests = [self.server requestsForPath:path];
+    XCTAssertEqual(requests.count, 2);
+    XCTAssertTrue([requests[1].headers[@"range"] hasPrefix:@"bytes="]);
+    XCTAssertEqualObjects(requests[1].headers[@"if-range"], @"\"v1\"");
+    XCTAssertGreaterThan([SGCacheMetrics.sharedMetrics.snapshot
+          valueForCounter:SGCacheCounterBytesResumed], 0);
+}
+
+- (void)testChangedContentIsFetchedInFull {
+    NSString *path = self.uniquePath;
+    NSData *changed = [self.payload subdataWithRange:NSMakeRange(0, PAYLOAD_SIZE / 4)];
+    [self servePath:path cutThen:^SGTestHTTPResponse *(SGTestHTTPRequest *request, NSUInteger count) {
+        SGTestHTTPResponse *response = [SGTestHTTPResponse responseWithStatus:200 body:changed];
+        response.headers = @{@"ETag" : @"\"v2\""}; // If-Range doesn't match, so no 206
+        return response;
+    }];
+
+    XCTAssertEqualObjects([self fetchURL:[self.server URLForPath:path]], changed);
+    XCTAssertEqual([self.server requestsForPath:path].count, 2);
+}
+
+- (void)testMisplacedRangeIsRefetchedInSameAttempt {
+    NSString *path = self.uniquePath;
+    NSData *payload = self.payload;
+    [self servePath:path cutThen:^SGTestHTTPResponse *(SGTestHTTPRequest *request, NSUInteger count) {
+        if (request.headers[@"range"]) { // the whole body, mislabelled as a range
+            SGTestHTTPResponse *response = [SGTestHTTPResponse responseWithStatus:206 body:payload];
+            response.headers = @{@"ETag" : @"\"v1\"", @"Content-Range" : [NSString
+                  stringWithFormat:@"bytes 0-%lu/%lu", (unsigned long)payload.length - 1,
+                  (unsigned long)payload.length]};
+            return response;
+        }
+        SGTestHTTPResponse *response = [SGTestHTTPResponse responseWithStatus:200 body:payload];
+        response.headers = @{@"ETag" : @"\"v1\""};
+        return response;
+    }];
+
+    XCTAssertEqualObjects([self fetchURL:[self.server URLForPath:path]], payload);
+    NSArray <SGTestHTTPRequest *> *requests = [self.server requestsForPath:path];
+    XCTAssertEqual(requests.count, 3);
+    XCTAssertNil(requests[2].headers[@"range"]);
+
+    // only the cut counts as a failed attempt
+    XCTAssertEqual([SGCacheMetrics.sharedMetrics.snapshot valueForCounter:SGCacheCounterRetries], 1);
+}
+
+@end
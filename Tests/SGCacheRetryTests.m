@@ -0,0 +1,206 @@
+//
+//  SGCacheRetryTests.m
+//  Pods
+//
+
+#import <XCTest/XCTest.h>
+#import "SGCache.h"
+#import "SGCacheCircuitBreaker.h"
+#import "SGTestHTTPServer.h"
+
+// as in SGCache.m and SGCacheCircuitBreaker.m
+#define MAX_RETRIES 5
+#define RETRY_BASE_DELAY 0.5
+#define FAILURE_THRESHOLD 5
+
+#define FETCH_TIMEOUT 30.0
+#define TIMING_SLACK 1.0
+
+@interface SGCacheRetryTests : XCTestCase
+@property (nonatomic, strong) SGTestHTTPServer *server;
+@end
+
+@implementation SGCacheRetryTests
+
+- (void)setUp {
+    [super setUp];
+    self.server = SGTestHTTPServer.server;
+    XCTAssertNotNil(self.server);
+    [SGCache setStreamsDownloads:YES];
+    // every test talks to the same host, so each starts with its circuit closed
+    [SGCacheCircuitBreaker.sharedBreaker recordSuccessForHost:@"127.0.0.1"];
+}
+
+- (void)tearDown {
+    [self.server stop];
+    [SGCache setStreamsDownloads:YES];
+    [super tearDown];
+}
+
+#pragma mark - Helpers
+
+- (NSString *)uniquePath {
+    return [NSString stringWithFormat:@"/%@", NSUUID.UUID.UUIDString];
+}
+
+- (NSData *)payload {
+    NSMutableData *data = [NSMutableData dataWithLength:32 * 1024];
+    arc4random_buf(data.mutableBytes, data.length);
+    return data;
+}
+
+// waits for the fetch to settle, returning nil if it failed
+- (NSData *)fetchURL:(NSString *)url {
+    XCTestExpectation *settled = [self expectationWithDescription:url];
+    __block NSData *result;
+    [SGCache getFileForURL:url].then(^(NSData *data) {
+        result = data;
+        [settled fulfill];
+    }).catch(^(NSError *error) {
+        [settled fulfill];
+    });
+    [self waitForExpectationsWithTimeout:FETCH_TIMEOUT handler:nil];
+    return result;
+}
+
+- (void)failPath:(NSString *)path withStatus:(NSInteger)status {
+    [self.server handlePath:path with:^SGTestHTTPResponse *(SGTestHTTPRequest *request,
+          NSUInteger count) {
+        return [SGTestHTTPResponse responseWithStatus:status body:nil];
+    }];
+}
+
+- (void)failPath:(NSString *)path withStatus:(NSInteger)status times:(NSUInteger)times
+      thenServe:(NSData *)data {
+    [self.server handlePath:path with:^SGTestHTTPResponse *(SGTestHTTPRequest *request,
+          NSUInteger count) {
+        return [SGTestHTTPResponse responseWithStatus:count > times ? 200 : status
+              body:count > times ? data : nil];
+    }];
+}
+
+#pragma mark - Retry
+
+- (void)testServerErrorsAreRetried {
+    NSString *path = self.uniquePath;
+    NSData *payload = self.payload;
+    [self failPath:path withStatus:503 times:2 thenServe:payload];
+
+    NSString *url = [self.server URLForPath:path];
+    XCTAssertEqualObjects([self fetchURL:url], payload);
+    XCTAssertEqual([self.server requestsForPath:path].count, 3);
+    XCTAssertTrue([SGCache haveFileForURL:url]);
+}
+
+- (void)testServerErrorsAreRetriedWithoutStreaming {
+    [SGCache setStreamsDownloads:NO];
+    NSString *path = self.uniquePath;
+    NSData *payload = self.payload;
+    [self failPath:path withStatus:500 times:2 thenServe:payload];
+
+    XCTAssertEqualObjects([self fetchURL:[self.server URLForPath:path]], payload);
+    XCTAssertEqual([self.server requestsForPath:path].count, 3);
+}
+
+- (void)testRetriesStopAfterMaxAttempts {
+    NSString *path = self.uniquePath;
+    [self failPath:path withStatus:503];
+
+    XCTAssertNil([self fetchURL:[self.server URLForPath:path]]);
+    XCTAssertEqual([self.server requestsForPath:path].count, MAX_RETRIES);
+}
+
+- (void)testClientErrorsAreNotRetried {
+    NSString *path = self.uniquePath;
+    [self failPath:path withStatus:404];
+
+    XCTAssertNil([self fetchURL:[self.server URLForPath:path]]);
+    XCTAssertEqual([self.server requestsForPath:path].count, 1);
+}
+
+- (void)testBodyCutShortIsRetried {
+    NSString *path = self.uniquePath;
+    NSData *payload = self.payload;
+    [self.server handlePath:path with:^SGTestHTTPResponse *(SGTestHTTPRequest *request,
+          NSUInteger count) {
+        SGTestHTTPResponse *response = [SGTestHTTPResponse responseWithStatus:200 body:payload];
+        response.honoursRanges = NO;
+        response.cutAfterBytes = count == 1 ? payload.length / 2 : 0;
+        return response;
+    }];
+
+    XCTAssertEqualObjects([self fetchURL:[self.server URLForPath:path]], payload);
+    XCTAssertEqual([self.server requestsForPath:path].count, 2);
+}
+
+#pragma mark - Backoff
+
+- (void)testRetriesBackOff {
+    NSString *path = self.uniquePath;
+    [self failPath:path withStatus:503];
+
+    XCTAssertNil([self fetchURL:[self.server URLForPath:path]]);
+    NSArray <SGTestHTTPRequest *> *requests = [self.server requestsForPath:path];
+    XCTAssertEqual(requests.count, MAX_RETRIES);
+
+    // each wait is jittered below a cap that doubles, so only the caps and the
+    // total can be checked
+    NSTimeInterval total = 0;
+    for (NSUInteger i = 1; i < requests.count; i++) {
+        NSTimeInterval gap = [requests[i].receivedAt timeIntervalSinceDate:requests[i - 1].receivedAt];
+        XCTAssertLessThan(gap, RETRY_BASE_DELAY * pow(2, i - 1) + TIMING_SLACK);
+        total += gap;
+    }
+    XCTAssertGreaterThan(total, 0.05, @"retries went out back to back");
+}
+
+#pragma mark - Circuit Breaker
+
+- (void)testCircuitOpensAfterRepeatedServerErrors {
+    NSString *failing = self.uniquePath;
+    [self failPath:failing withStatus:503];
+    XCTAssertNil([self fetchURL:[self.server URLForPath:failing]]);
+    XCTAssertFalse([SGCacheCircuitBreaker.sharedBreaker allowRequestToHost:@"127.0.0.1"]);
+
+    // the open circuit keeps other requests to the host off the network
+    NSString *healthy = self.uniquePath;
+    [self.server serveData:self.payload forPath:healthy];
+    XCTAssertNil([self fetchURL:[self.server URLForPath:healthy]]);
+    XCTAssertEqual([self.server requestsForPath:healthy].count, 0);
+}
+
+- (void)testErrorRateBelowThresholdKeepsCircuitClosed {
+    NSString *path = self.uniquePath;
+    NSData *payload = self.payload;
+    [self failPath:path withStatus:503 times:FAILURE_THRESHOLD - 1 thenServe:payload];
+
+    XCTAssertEqualObjects([self fetchURL:[self.server URLForPath:path]], payload);
+    XCTAssertTrue([SGCacheCircuitBreaker.sharedBreaker allowRequestToHost:@"127.0.0.1"]);
+}
+
+- (void)testClientErrorsDontOpenCircuit {
+    for (int i = 0; i < FAILURE_THRESHOLD + 1; i++) {
+        NSString *path = self.uniquePath;
+        [self failPath:path withStatus:404];
+        XCTAssertNil([self fetchURL:[self.server URLForPath:path]]);
+    }
+    XCTAssertTrue([SGCacheCircuitBreaker.sharedBreaker allowRequestToHost:@"127.0.0.1"]);
+}
+
+- (void)testRefusedConnectionsOpenCircuit {
+    NSString *url = [self.server URLForPath:self.uniquePath];
+    [self.server stop];
+
+    XCTAssertNil([self fetchURL:url]);
+    XCTAssertFalse([SGCacheCircuitBreaker.sharedBreaker allowRequestToHost:@"127.0.0.1"]);
+}
+
+- (void)testUnresolvableHostDoesntOpenCircuit {
+    // a lookup failure is about our network as much as the host, so it isn't held against it
+    NSString *host = @"sgimagecache-test.invalid";
+    XCTAssertNil([self fetchURL:[NSString stringWithFormat:@"http://%@/%@", host,
+          NSUUID.UUID.UUIDString]]);
+    XCTAssertTrue([SGCacheCircuitBreaker.sharedBreaker allowRequestToHost:host]);
+}
+
+@end
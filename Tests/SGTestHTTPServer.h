@@ -0,0 +1,90 @@
+//
+//  SGTestHTTPServer.h
+//  Pods
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+* What the server sends back for one request.
+*/
+
+@interface SGTestHTTPResponse : NSObject
+
+@property (nonatomic, assign) NSInteger statusCode;
+@property (nonatomic, copy) NSDictionary *headers;
+@property (nonatomic, copy) NSData *body;
+
+/** Seconds to wait before sending anything. */
+@property (nonatomic, assign) NSTimeInterval delay;
+
+/**
+* If non zero, the connection is closed after this many body bytes, while
+* the `Content-Length` header still promises the whole body.
+*/
+@property (nonatomic, assign) NSUInteger cutAfterBytes;
+
+/**
+* Answer a `Range` request with a 206 and the rest of the body, unless an
+* `If-Range` header doesn't match the response's `ETag`. Defaults to YES.
+*/
+@property (nonatomic, assign) BOOL honoursRanges;
+
++ (instancetype)responseWithStatus:(NSInteger)statusCode body:(NSData *)body;
+
+@end
+
+/**
+* A request as the server received it. Header names are lowercased.
+*/
+
+@interface SGTestHTTPRequest : NSObject
+
+@property (nonatomic, readonly) NSString *method;
+@property (nonatomic, readonly) NSString *path;
+@property (nonatomic, readonly) NSDictionary *headers;
+@property (nonatomic, readonly) NSDate *receivedAt;
+
+@end
+
+/**
+* Called on a background queue with the request, and the number of requests
+* made for its path so far, including this one.
+*/
+typedef SGTestHTTPResponse *(^SGTestHTTPHandler)(SGTestHTTPRequest *request, NSUInteger count);
+
+/**
+* A minimal HTTP/1.1 server on 127.0.0.1, for exercising the cache against
+* slow and failing hosts without leaving the process. Each connection serves
+* one request and is then closed. Paths without a handler get a 404.
+*/
+
+@interface SGTestHTTPServer : NSObject
+
+@property (nonatomic, readonly) uint16_t port;
+
+/** Seconds added before every response. */
+@property (atomic, assign) NSTimeInterval latency;
+
+/** Caps the rate bodies are sent at. Zero for no cap. */
+@property (atomic, assign) NSUInteger bytesPerSecond;
+
+/** The fraction of requests, from 0 to 1, answered with a 503 instead. */
+@property (atomic, assign) double errorRate;
+
+/** Returns a server already listening on a free port. */
++ (instancetype)server;
+
+- (NSString *)URLForPath:(NSString *)path;
+- (void)handlePath:(NSString *)path with:(SGTestHTTPHandler)handler;
+
+/** Serves the same body for every request to the path. */
+- (void)serveData:(NSData *)data forPath:(NSString *)path;
+
+- (NSArray <SGTestHTTPRequest *> *)requestsForPath:(NSString *)path;
+- (NSUInteger)requestCount;
+
+/** Stops listening and drops any open connections. */
+- (void)stop;
+
+@end
@@ -0,0 +1,320 @@
+//
+//  SGTestHTTPServer.m
+//  Pods
+//
+
+#import "SGTestHTTPServer.h"
+#import "SGCache.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <unistd.h>
+
+#define MAX_REQUEST_HEAD_SIZE (64 * 1024)
+#define SEND_CHUNK_SIZE 4096
+
+@implementation SGTestHTTPResponse
+
++ (instancetype)responseWithStatus:(NSInteger)statusCode body:(NSData *)body {
+    SGTestHTTPResponse *response = self.new;
+    response.statusCode = statusCode;
+    response.body = body;
+    return response;
+}
+
+- (id)init {
+    self = [super init];
+    _statusCode = 200;
+    _honoursRanges = YES;
+    return self;
+}
+
+@end
+
+@interface SGTestHTTPRequest ()
+@property (nonatomic, copy) NSString *method;
+@property (nonatomic, copy) NSString *path;
+@property (nonatomic, copy) NSDictionary *headers;
+@property (nonatomic, strong) NSDate *receivedAt;
+@end
+
+@implementation SGTestHTTPRequest
+@end
+
+@interface SGTestHTTPServer ()
+@property (nonatomic, assign) uint16_t port;
+@property (nonatomic, assign) int listenSocket;
+@property (nonatomic, strong) dispatch_source_t acceptSource;
+@property (nonatomic, strong) dispatch_queue_t connectionQueue;
+@property (nonatomic, strong) NSMutableDictionary *handlers;
+@property (nonatomic, strong) NSMutableDictionary *requests;
+@property (nonatomic, strong) NSMutableSet *openSockets;
+@property (nonatomic, assign) BOOL stopped;
+@end
+
+@implementation SGTestHTTPServer
+
++ (instancetype)server {
+    SGTestHTTPServer *server = self.new;
+    return [server start] ? server : nil;
+}
+
+- (id)init {
+    self = [super init];
+    self.handlers = NSMutableDictionary.new;
+    self.requests = NSMutableDictionary.new;
+    self.openSockets = NSMutableSet.new;
+    self.connectionQueue = dispatch_queue_create("SGTestHTTPServer.connections",
+          DISPATCH_QUEUE_CONCURRENT);
+    return self;
+}
+
+- (void)dealloc {
+    [self stop];
+}
+
+- (BOOL)start {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return NO;
+    }
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    // loopback only, on whatever port is free
+    struct sockaddr_in addr = {0};
+    addr.sin_len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, length) < 0 || listen(fd, 64) < 0
+          || getsockname(fd, (struct sockaddr *)&addr, &length) < 0) {
+        close(fd);
+        return NO;
+    }
+    self.port = ntohs(addr.sin_port);
+    self.listenSocket = fd;
+
+    __weakSelf me = self;
+    self.acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, fd, 0,
+          dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+    dispatch_source_set_event_handler(self.acceptSource, ^{
+        [me acceptConnection];
+    });
+    dispatch_source_set_cancel_handler(self.acceptSource, ^{
+        close(fd);
+    });
+    dispatch_resume(self.acceptSource);
+    return YES;
+}
+
+- (void)stop {
+    @synchronized (self) {
+        if (self.stopped) {
+            return;
+        }
+        self.stopped = YES;
+        // wakes any connection blocked reading or writing, which then closes itself
+        for (NSNumber *fd in self.openSockets) {
+            shutdown(fd.intValue, SHUT_RDWR);
+        }
+    }
+    if (self.acceptSource) {
+        dispatch_source_cancel(self.acceptSource);
+    }
+}
+
+#pragma mark - Handlers
+
+- (NSString *)URLForPath:(NSString *)path {
+    return [NSString stringWithFormat:@"http://127.0.0.1:%u%@", self.port, path];
+}
+
+- (void)handlePath:(NSString *)path with:(SGTestHTTPHandler)handler {
+    @synchronized (self) {
+        self.handlers[path] = [handler copy];
+    }
+}
+
+- (void)serveData:(NSData *)data forPath:(NSString *)path {
+    [self handlePath:path with:^SGTestHTTPResponse *(SGTestHTTPRequest *request, NSUInteger count) {
+        return [SGTestHTTPResponse responseWithStatus:200 body:data];
+    }];
+}
+
+- (NSArray <SGTestHTTPRequest *> *)requestsForPath:(NSString *)path {
+    @synchronized (self) {
+        return [self.requests[path] copy] ?: @[];
+    }
+}
+
+- (NSUInteger)requestCount {
+    @synchronized (self) {
+        NSUInteger count = 0;
+        for (NSArray *requests in self.requests.allValues) {
+            count += requests.count;
+        }
+        return count;
+    }
+}
+
+#pragma mark - Connections
+
+- (void)acceptConnection {
+    int fd = accept(self.listenSocket, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+    @synchronized (self) {
+        if (self.stopped) {
+            close(fd);
+            return;
+        }
+        [self.openSockets addObject:@(fd)];
+    }
+    dispatch_async(self.connectionQueue, ^{
+        [self serveConnection:fd];
+        @synchronized (self) {
+            [self.openSockets removeObject:@(fd)];
+        }
+        close(fd);
+    });
+}
+
+- (void)serveConnection:(int)fd {
+    NSData *end = [@"\r\n\r\n" dataUsingEncoding:NSASCIIStringEncoding];
+    NSMutableData *head = NSMutableData.data;
+    char buffer[SEND_CHUNK_SIZE];
+    while ([head rangeOfData:end options:0 range:NSMakeRange(0, head.length)].location
+          == NSNotFound) {
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got <= 0 || head.length > MAX_REQUEST_HEAD_SIZE) {
+            return;
+        }
+        [head appendBytes:buffer length:(NSUInteger)got];
+    }
+
+    SGTestHTTPRequest *request = [self requestFromHead:head];
+    if (!request) {
+        return;
+    }
+    SGTestHTTPHandler handler;
+    NSUInteger count;
+    @synchronized (self) {
+        NSMutableArray *seen = self.requests[request.path];
+        if (!seen) {
+            seen = self.requests[request.path] = NSMutableArray.new;
+        }
+        [seen addObject:request];
+        count = seen.count;
+        handler = self.handlers[request.path];
+    }
+
+    SGTestHTTPResponse *response;
+    if (self.errorRate > 0 && arc4random_uniform(1000) < self.errorRate * 1000) {
+        response = [SGTestHTTPResponse responseWithStatus:503 body:nil];
+    } else if (handler) {
+        response = handler(request, count);
+    }
+    if (!response) {
+        response = [SGTestHTTPResponse responseWithStatus:404 body:nil];
+    }
+
+    NSTimeInterval wait = self.latency + response.delay;
+    if (wait > 0) {
+        [NSThread sleepForTimeInterval:wait];
+    }
+    [self sendResponse:response forRequest:request toSocket:fd];
+}
+
+- (SGTestHTTPRequest *)requestFromHead:(NSData *)head {
+    NSString *string = [NSString.alloc initWithData:head encoding:NSISOLatin1StringEncoding];
+    NSArray *lines = [string componentsSeparatedByString:@"\r\n"];
+    NSArray *requestLine = [lines.firstObject componentsSeparatedByString:@" "];
+    if (requestLine.count != 3) {
+        return nil;
+    }
+    NSMutableDictionary *headers = NSMutableDictionary.new;
+    for (NSString *line in [lines subarrayWithRange:NSMakeRange(1, lines.count - 1)]) {
+        NSRange colon = [line rangeOfString:@":"];
+        if (colon.location == NSNotFound) {
+            continue;
+        }
+        NSString *name = [line substringToIndex:colon.location].lowercaseString;
+        headers[name] = [[line substringFromIndex:colon.location + 1]
+              stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+    }
+    SGTestHTTPRequest *request = SGTestHTTPRequest.new;
+    request.method = requestLine[0];
+    request.path = requestLine[1];
+    request.headers = headers;
+    request.receivedAt = NSDate.date;
+    return request;
+}
+
+- (void)sendResponse:(SGTestHTTPResponse *)response forRequest:(SGTestHTTPRequest *)request
+      toSocket:(int)fd {
+    NSData *body = response.body ?: NSData.data;
+    NSInteger status = response.statusCode;
+    NSMutableDictionary *headers = NSMutableDictionary.new;
+    [headers addEntriesFromDictionary:response.headers];
+
+    // a range is served only if the validator the client has is still current
+    NSString *range = request.headers[@"range"];
+    NSString *ifRange = request.headers[@"if-range"];
+    unsigned long long start = 0;
+    NSScanner *scanner = range ? [NSScanner scannerWithString:range] : nil;
+    if (status == 200 && response.honoursRanges
+          && (!ifRange || [ifRange isEqualToString:response.headers[@"ETag"]])
+          && [scanner scanString:@"bytes=" intoString:NULL]
+          && [scanner scanUnsignedLongLong:&start] && start < body.length) {
+        headers[@"Content-Range"] = [NSString stringWithFormat:@"bytes %llu-%lu/%lu", start,
+              (unsigned long)body.length - 1, (unsigned long)body.length];
+        body = [body subdataWithRange:NSMakeRange((NSUInteger)start, body.length - (NSUInteger)start)];
+        status = 206;
+    }
+    headers[@"Content-Length"] = @(body.length).stringValue;
+    headers[@"Connection"] = @"close";
+
+    NSMutableString *head = [NSMutableString stringWithFormat:@"HTTP/1.1 %ld %@\r\n",
+          (long)status, [NSHTTPURLResponse localizedStringForStatusCode:status]];
+    for (NSString *name in headers) {
+        [head appendFormat:@"%@: %@\r\n", name, headers[name]];
+    }
+    [head appendString:@"\r\n"];
+    NSData *headData = [head dataUsingEncoding:NSISOLatin1StringEncoding];
+    if (![self writeBytes:headData.bytes length:headData.length toSocket:fd]) {
+        return;
+    }
+
+    // the body goes in chunks, so it can be throttled or cut short
+    NSUInteger length = body.length;
+    if (response.cutAfterBytes) {
+        length = MIN(length, response.cutAfterBytes);
+    }
+    NSUInteger bytesPerSecond = self.bytesPerSecond;
+    for (NSUInteger sent = 0; sent < length; sent += SEND_CHUNK_SIZE) {
+        NSUInteger chunk = MIN(SEND_CHUNK_SIZE, length - sent);
+        if (![self writeBytes:(const char *)body.bytes + sent length:chunk toSocket:fd]) {
+            return;
+        }
+        if (bytesPerSecond) {
+            [NSThread sleepForTimeInterval:(double)chunk / bytesPerSecond];
+        }
+    }
+}
+
+- (BOOL)writeBytes:(const void *)bytes length:(NSUInteger)length toSocket:(int)fd {
+    NSUInteger written = 0;
+    while (written < length) {
+        ssize_t count = write(fd, (const char *)bytes + written, length - written);
+        if (count <= 0) {
+            return NO;
+        }
+        written += (NSUInteger)count;
+    }
+    return YES;
+}
+
+@end
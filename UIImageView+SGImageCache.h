@@ -7,6 +7,10 @@
 /**
 * A `UIImageView` category with convenience setters for loading images from
 * <SGImageCache>.
+*
+* An image view subscribes to the fetch for the image it's waiting on, and
+* unsubscribes when given a different image or deallocated. A fetch with no
+* subscribers left is cancelled.
 */
 
 #define SGImageViewImageChanged     @"SGImageViewImageChanged"
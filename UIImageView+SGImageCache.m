@@ -6,16 +6,52 @@
 
 #import "UIImageView+SGImageCache.h"
 #import "SGImageCache.h"
+#import "SGCachePrivate.h"
+#import "SGImageCachePrivate.h"
 #import <MGEvents/MGEvents.h>
 #import <objc/runtime.h>
 
+// Holds the image view's fetch promises for one URL, and unsubscribes from
+// them when released, whether because the image view was given something
+// else to show or was deallocated.
+@interface SGImageViewSubscription : NSObject
+@property (nonatomic, copy) NSString *url;
+@property (nonatomic, strong) NSMutableArray *promises;
+@end
+
+@implementation SGImageViewSubscription
+
+- (id)init {
+    self = [super init];
+    _promises = NSMutableArray.new;
+    return self;
+}
+
+- (void)dealloc {
+    for (SGCachePromise *promise in _promises) {
+        [SGImageCache unsubscribeFromPromise:promise];
+    }
+}
+
+@end
+
 @interface UIImageView (SGImageCache_Private)
 @property (nonatomic,strong) NSString *cachedImageURL;
+@property (nonatomic,strong) SGImageViewSubscription *imageSubscription;
 @end
 
 @implementation UIImageView (SGImageCache_Private)
 
 @dynamic cachedImageURL;
+@dynamic imageSubscription;
+
+- (void)setImageSubscription:(SGImageViewSubscription *)object {
+     objc_setAssociatedObject(self, @selector(imageSubscription), object, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+- (SGImageViewSubscription *)imageSubscription {
+    return objc_getAssociatedObject(self, @selector(imageSubscription));
+}
 
 - (void)setCachedImageURL:(NSString*)object {
      objc_setAssociatedObject(self, @selector(cachedImageURL), object, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
@@ -57,10 +93,14 @@
             stillValid:(BOOL(^)(void))stillValid {
     __weakSelf me = self;
 
+    NSString *cacheKey = [SGImageCache.cache cacheKeyFor:url requestHeaders:nil];
     self.cachedImageURL = url;
+    [SGImageCache setDisplayedCacheKey:cacheKey forImageView:self];
 
-    if ([SGImageCache haveImageForURL:url]) {
-        UIImage *image = [SGImageCache imageForURL:url];
+    // only memory is checked here. disk hits are read and decoded off the main thread
+    UIImage *image = [SGImageCache imageFromMemCacheForCacheKey:cacheKey];
+    if (image) {
+        self.imageSubscription = nil;
         self.image = image;
         [self trigger:SGImageViewImageChanged withContext:image];        
     } else {
@@ -68,7 +108,10 @@
             self.image = placeholder;
             [me trigger:SGImageViewImageChanged withContext:placeholder];
         }
-        [SGImageCache getImageForURL:url].then(^(UIImage *image) {
+
+        // set in the delivery batch, inside its frame budget, rather than in a
+        // promise handler
+        void (^delivered)(UIImage *) = ^(UIImage *image) {
             if (!image) {
                 return;
             }
@@ -91,7 +134,16 @@
                 me.image = image;
                 [me trigger:SGImageViewImageChanged withContext:image];
             }
-        });
+        };
+
+        // releasing the previous subscription lets its fetch be cancelled
+        SGCachePromise *promise = [SGImageCache getImageForURL:url requestHeaders:nil
+              cacheKey:cacheKey onDelivery:delivered];
+        if (![self.imageSubscription.url isEqualToString:url]) {
+            self.imageSubscription = SGImageViewSubscription.new;
+            self.imageSubscription.url = url;
+        }
+        [self.imageSubscription.promises addObject:promise];
     }
 }
 
@@ -104,6 +156,8 @@
 - (void)setImageWithName:(NSString *)name
        crossFadeDuration:(NSTimeInterval)duration {
     __weakSelf me = self;
+    self.imageSubscription = nil;
+    [SGImageCache setDisplayedCacheKey:name forImageView:self];
     if (duration > 0 && me.window) {
         UIImage *image = [SGImageCache imageNamed:name];
         [UIView transitionWithView:me.superview